@@ -18,6 +18,8 @@
 #define SYSTEM4_ASSET_MANAGER_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct archive_data;
 struct cg;
@@ -44,8 +46,37 @@ struct archive_data *asset_get(enum asset_type type, int no);
 struct archive_data *asset_get_by_name(enum asset_type type, const char *name, int *id_out);
 
 struct cg *asset_cg_load(int no);
+// Decode a CG without going through the cache. Use these instead of calling
+// the libsys4 decoders directly, since CGs may be decoded in the background.
+struct cg *asset_cg_decode(struct archive_data *data);
+struct cg *asset_cg_decode_buffer(uint8_t *buf, size_t size);
+struct cg *asset_cg_decode_file(const char *path);
 struct cg *asset_cg_load_by_name(const char *name, int *id_out);
 bool asset_cg_get_metrics(int no, struct cg_metrics *metrics);
 bool asset_cg_get_metrics_by_name(const char *name, struct cg_metrics *metrics);
 
+struct asset_cg_cache_stats {
+	int nr_entries;
+	int max_entries;
+	size_t bytes;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
+void asset_cg_cache_init(int nr_entries);
+void asset_cg_cache_clear(void);
+void asset_cg_cache_get_stats(struct asset_cg_cache_stats *stats);
+
+struct asset_cg_decode_stats {
+	int nr_jobs;
+	unsigned long prefetches;
+	unsigned long waits;
+};
+
+// Decode a CG in the background so that a later asset_cg_load is cheap.
+void asset_cg_prefetch(int no);
+void asset_cg_prefetch_by_name(const char *name);
+void asset_cg_decode_get_stats(struct asset_cg_decode_stats *stats);
+
 #endif /* SYSTEM4_ASSET_MANAGER_H */
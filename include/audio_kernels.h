@@ -0,0 +1,44 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_AUDIO_KERNELS_H
+#define SYSTEM4_AUDIO_KERNELS_H
+
+/*
+ * Sample processing kernels for the audio path. All samples are float, and
+ * stereo data is interleaved. An implementation is selected at runtime
+ * based on the instruction sets supported by the CPU.
+ */
+struct audio_kernels {
+	const char *name;
+	// acc[i] += clamp(src[i] * gain), for N samples
+	void (*mix)(float *acc, const float *src, float gain, unsigned n);
+	// dst[i] = clamp(src[i] * gain), for N samples
+	void (*scale)(float *dst, const float *src, float gain, unsigned n);
+	// expand FRAMES mono samples at the start of DATA to stereo, in place
+	void (*mono_to_stereo)(float *data, unsigned frames);
+	// swap left and right channels (DST may equal SRC)
+	void (*swap_lr)(float *dst, const float *src, unsigned frames);
+};
+
+extern const struct audio_kernels *audio_kernels;
+
+void audio_kernels_init(void);
+
+// Time each available implementation against the scalar one.
+void audio_kernels_benchmark(void);
+
+#endif /* SYSTEM4_AUDIO_KERNELS_H */
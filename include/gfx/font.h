@@ -43,10 +43,43 @@ enum font_weight {
 };
 #define NR_FONT_WEIGHTS (FONT_WEIGHT_HEAVY+1)
 
+/*
+ * Glyphs are packed into per-size atlas textures, in rows ("shelves") of
+ * similar height. When every page of an atlas is full, the oldest page is
+ * cleared and the glyphs on it are re-rendered on their next use.
+ */
+#define GLYPH_ATLAS_SIZE 1024
+#define GLYPH_ATLAS_MAX_PAGES 4
+#define GLYPH_ATLAS_MAX_SHELVES 128
+
+struct glyph_shelf {
+	int x, y, h;
+};
+
+struct glyph_atlas_page {
+	Texture t;
+	unsigned generation;
+	int nr_shelves;
+	struct glyph_shelf shelves[GLYPH_ATLAS_MAX_SHELVES];
+};
+
+struct glyph_atlas {
+	int nr_pages;
+	int next_eviction;
+	struct glyph_atlas_page *pages[GLYPH_ATLAS_MAX_PAGES];
+};
+
+// The location of a rendered glyph within an atlas.
+struct glyph_cell {
+	struct glyph_atlas_page *page;
+	unsigned generation;
+	Rectangle r;
+};
+
 struct glyph {
-	Rectangle rect;
+	Rectangle rect; // position of the glyph within its cell
 	float advance;
-	Texture t[NR_FONT_WEIGHTS];
+	struct glyph_cell cell[NR_FONT_WEIGHTS];
 };
 
 struct font_size {
@@ -54,8 +87,14 @@ struct font_size {
 	int y_offset;
 	struct font *font;
 	struct hash_table *glyph_table;
+	struct glyph_atlas atlas;
 };
 
+static inline bool glyph_cell_valid(struct glyph_cell *cell)
+{
+	return cell->page && cell->generation == cell->page->generation;
+}
+
 enum charmap {
 	CHARMAP_UNICODE,
 	CHARMAP_SJIS
@@ -135,6 +174,8 @@ void gfx_font_init(void);
 void ft_font_init(void);
 struct font *ft_font_load(const char *path);
 struct font *fnl_font_load(struct fnl *lib, unsigned index);
+bool glyph_atlas_add(struct font_size *size, struct glyph *glyph, enum font_weight weight,
+		int w, int h, uint8_t *pixels);
 
 bool gfx_set_font(enum font_face face, unsigned int size);
 bool gfx_set_font_size(unsigned int size);
@@ -67,6 +67,30 @@ struct gfx_render_job {
 	void *data;
 };
 
+enum gfx_pass {
+	GFX_PASS_SCENE,
+	GFX_PASS_PARTS,
+	GFX_PASS_3D,
+	GFX_PASS_DUNGEON,
+	GFX_PASS_EFFECT,
+	GFX_NR_PASSES
+};
+
+struct gfx_frame_stats {
+	unsigned draw_calls;
+	unsigned shader_switches;
+	unsigned texture_binds;
+	unsigned fbo_switches;
+	unsigned texture_uploads;
+	uint64_t upload_bytes;
+	// GPU time spent in each pass (valid if gpu_timing is set)
+	bool gpu_timing;
+	uint64_t gpu_ns[GFX_NR_PASSES];
+};
+
+// Counters for the frame currently being drawn.
+extern struct gfx_frame_stats gfx_stats;
+
 struct gfx_vertex {
 	GLfloat x, y, z, w;
 	GLfloat u, v;
@@ -83,6 +107,20 @@ void gfx_toggle_fullscreen(void);
 void gfx_update_screen_scale(void);
 void gfx_set_wait_vsync(bool wait);
 float gfx_get_frame_rate(void);
+unsigned gfx_get_swap_count(void);
+void gfx_present_texture(struct texture *t, Rectangle *r);
+
+// frame_stats.c
+void gfx_frame_stats_init(void);
+void gfx_frame_stats_end_frame(void);
+void gfx_frame_stats_render_overlay(void);
+void gfx_get_frame_stats(struct gfx_frame_stats *stats);
+void gfx_frame_stats_enable_gpu_timing(void);
+void gfx_frame_stats_set_overlay(bool enabled);
+bool gfx_frame_stats_get_overlay(void);
+const char *gfx_pass_name(enum gfx_pass pass);
+void gfx_pass_begin(enum gfx_pass pass);
+void gfx_pass_end(enum gfx_pass pass);
 
 void gfx_load_shader(struct shader *dst, const char *vertex_shader_path, const char *fragment_shader_path);
 GLuint gfx_load_shader_file(const char *path, GLenum type, const char *defines);
@@ -92,11 +130,15 @@ void gfx_set_clear_color(int r, int g, int b, int a);
 void gfx_set_view_offset(int x, int y);
 void gfx_clear(void);
 void gfx_swap(void);
+void gfx_set_clip_rect(Rectangle *r);
 void gfx_set_view(struct texture *t);
 void gfx_reset_view(void);
 void gfx_prepare_job(struct gfx_render_job *job);
 void gfx_run_job(struct gfx_render_job *job);
 void gfx_render(struct gfx_render_job *job);
+void gfx_batch_begin(void);
+void gfx_batch_end(void);
+void gfx_batch_invalidate(void);
 void _gfx_render_texture(struct shader *s, struct texture *t, Rectangle *r, void *data);
 void gfx_render_texture(struct texture *t, Rectangle *r);
 void gfx_render_quadrilateral(struct texture *t, struct gfx_vertex vertices[4]);
@@ -109,6 +151,7 @@ void gfx_init_texture_rgb(struct texture *t, int w, int h, SDL_Color color);
 void gfx_init_texture_with_pixels(struct texture *t, int w, int h, void *pixels);
 void gfx_init_texture_amap(struct texture *t, int w, int h, uint8_t *amap, SDL_Color color);
 void gfx_init_texture_rmap(struct texture *t, int w, int h, uint8_t *rmap);
+void gfx_update_texture_rmap(struct texture *t, int x, int y, int w, int h, uint8_t *rmap);
 void gfx_update_texture_with_pixels(struct texture *t, void *pixels);
 void gfx_copy_main_surface(struct texture *dst);
 void gfx_delete_texture(struct texture *t);
@@ -188,9 +231,23 @@ void gfx_copy_grayscale_with_alpha_map(Texture *dst, int dx, int dy, Texture *sr
 void gfx_copy_grayscale_reverse_LR_with_alpha_map(Texture *dst, int dx, int dy, Texture *src, int sx, int sy, int w, int h);
 void gfx_draw_line(Texture *dst, int x0, int y0, int x1, int y1, int r, int g, int b);
 void gfx_draw_line_to_amap(Texture *dst, int x0, int y0, int x1, int y1, int a);
-void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, SDL_Color color, float scale_x, float bold_width, bool blend);
-void gfx_draw_glyph_to_pmap(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_pos, SDL_Color color, float scale_x);
-void gfx_draw_glyph_to_amap(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_pos, float scale_x);
+void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_cell, SDL_Color color, float scale_x, float bold_width, bool blend);
+
+enum gfx_glyph_mode {
+	GFX_GLYPH_COPY,
+	GFX_GLYPH_BLEND,
+	GFX_GLYPH_PMAP,
+	GFX_GLYPH_AMAP,
+};
+
+// A glyph drawn by gfx_draw_glyphs: destination and source rectangles, in pixels.
+struct gfx_glyph_quad {
+	int dx, dy, dw, dh;
+	Rectangle src;
+};
+
+void gfx_draw_glyphs(Texture *dst, Texture *atlas, struct gfx_glyph_quad *quads, int nr_quads,
+		SDL_Color color, float bold_width, enum gfx_glyph_mode mode);
 void gfx_draw_quadrilateral(Texture *dst, Texture *src, struct gfx_vertex vertices[4]);
 
 #endif /* SYSTEM4_SDL_CORE_H */
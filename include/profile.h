@@ -0,0 +1,59 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_PROFILE_H
+#define SYSTEM4_PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_NO_HLL -1
+
+// The HLL function currently being executed, as (libno << 16 | fno).
+extern volatile int32_t profile_current_hll;
+
+/*
+ * Start the sampling profiler. Collapsed stacks (for flamegraph.pl and
+ * similar tools) are written to PATH at exit, and a summary is printed.
+ */
+void profile_start(const char *path);
+
+static inline int32_t profile_hll_enter(int libno, int fno)
+{
+	int32_t prev = profile_current_hll;
+	profile_current_hll = (libno << 16) | (fno & 0xFFFF);
+	return prev;
+}
+
+static inline void profile_hll_leave(int32_t prev)
+{
+	profile_current_hll = prev;
+}
+
+// Called when an HLL function calls back into the VM, so that time spent
+// in bytecode isn't attributed to the HLL function.
+static inline int32_t profile_vm_enter(void)
+{
+	int32_t prev = profile_current_hll;
+	profile_current_hll = PROFILE_NO_HLL;
+	return prev;
+}
+
+static inline void profile_vm_leave(int32_t prev)
+{
+	profile_current_hll = prev;
+}
+
+#endif /* SYSTEM4_PROFILE_H */
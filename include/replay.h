@@ -0,0 +1,74 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_REPLAY_H
+#define SYSTEM4_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Input recording and replay. While recording, every input-dependent value
+ * observed by the game (input state changes at each handle_events call,
+ * text and key handler calls, mouse positions and readings of the VM clock)
+ * is written to a log in the order it was observed. During replay the same
+ * values are read back from the log in place of the real devices and clock,
+ * so the game follows the same path as long as it is otherwise
+ * deterministic.
+ */
+
+enum replay_mode {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY,
+};
+
+extern enum replay_mode replay_mode;
+
+enum replay_record_type {
+	REPLAY_EVENTS = 'E',
+	REPLAY_TEXT   = 'I',
+	REPLAY_KEY    = 'K',
+	REPLAY_MOUSE  = 'M',
+	REPLAY_TIME   = 'T',
+};
+
+void replay_record_start(const char *path);
+void replay_play_start(const char *path, bool benchmark);
+
+// Append a record to the log.
+void replay_record(enum replay_record_type type, const char *fmt, ...);
+
+// Type of the next record in the log (0 at the end of the log).
+char replay_peek(void);
+
+/*
+ * Read the next record, which must be of type TYPE. Returns the payload of
+ * the record. If the log is exhausted (or the game diverged from it) the
+ * replay ends; in benchmark mode the results are reported and xsystem4
+ * exits, otherwise NULL is returned and live input is used from then on.
+ */
+char *replay_next(enum replay_record_type type);
+
+// Returns the (recorded or replayed) value of the VM clock.
+uint32_t replay_time(uint32_t now);
+
+// Benchmark hooks.
+void replay_frame(void);
+void replay_render_begin(void);
+void replay_render_end(void);
+
+#endif /* SYSTEM4_REPLAY_H */
@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include "queue.h"
+#include "gfx/types.h"
 
 typedef struct cJSON cJSON;
 struct texture;
@@ -42,6 +43,19 @@ struct sprite {
 	int id;
 	// The rendering function.
 	void (*render)(struct sprite*);
+	// This flag indicates that the rendering function only draws through
+	// gfx_render (or calls gfx_batch_invalidate before using GL directly),
+	// so it can be called within a render batch.
+	bool batchable;
+	// Computes the area of the main surface covered by the sprite. If this
+	// function is not provided (or returns false), any change to the sprite
+	// causes the whole scene to be redrawn.
+	bool (*get_bounds)(struct sprite*, Rectangle*);
+	// This flag indicates that the sprite changed since it was last drawn.
+	bool damaged;
+	// The area covered by the sprite when it was last drawn.
+	bool drawn;
+	Rectangle drawn_bounds;
 	// Debug printing function
 	cJSON *(*to_json)(struct sprite*, bool);
 };
@@ -51,6 +65,7 @@ extern bool scene_is_dirty;
 void scene_register_sprite(struct sprite *sp);
 void scene_unregister_sprite(struct sprite *sp);
 void scene_render(void);
+bool scene_update(void);
 int scene_set_wp(int cg_no);
 int scene_set_wp_color(int r, int g, int b);
 int scene_set_wp_texture(struct texture *tex);
@@ -66,6 +81,7 @@ static inline void scene_sprite_dirty(struct sprite *sp)
 	if (!sp)
 		return;
 	scene_is_dirty = true;
+	sp->damaged = true;
 	if (sp->hidden) {
 		scene_unregister_sprite(sp);
 	} else if (sp->has_pixel) {
@@ -73,10 +89,7 @@ static inline void scene_sprite_dirty(struct sprite *sp)
 	}
 }
 
-static inline void scene_dirty(void)
-{
-	scene_is_dirty = true;
-}
+void scene_dirty(void);
 
 static inline void scene_set_sprite_show(struct sprite *sp, bool show)
 {
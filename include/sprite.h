@@ -64,6 +64,12 @@ struct sact_sprite {
 	bool suspended;
 	// (optional) Draw plugin bound to this sprite.
 	struct draw_plugin *plugin;
+	// CPU copy of the texture's pixels, for hit testing without reading
+	// back from the GPU. Only kept for sprites that have been hit tested.
+	struct {
+		bool enabled;
+		uint8_t *pixels;
+	} shadow;
 };
 
 /*
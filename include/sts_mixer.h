@@ -159,6 +159,9 @@ void sts_mixer_mix_audio(sts_mixer_t* mixer, void* output, unsigned int samples)
 ////
 #ifdef STS_MIXER_IMPLEMENTATION
 
+#include <string.h>
+#include "audio_kernels.h" // added in xsystem4
+
 enum {
   STS_MIXER_VOICE_STOPPED,
   STS_MIXER_VOICE_PLAYING,
@@ -297,70 +300,113 @@ void sts_mixer_stop_stream(sts_mixer_t* mixer, sts_mixer_stream_t* stream) {
 }
 
 
+// xsystem4 change: voices are mixed one at a time over a block of output
+// frames (rather than frame by frame), so that streams which don't need
+// resampling can be mixed with the vectorized kernels in audio_kernels.c.
+#define STS_MIXER_BLOCK_FRAMES 1024
+
+static void sts_mixer__mix_sample_voice(sts_mixer_t* mixer, int i, float* acc, unsigned int frames) {
+  sts_mixer_voice_t*  voice = &mixer->voices[i];
+  float               advance = 1.0f / (float)mixer->frequency;
+  float               sample;
+  unsigned int        f, position;
+
+  for (f = 0; f < frames; ++f) {
+    position = (int)voice->position;
+    if (position >= voice->sample->length) {
+      sts_mixer__reset_voice(mixer, i);
+      return;
+    }
+    sample = sts_mixer__clamp_sample(sts_mixer__get_sample(voice->sample, position) * voice->gain);
+    acc[f * 2] += sts_mixer__clamp_sample(sample * (0.5f - voice->pan));
+    acc[f * 2 + 1] += sts_mixer__clamp_sample(sample * (0.5f + voice->pan));
+    voice->position += (float)voice->sample->frequency * advance * voice->pitch;
+  }
+}
+
+
+static void sts_mixer__mix_stream_voice(sts_mixer_t* mixer, int i, float* acc, unsigned int frames) {
+  sts_mixer_voice_t*  voice = &mixer->voices[i];
+  sts_mixer_sample_t* sample = &voice->stream->sample;
+  float               advance = 1.0f / (float)mixer->frequency;
+  unsigned int        f = 0, position, n;
+
+  while (f < frames) {
+    position = ((int)voice->position) * 2;
+    if (position >= sample->length) {
+      // buffer empty...refill
+      int status = voice->stream->callback(sample, voice->stream->userdata);
+      voice->position = 0.0f;
+      position = 0;
+      // added in xsystem4: allow stopping stream via callback return value
+      if (status == STS_STREAM_COMPLETE) {
+        sts_mixer_stop_voice(mixer, i);
+        return;
+      }
+    }
+    if (sample->frequency == mixer->frequency && sample->audio_format == STS_MIXER_SAMPLE_FORMAT_FLOAT) {
+      // no resampling needed: mix the rest of the buffer in one go
+      n = (sample->length - position) / 2;
+      if (n > frames - f) n = frames - f;
+      audio_kernels->mix(acc + f * 2, (float*)sample->data + position, voice->gain, n * 2);
+      voice->position += (float)n;
+      f += n;
+    } else {
+      acc[f * 2] += sts_mixer__clamp_sample(sts_mixer__get_sample(sample, position) * voice->gain);
+      acc[f * 2 + 1] += sts_mixer__clamp_sample(sts_mixer__get_sample(sample, position + 1) * voice->gain);
+      voice->position += (float)sample->frequency * advance;
+      ++f;
+    }
+  }
+}
+
+
 void sts_mixer_mix_audio(sts_mixer_t* mixer, void* output, unsigned int samples) {
-  sts_mixer_voice_t*  voice;
-  unsigned int        i, position;
-  float               left, right, advance, sample;
+  float               acc[STS_MIXER_BLOCK_FRAMES * 2];
+  float               left, right;
+  unsigned int        i, n;
   char*               out_8 = (char*)output;
   short*              out_16 = (short*)output;
   int*                out_32 = (int*)output;
   float*              out_float = (float*)output;
 
-  // mix all voices
-  advance = 1.0f / (float)mixer->frequency;
-  for (; samples > 0; --samples) {
-    left = right = 0.0f;
+  for (; samples > 0; samples -= n) {
+    n = samples < STS_MIXER_BLOCK_FRAMES ? samples : STS_MIXER_BLOCK_FRAMES;
+
+    // mix all voices
+    memset(acc, 0, n * 2 * sizeof(float));
     for (i = 0; i < STS_MIXER_VOICES; ++i) {
-      voice = &mixer->voices[i];
-      if (voice->state == STS_MIXER_VOICE_PLAYING) {
-        position = (int)voice->position;
-        if (position < voice->sample->length) {
-          sample = sts_mixer__clamp_sample(sts_mixer__get_sample(voice->sample, position) * voice->gain);
-          left += sts_mixer__clamp_sample(sample * (0.5f - voice->pan));
-          right += sts_mixer__clamp_sample(sample * (0.5f + voice->pan));
-          voice->position += (float)voice->sample->frequency * advance * voice->pitch;
-        } else sts_mixer__reset_voice(mixer, i);
-      } else if (voice->state == STS_MIXER_VOICE_STREAMING) {
-        int status = 1;
-        position = ((int)voice->position) * 2;
-        if (position >= voice->stream->sample.length) {
-          // buffer empty...refill
-          status = voice->stream->callback(&voice->stream->sample, voice->stream->userdata);
-          voice->position = 0.0f;
-          position = 0;
-        }
-        // added in xsystem4: allow stopping stream via callback return value
-        if (status == STS_STREAM_COMPLETE) {
-          sts_mixer_stop_voice(mixer, i);
-        } else {
-          left += sts_mixer__clamp_sample(sts_mixer__get_sample(&voice->stream->sample, position) * voice->gain);
-          right += sts_mixer__clamp_sample(sts_mixer__get_sample(&voice->stream->sample, position + 1) * voice->gain);
-          voice->position += (float)voice->stream->sample.frequency * advance;
-        }
+      if (mixer->voices[i].state == STS_MIXER_VOICE_PLAYING) {
+        sts_mixer__mix_sample_voice(mixer, i, acc, n);
+      } else if (mixer->voices[i].state == STS_MIXER_VOICE_STREAMING) {
+        sts_mixer__mix_stream_voice(mixer, i, acc, n);
       }
     }
 
     // write to buffer
     // NOTE: xsystem4 change: use mixer gain (not sure why this isn't implemented upstream...)
-    left = sts_mixer__clamp_sample(left * mixer->gain);
-    right = sts_mixer__clamp_sample(right * mixer->gain);
-    switch (mixer->audio_format) {
-      case STS_MIXER_SAMPLE_FORMAT_8:
-        *out_8++ = (char)(left * 127.0f);
-        *out_8++ = (char)(right * 127.0f);
-        break;
-      case STS_MIXER_SAMPLE_FORMAT_16:
-        *out_16++ = (short)(left * 32767.0f);
-        *out_16++ = (short)(right * 32767.0f);
-        break;
-      case STS_MIXER_SAMPLE_FORMAT_32:
-        *out_32++ = (int)(left * 2147483647.0f);
-        *out_32++ = (int)(right * 2147483647.0f);
-        break;
-      case STS_MIXER_SAMPLE_FORMAT_FLOAT:
-        *out_float++ = left;
-        *out_float++ = right;
-        break;
+    if (mixer->audio_format == STS_MIXER_SAMPLE_FORMAT_FLOAT) {
+      audio_kernels->scale(out_float, acc, mixer->gain, n * 2);
+      out_float += n * 2;
+      continue;
+    }
+    for (i = 0; i < n; ++i) {
+      left = sts_mixer__clamp_sample(acc[i * 2] * mixer->gain);
+      right = sts_mixer__clamp_sample(acc[i * 2 + 1] * mixer->gain);
+      switch (mixer->audio_format) {
+        case STS_MIXER_SAMPLE_FORMAT_8:
+          *out_8++ = (char)(left * 127.0f);
+          *out_8++ = (char)(right * 127.0f);
+          break;
+        case STS_MIXER_SAMPLE_FORMAT_16:
+          *out_16++ = (short)(left * 32767.0f);
+          *out_16++ = (short)(right * 32767.0f);
+          break;
+        case STS_MIXER_SAMPLE_FORMAT_32:
+          *out_32++ = (int)(left * 2147483647.0f);
+          *out_32++ = (int)(right * 2147483647.0f);
+          break;
+      }
     }
   }
 }
@@ -178,6 +178,10 @@ static inline float get_argument_float(int n)
 
 uint32_t get_switch_address(int no, int val);
 uint32_t get_strswitch_address(int no, struct string *str);
+void vm_patch_opcode(uint32_t addr, uint16_t opcode);
+void vm_execute_instruction(void);
+bool vm_jit_is_enabled(void);
+bool vm_jit_set_enabled(bool enable);
 
 int vm_save_image(const char *key, const char *path);
 void vm_load_image(const char *key, const char *path);
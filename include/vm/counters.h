@@ -0,0 +1,55 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_VM_COUNTERS_H
+#define SYSTEM4_VM_COUNTERS_H
+
+/*
+ * Exact execution counters, enabled with the `vm_counters` build option.
+ * Every executed instruction is counted by opcode, and every HLL call is
+ * counted (with cumulative time) by library/function.
+ */
+#ifdef VM_COUNTERS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "system4/instructions.h"
+
+extern uint64_t vm_opcode_counts[NR_OPCODES];
+
+#define VM_COUNT_OPCODE(opcode) \
+	do { \
+		unsigned _op = (opcode) & ~OPTYPE_MASK; \
+		if (_op < NR_OPCODES) \
+			vm_opcode_counts[_op]++; \
+	} while (0)
+
+// Start counting. The counters are written to PATH at exit.
+void vm_counters_init(const char *path);
+
+// Write the counters as JSON to PATH (or stdout if PATH is NULL).
+bool vm_counters_dump(const char *path);
+
+uint64_t vm_counters_hll_begin(void);
+void vm_counters_hll_end(int libno, int fno, uint64_t start);
+
+#else
+
+#define VM_COUNT_OPCODE(opcode)
+
+#endif /* VM_COUNTERS */
+
+#endif /* SYSTEM4_VM_COUNTERS_H */
@@ -52,6 +52,28 @@ struct vm_pointer {
 extern struct vm_pointer *heap;
 extern size_t heap_size;
 
+// Allocation statistics (cumulative, except for the byte/page counts).
+struct heap_stats {
+	uint64_t slot_allocs;
+	uint64_t slot_frees;
+	uint64_t page_allocs;
+	uint64_t page_frees;
+	// page allocations and resizes not served from the free lists
+	uint64_t page_mallocs;
+	// bytes in live pages
+	size_t page_bytes;
+	// pages (and bytes) on the free lists
+	size_t cached_pages;
+	size_t cached_bytes;
+};
+
+extern struct heap_stats heap_stats;
+
+// Record the end of a frame, for heap_stats_last_frame.
+void heap_stats_end_frame(void);
+// Get the change in the cumulative counters over the last frame.
+void heap_stats_last_frame(struct heap_stats *out);
+
 void heap_init(void);
 void heap_delete(void);
 void heap_grow(size_t new_size);
@@ -0,0 +1,73 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_VM_JIT_H
+#define SYSTEM4_VM_JIT_H
+
+#include <stdint.h>
+
+/*
+ * Baseline JIT compiler. Only x86-64 with the System V calling convention is
+ * supported; on other platforms the VM always uses the interpreter.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(_WIN32) && !defined(VM_NO_JIT)
+#define VM_JIT
+
+struct jit_function;
+
+/*
+ * Compile the instructions in the range [start, end) of the code section.
+ * Instructions which cannot be compiled (breakpoints) are left to the
+ * interpreter. Returns NULL on failure.
+ */
+struct jit_function *jit_compile(int fno, uint32_t start, uint32_t end);
+
+/*
+ * Get the native entry point for the instruction at ADDR, or NULL if
+ * execution cannot begin at that instruction in native code.
+ */
+void *jit_entry_point(struct jit_function *f, uint32_t addr);
+
+/*
+ * Free a compiled function. The caller must have stopped using its entry
+ * points; if native code is currently on the C stack, the function is freed
+ * once that code returns.
+ */
+void jit_free(struct jit_function *f);
+
+/*
+ * Execute native code starting at ENTRY. Returns when the compiled code
+ * exits to the interpreter, with instr_ptr set to the address of the next
+ * instruction to execute.
+ */
+void jit_enter(void *entry);
+
+/*
+ * Force any native code currently on the C stack to exit to the interpreter
+ * at the next opportunity. Must be called whenever compiled code becomes
+ * stale (e.g. when a breakpoint is set).
+ */
+void jit_invalidate(void);
+
+/*
+ * Must be called when the C stack is unwound past jit_enter without
+ * returning (i.e. on vm_reset), so that retired code can be freed.
+ */
+void jit_reset_stack(void);
+
+#endif /* VM_JIT */
+
+#endif /* SYSTEM4_VM_JIT_H */
@@ -77,6 +77,7 @@ struct page {
 			int rank;
 		} array;
 	};
+	int capacity; // number of values the allocation can hold
 	int nr_vars;
 	union vm_value values[];
 };
@@ -0,0 +1,41 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#ifndef SYSTEM4_VM_STRING_INDEX_H
+#define SYSTEM4_VM_STRING_INDEX_H
+
+struct string;
+
+/*
+ * SJIS character indexing for long strings. Operations which address a
+ * string by character index normally rescan it from the start; these
+ * versions consult a small cache of recently indexed strings, which records
+ * the character count and the byte offset of every Nth character.
+ *
+ * The cache holds a reference to each indexed string, so any mutation of
+ * the string goes through copy-on-write and the index can never go stale.
+ */
+
+// Equivalent to sjis_count_char(s->text).
+int vm_string_length(struct string *s);
+
+// Equivalent to string_copy(s, index, len).
+struct string *vm_string_copy(struct string *s, int index, int len);
+
+// Drop all cached indices.
+void vm_string_index_clear(void);
+
+#endif /* SYSTEM4_VM_STRING_INDEX_H */
@@ -25,6 +25,11 @@ enum resume_save_format {
 	SAVE_FORMAT_RSM,
 };
 
+enum vm_dispatch_method {
+	VM_DISPATCH_SWITCH,
+	VM_DISPATCH_THREADED,
+};
+
 struct config {
 	char *game_name;
 	char *boot_name;
@@ -52,6 +57,14 @@ struct config {
 	bool manual_text_x_scale;
 	enum resume_save_format save_format;
 	int msgskip_delay;
+	enum vm_dispatch_method vm_dispatch;
+	bool jit;
+	int jit_threshold;
+	int cg_cache_size;
+	int sound_cache_max_length;
+	bool frame_stats_overlay;
+	char *frame_stats_csv;
+	bool headless;
 };
 
 extern struct config config;
@@ -19,6 +19,10 @@ uniform float threshold;
 uniform vec4 color;  // .a is the discard threshold
 
 in vec2 tex_coord;
+// texture coordinates of the outermost texel centers of the glyph's cell;
+// samples are clamped to it so that neighbouring glyphs in the atlas are
+// never picked up
+flat in vec4 clip_rect;
 out vec4 frag_color;
 
 void main() {
@@ -37,7 +41,7 @@ void main() {
 			float d = distance(vec2(x, y), vec2(0, 0));
 			if (d > t)
 				continue;
-			float a = texture(tex, tex_coord + vec2(x, y) / tex_size).r;
+			float a = texture(tex, clamp(tex_coord + vec2(x, y) / tex_size, clip_rect.xy, clip_rect.zw)).r;
 			if (d > float(size))
 				a *= edge_weight;
 			a_out += a;
@@ -25,6 +25,7 @@
 #include "system4/hashtable.h"
 
 #include "3d_internal.h"
+#include "asset_manager.h"
 #include "reign.h"
 
 #define FP16_MIN 6.103516e-5f
@@ -90,9 +91,9 @@ static GLuint load_texture(struct archive *aar, const char *path, const char *na
 	if (!dfile) {
 		return 0;
 	}
-	struct cg *cg = cg_load_data(dfile);
+	struct cg *cg = asset_cg_decode(dfile);
 	if (!cg) {
-		WARNING("cg_load_data failed: %s", dfile->name);
+		WARNING("asset_cg_decode failed: %s", dfile->name);
 		archive_free_data(dfile);
 		return 0;
 	}
@@ -24,6 +24,7 @@
 #include "system4/utfsjis.h"
 
 #include "3d_internal.h"
+#include "asset_manager.h"
 
 static inline float randf(void)
 {
@@ -470,9 +471,9 @@ static void load_textures(struct pae *effect, struct archive *aar)
 				WARNING("cannot load texture %s\\%s", effect->path, name);
 				continue;
 			}
-			struct cg *cg = cg_load_data(dfile);
+			struct cg *cg = asset_cg_decode(dfile);
 			if (!cg) {
-				WARNING("cg_load_data failed: %s", dfile->name);
+				WARNING("asset_cg_decode failed: %s", dfile->name);
 				archive_free_data(dfile);
 				continue;
 			}
@@ -1382,10 +1382,10 @@ bool RE_back_cg_set_name(struct RE_back_cg *bcg, struct string *name, struct arc
 		WARNING("cannot load back CG %s", name->text);
 		return false;
 	}
-	struct cg *cg = cg_load_data(dfile);
+	struct cg *cg = asset_cg_decode(dfile);
 	archive_free_data(dfile);
 	if (!cg) {
-		WARNING("cg_load_data failed: %s", name->text);
+		WARNING("asset_cg_decode failed: %s", name->text);
 		return false;
 	}
 	gfx_init_texture_with_cg(&bcg->texture, cg);
@@ -25,6 +25,7 @@
 #include "asset_manager.h"
 #include "reign.h"
 #include "sact.h"
+#include "vm.h"
 
 #define BONE_TRANSFORMS_BINDING 0
 
@@ -278,7 +279,7 @@ struct RE_renderer *RE_renderer_new(void)
 	init_outline_renderer(&r->outline);
 	init_billboard_mesh(r);
 	r->billboard_textures = ht_create(256);
-	r->last_frame_timestamp = SDL_GetTicks();
+	r->last_frame_timestamp = vm_time();
 	return r;
 }
 
@@ -528,6 +529,7 @@ static void render_model(struct RE_instance *inst, struct RE_renderer *r, enum d
 			glDrawElements(GL_TRIANGLES, mesh->nr_indices, GL_UNSIGNED_SHORT, NULL);
 		else
 			glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+		gfx_stats.draw_calls++;
 
 		if (mesh->flags & MESH_NO_ZWRITE)
 			glDepthMask(GL_TRUE);
@@ -632,6 +634,7 @@ static void render_billboard(struct RE_instance *inst, struct RE_renderer *r, ma
 	glBindVertexArray(r->billboard_vao);
 
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	gfx_stats.draw_calls++;
 
 	glBindVertexArray(0);
 	glBindTexture(GL_TEXTURE_2D, 0);
@@ -673,6 +676,7 @@ static void render_billboard_particles(struct RE_renderer *r, struct RE_instance
 		glUniformMatrix3fv(r->normal_transform, 1, GL_FALSE, local_transform[0]);
 
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		gfx_stats.draw_calls++;
 	}
 
 	glBindVertexArray(0);
@@ -712,6 +716,7 @@ static void render_polygon_particles(struct RE_renderer *r, struct RE_instance *
 
 			glBindVertexArray(mesh->vao);
 			glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+			gfx_stats.draw_calls++;
 
 			glBindVertexArray(0);
 			glBindTexture(GL_TEXTURE_2D, 0);
@@ -761,6 +766,7 @@ static void render_s3de_billboard_particles(struct RE_renderer *r, struct RE_ins
 		glUniformMatrix3fv(r->normal_transform, 1, GL_FALSE, world[0]);
 
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		gfx_stats.draw_calls++;
 	}
 
 	glEnable(GL_CULL_FACE);
@@ -816,6 +822,7 @@ static void render_s3de_polygon_particles(struct RE_renderer *r, struct RE_insta
 			if (mesh->flags & MESH_BOTH)
 				glDisable(GL_CULL_FACE);
 			glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+			gfx_stats.draw_calls++;
 			if (mesh->flags & MESH_BOTH)
 				glEnable(GL_CULL_FACE);
 
@@ -1061,6 +1068,7 @@ static void render_shadow_map(struct RE_plugin *plugin, mat4 light_space_transfo
 				continue;
 			glBindVertexArray(mesh->vao);
 			glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+			gfx_stats.draw_calls++;
 		}
 		glBindVertexArray(0);
 	}
@@ -1115,6 +1123,7 @@ static void render_outlines(struct RE_plugin *plugin, mat4 view_transform)
 			}
 			glBindVertexArray(mesh->vao);
 			glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+			gfx_stats.draw_calls++;
 		}
 		glBindVertexArray(0);
 	}
@@ -1258,7 +1267,7 @@ void RE_update_model(struct RE_plugin *plugin)
 	struct RE_renderer *r = plugin->renderer;
 	if (!r || plugin->suspended)
 		return;
-	uint32_t timestamp = SDL_GetTicks();
+	uint32_t timestamp = vm_time();
 	RE_build_model(plugin, timestamp - r->last_frame_timestamp);
 	r->last_frame_timestamp = timestamp;
 }
@@ -1270,6 +1279,7 @@ void RE_render(struct sact_sprite *sp)
 	if (!r || plugin->suspended)
 		return;
 
+	gfx_pass_begin(GFX_PASS_3D);
 	sprite_dirty(sp);
 	struct texture *texture = sprite_get_texture(sp);
 
@@ -1366,6 +1376,7 @@ void RE_render(struct sact_sprite *sp)
 	glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
 	gfx_reset_framebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gfx_pass_end(GFX_PASS_3D);
 }
 
 struct height_detector {
@@ -1430,6 +1441,7 @@ struct height_detector *RE_renderer_create_height_detector(struct RE_renderer *r
 		struct mesh *mesh = &model->meshes[i];
 		glBindVertexArray(mesh->vao);
 		glDrawArrays(GL_TRIANGLES, 0, mesh->nr_vertices);
+		gfx_stats.draw_calls++;
 	}
 	glBindVertexArray(0);
 	glFinish();
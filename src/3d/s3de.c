@@ -29,6 +29,7 @@
 #include "system4/utfsjis.h"
 
 #include "3d_internal.h"
+#include "asset_manager.h"
 #include "audio.h"
 
 static void parse_error(const char *msg, char *input)
@@ -578,9 +579,9 @@ static void load_textures(struct s3de *s, struct archive *aar)
 			WARNING("cannot load texture %s\\%s", s->path, name);
 			continue;
 		}
-		struct cg *cg = cg_load_data(dfile);
+		struct cg *cg = asset_cg_decode(dfile);
 		if (!cg) {
-			WARNING("cg_load_data failed: %s", dfile->name);
+			WARNING("asset_cg_decode failed: %s", dfile->name);
 			archive_free_data(dfile);
 			continue;
 		}
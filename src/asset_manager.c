@@ -14,6 +14,7 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include <dirent.h>
 #include <limits.h>
 #include <assert.h>
+#include <SDL.h>
 
 #include "system4.h"
 #include "system4/ald.h"
@@ -88,6 +90,9 @@ bool asset_manager_load_archive(enum asset_type type, const char *archive_name)
 	char *path = gamedir_path(archive_name);
 	bool r = assets[type]->load_archive(assets[type], path);
 	free(path);
+	// the new archive may shadow cached CGs
+	if (r && type == ASSET_CG)
+		asset_cg_cache_clear();
 	return r;
 }
 
@@ -107,11 +112,20 @@ bool asset_exists_by_name(enum asset_type type, const char *name, int *id_out)
 	return assets[type]->exists_by_name(assets[type], name, id_out);
 }
 
+static void cg_decoder_lock(void);
+static void cg_decoder_unlock(void);
+
 struct archive_data *asset_get(enum asset_type type, int id)
 {
 	if (!assets[type])
 		return NULL;
-	return assets[type]->get_by_id(assets[type], id);
+	// the CG decoder thread may be reading from the CG archive
+	if (type == ASSET_CG)
+		cg_decoder_lock();
+	struct archive_data *data = assets[type]->get_by_id(assets[type], id);
+	if (type == ASSET_CG)
+		cg_decoder_unlock();
+	return data;
 }
 
 struct archive_data *asset_get_by_name(enum asset_type type, const char *name, int *id_out)
@@ -120,26 +134,577 @@ struct archive_data *asset_get_by_name(enum asset_type type, const char *name, i
 		return NULL;
 	if (!assets[type]->get_by_name)
 		ERROR("get_by_name not supported on this archive type");
-	return assets[type]->get_by_name(assets[type], name, id_out);
+	if (type == ASSET_CG)
+		cg_decoder_lock();
+	struct archive_data *data = assets[type]->get_by_name(assets[type], name, id_out);
+	if (type == ASSET_CG)
+		cg_decoder_unlock();
+	return data;
+}
+
+/*
+ * Decoded CG cache.
+ *
+ * Decoding a CG is expensive, and scripts tend to load the same handful of
+ * CGs (button states, faces, numerals) over and over. Recently loaded CGs
+ * are kept here in LRU order, and callers receive a copy (the pixel copy is
+ * far cheaper than decoding).
+ *
+ * The number of entries comes from the cg_cache_size argument that games
+ * pass to SACT2_Init and friends, unless overridden in the config.
+ */
+
+#define CG_CACHE_NR_BUCKETS 256
+#define CG_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+struct cg_cache_entry {
+	int id;
+	char *name; // NULL for entries loaded by id
+	struct cg *cg;
+	size_t size;
+	// LRU list (most recently used first)
+	struct cg_cache_entry *prev;
+	struct cg_cache_entry *next;
+	struct cg_cache_entry *hash_next;
+};
+
+static struct {
+	int max_entries;
+	int nr_entries;
+	size_t bytes;
+	struct cg_cache_entry *head;
+	struct cg_cache_entry *tail;
+	struct cg_cache_entry *buckets[CG_CACHE_NR_BUCKETS];
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} cg_cache = {0};
+
+static size_t cg_pixels_size(struct cg *cg)
+{
+	// decoded CGs are always 32-bit RGBA
+	return (size_t)cg->metrics.w * (size_t)cg->metrics.h * 4;
+}
+
+static struct cg *cg_copy(struct cg *src)
+{
+	struct cg *dst = xmalloc(sizeof(struct cg));
+	*dst = *src;
+	if (src->pixels) {
+		size_t size = cg_pixels_size(src);
+		dst->pixels = xmalloc(size);
+		memcpy(dst->pixels, src->pixels, size);
+	}
+	return dst;
+}
+
+static unsigned cg_cache_hash(int id, const char *name)
+{
+	if (!name)
+		return (unsigned)id % CG_CACHE_NR_BUCKETS;
+	uint32_t h = 2166136261u;
+	for (const char *p = name; *p; p++) {
+		h = (h ^ (uint8_t)*p) * 16777619u;
+	}
+	return h % CG_CACHE_NR_BUCKETS;
+}
+
+static struct cg_cache_entry **cg_cache_find(int id, const char *name)
+{
+	struct cg_cache_entry **e = &cg_cache.buckets[cg_cache_hash(id, name)];
+	for (; *e; e = &(*e)->hash_next) {
+		if (name ? ((*e)->name && !strcmp((*e)->name, name)) : (!(*e)->name && (*e)->id == id))
+			return e;
+	}
+	return e;
+}
+
+static void cg_cache_unlink(struct cg_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cg_cache.head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cg_cache.tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void cg_cache_push_front(struct cg_cache_entry *e)
+{
+	e->next = cg_cache.head;
+	e->prev = NULL;
+	if (cg_cache.head)
+		cg_cache.head->prev = e;
+	else
+		cg_cache.tail = e;
+	cg_cache.head = e;
+}
+
+static void cg_cache_remove(struct cg_cache_entry *e)
+{
+	struct cg_cache_entry **p = cg_cache_find(e->id, e->name);
+	assert(*p == e);
+	*p = e->hash_next;
+	cg_cache_unlink(e);
+	cg_cache.nr_entries--;
+	cg_cache.bytes -= e->size;
+	cg_free(e->cg);
+	free(e->name);
+	free(e);
+}
+
+static struct cg *cg_cache_get(int id, const char *name, int *id_out)
+{
+	struct cg_cache_entry *e = *cg_cache_find(id, name);
+	if (!e) {
+		cg_cache.misses++;
+		return NULL;
+	}
+	cg_cache.hits++;
+	cg_cache_unlink(e);
+	cg_cache_push_front(e);
+	if (id_out)
+		*id_out = e->id;
+	return cg_copy(e->cg);
+}
+
+static void cg_cache_put(int id, const char *name, struct cg *cg)
+{
+	size_t size = cg_pixels_size(cg);
+	if (size > CG_CACHE_MAX_BYTES / 4)
+		return;
+
+	struct cg_cache_entry *e = xcalloc(1, sizeof(struct cg_cache_entry));
+	e->id = id;
+	e->name = name ? xstrdup(name) : NULL;
+	e->cg = cg_copy(cg);
+	e->size = size;
+
+	struct cg_cache_entry **p = cg_cache_find(id, name);
+	if (*p)
+		cg_cache_remove(*p);
+	p = cg_cache_find(id, name);
+	*p = e;
+	cg_cache_push_front(e);
+	cg_cache.nr_entries++;
+	cg_cache.bytes += size;
+
+	while (cg_cache.tail != e && (cg_cache.nr_entries > cg_cache.max_entries
+				|| cg_cache.bytes > CG_CACHE_MAX_BYTES)) {
+		cg_cache_remove(cg_cache.tail);
+		cg_cache.evictions++;
+	}
+}
+
+void asset_cg_cache_init(int nr_entries)
+{
+	if (config.cg_cache_size >= 0)
+		nr_entries = config.cg_cache_size;
+	// multiple libraries may request a cache; use the largest size
+	if (nr_entries > cg_cache.max_entries)
+		cg_cache.max_entries = nr_entries;
+}
+
+static void cg_decode_cancel_all(void);
+
+void asset_cg_cache_clear(void)
+{
+	cg_decode_cancel_all();
+	while (cg_cache.head) {
+		cg_cache_remove(cg_cache.head);
+	}
+}
+
+void asset_cg_cache_get_stats(struct asset_cg_cache_stats *stats)
+{
+	stats->nr_entries = cg_cache.nr_entries;
+	stats->max_entries = cg_cache.max_entries;
+	stats->bytes = cg_cache.bytes;
+	stats->hits = cg_cache.hits;
+	stats->misses = cg_cache.misses;
+	stats->evictions = cg_cache.evictions;
+}
+
+/*
+ * Background CG decoding.
+ *
+ * asset_cg_prefetch() reads the CG data from the archive on the calling
+ * thread and queues it to be decoded by a worker thread. Finished CGs are
+ * moved into the cache on the main thread; if the cache is disabled they
+ * are held until they are loaded, and dropped if they aren't loaded within
+ * CG_DECODE_UNCLAIMED_MS. A synchronous load of a CG which is still in
+ * flight waits for the worker instead of decoding it a second time.
+ * Texture upload is left to the caller as usual, since it must happen on
+ * the main thread.
+ *
+ * The decoders in libsys4 aren't known to be reentrant, and some formats
+ * (e.g. DCF) read their base CG from the archive while decoding, which
+ * isn't thread-safe either. So there is a single worker, and all decoding
+ * and CG archive access (including from the main thread) is serialized by
+ * the decoder lock. Code outside of the asset manager must decode CGs with
+ * the asset_cg_decode* functions for the same reason.
+ */
+
+#define CG_DECODE_MAX_JOBS 64
+#define CG_DECODE_UNCLAIMED_MS 2000
+
+enum cg_decode_state {
+	CG_DECODE_QUEUED,
+	CG_DECODE_RUNNING,
+	CG_DECODE_DONE,
+};
+
+struct cg_decode_job {
+	int id;
+	char *name; // NULL for jobs queued by id
+	struct archive_data *data;
+	struct cg *cg;
+	enum cg_decode_state state;
+	uint32_t done_time;
+	struct cg_decode_job *next;
+};
+
+static struct {
+	bool initialized;
+	SDL_mutex *mutex;
+	SDL_cond *queued;
+	SDL_cond *done;
+	SDL_mutex *decoder;
+	struct cg_decode_job *jobs;
+	int nr_jobs;
+	unsigned long prefetches;
+	unsigned long waits;
+	// sequential access predictor
+	int last_id;
+	int run_length;
+} cg_decode = {0};
+
+static int cg_decode_thread(possibly_unused void *data)
+{
+	SDL_LockMutex(cg_decode.mutex);
+	while (true) {
+		struct cg_decode_job *job;
+		for (job = cg_decode.jobs; job; job = job->next) {
+			if (job->state == CG_DECODE_QUEUED)
+				break;
+		}
+		if (!job) {
+			SDL_CondWait(cg_decode.queued, cg_decode.mutex);
+			continue;
+		}
+		job->state = CG_DECODE_RUNNING;
+		SDL_UnlockMutex(cg_decode.mutex);
+
+		SDL_LockMutex(cg_decode.decoder);
+		struct cg *cg = cg_load_data(job->data);
+		SDL_UnlockMutex(cg_decode.decoder);
+
+		SDL_LockMutex(cg_decode.mutex);
+		job->cg = cg;
+		job->state = CG_DECODE_DONE;
+		job->done_time = SDL_GetTicks();
+		SDL_CondBroadcast(cg_decode.done);
+	}
+	return 0;
+}
+
+/*
+ * The decoder lock is only needed once the worker exists, and the worker is
+ * only started from the main thread, so checking `initialized` here is safe.
+ */
+static void cg_decoder_lock(void)
+{
+	if (cg_decode.initialized)
+		SDL_LockMutex(cg_decode.decoder);
+}
+
+static void cg_decoder_unlock(void)
+{
+	if (cg_decode.initialized)
+		SDL_UnlockMutex(cg_decode.decoder);
+}
+
+struct cg *asset_cg_decode(struct archive_data *data)
+{
+	cg_decoder_lock();
+	struct cg *cg = cg_load_data(data);
+	cg_decoder_unlock();
+	return cg;
+}
+
+struct cg *asset_cg_decode_buffer(uint8_t *buf, size_t size)
+{
+	cg_decoder_lock();
+	struct cg *cg = cg_load_buffer(buf, size);
+	cg_decoder_unlock();
+	return cg;
+}
+
+struct cg *asset_cg_decode_file(const char *path)
+{
+	cg_decoder_lock();
+	struct cg *cg = cg_load_file(path);
+	cg_decoder_unlock();
+	return cg;
+}
+
+static void cg_decode_init(void)
+{
+	if (cg_decode.initialized)
+		return;
+	cg_decode.initialized = true;
+	cg_decode.mutex = SDL_CreateMutex();
+	cg_decode.queued = SDL_CreateCond();
+	cg_decode.done = SDL_CreateCond();
+	cg_decode.decoder = SDL_CreateMutex();
+
+	SDL_Thread *thread = SDL_CreateThread(cg_decode_thread, "CG decoder", NULL);
+	if (!thread) {
+		// queued jobs are decoded when claimed
+		WARNING("SDL_CreateThread failed: %s", SDL_GetError());
+		return;
+	}
+	SDL_DetachThread(thread);
+}
+
+// Must be called with the mutex held.
+static struct cg_decode_job **cg_decode_find(int id, const char *name)
+{
+	struct cg_decode_job **job = &cg_decode.jobs;
+	for (; *job; job = &(*job)->next) {
+		if (name ? ((*job)->name && !strcmp((*job)->name, name)) : (!(*job)->name && (*job)->id == id))
+			return job;
+	}
+	return job;
+}
+
+static void cg_decode_free_job(struct cg_decode_job *job)
+{
+	archive_free_data(job->data);
+	free(job->name);
+	free(job);
+}
+
+/*
+ * Remove the job for the given CG, waiting for it to finish if a worker is
+ * decoding it. Returns NULL if no such job exists. Must be called with the
+ * mutex held.
+ */
+static struct cg_decode_job *cg_decode_take(int id, const char *name)
+{
+	struct cg_decode_job **p = cg_decode_find(id, name);
+	struct cg_decode_job *job = *p;
+	if (!job)
+		return NULL;
+	if (job->state == CG_DECODE_RUNNING) {
+		cg_decode.waits++;
+		while (job->state != CG_DECODE_DONE)
+			SDL_CondWait(cg_decode.done, cg_decode.mutex);
+		// the list may have changed while waiting
+		p = cg_decode_find(id, name);
+	}
+	*p = job->next;
+	cg_decode.nr_jobs--;
+	return job;
+}
+
+// Returns the decoded CG for a prefetched job (decoding it now if no worker
+// has picked it up yet), or NULL if the CG was never prefetched.
+static struct cg *cg_decode_claim(int id, const char *name, int *id_out)
+{
+	if (!cg_decode.initialized)
+		return NULL;
+	SDL_LockMutex(cg_decode.mutex);
+	struct cg_decode_job *job = cg_decode_take(id, name);
+	SDL_UnlockMutex(cg_decode.mutex);
+	if (!job)
+		return NULL;
+
+	struct cg *cg = job->state == CG_DECODE_DONE ? job->cg : asset_cg_decode(job->data);
+	if (id_out)
+		*id_out = job->id;
+	if (cg && cg_cache.max_entries > 0)
+		cg_cache_put(job->id, name, cg);
+	cg_decode_free_job(job);
+	return cg;
+}
+
+// Move finished jobs into the cache. Without the cache, finished jobs are
+// kept for a while in case they are loaded, and then dropped.
+static void cg_decode_collect(void)
+{
+	if (!cg_decode.initialized)
+		return;
+	uint32_t now = SDL_GetTicks();
+	SDL_LockMutex(cg_decode.mutex);
+	struct cg_decode_job **p = &cg_decode.jobs;
+	while (*p) {
+		struct cg_decode_job *job = *p;
+		if (job->state != CG_DECODE_DONE || (cg_cache.max_entries <= 0
+				&& job->done_time + CG_DECODE_UNCLAIMED_MS >= now)) {
+			p = &job->next;
+			continue;
+		}
+		*p = job->next;
+		cg_decode.nr_jobs--;
+		if (job->cg) {
+			if (cg_cache.max_entries > 0)
+				cg_cache_put(job->id, job->name, job->cg);
+			cg_free(job->cg);
+		}
+		cg_decode_free_job(job);
+	}
+	SDL_UnlockMutex(cg_decode.mutex);
+}
+
+static void cg_decode_cancel_all(void)
+{
+	if (!cg_decode.initialized)
+		return;
+	SDL_LockMutex(cg_decode.mutex);
+	while (cg_decode.jobs) {
+		struct cg_decode_job *job = cg_decode_take(cg_decode.jobs->id, cg_decode.jobs->name);
+		if (job->cg)
+			cg_free(job->cg);
+		cg_decode_free_job(job);
+	}
+	SDL_UnlockMutex(cg_decode.mutex);
+}
+
+static void cg_decode_queue(int id, const char *name, struct archive_data *data)
+{
+	struct cg_decode_job *job = xcalloc(1, sizeof(struct cg_decode_job));
+	job->id = id;
+	job->name = name ? xstrdup(name) : NULL;
+	job->data = data;
+	job->state = CG_DECODE_QUEUED;
+
+	SDL_LockMutex(cg_decode.mutex);
+	// append, so that CGs are decoded in the order they were requested
+	struct cg_decode_job **tail = &cg_decode.jobs;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = job;
+	cg_decode.nr_jobs++;
+	cg_decode.prefetches++;
+	SDL_CondSignal(cg_decode.queued);
+	SDL_UnlockMutex(cg_decode.mutex);
+}
+
+static bool cg_decode_should_queue(int id, const char *name)
+{
+	if (cg_cache.max_entries > 0 && *cg_cache_find(id, name))
+		return false;
+	cg_decode_init();
+	cg_decode_collect();
+	SDL_LockMutex(cg_decode.mutex);
+	bool r = cg_decode.nr_jobs < CG_DECODE_MAX_JOBS && !*cg_decode_find(id, name);
+	SDL_UnlockMutex(cg_decode.mutex);
+	return r;
+}
+
+void asset_cg_prefetch(int id)
+{
+	if (!assets[ASSET_CG] || !cg_decode_should_queue(id, NULL))
+		return;
+	struct archive_data *data = asset_get(ASSET_CG, id);
+	if (data)
+		cg_decode_queue(id, NULL, data);
+}
+
+void asset_cg_prefetch_by_name(const char *name)
+{
+	if (!assets[ASSET_CG] || !assets[ASSET_CG]->get_by_name || !cg_decode_should_queue(0, name))
+		return;
+	int id;
+	struct archive_data *data = asset_get_by_name(ASSET_CG, name, &id);
+	if (data)
+		cg_decode_queue(id, name, data);
+}
+
+/*
+ * Games often load runs of consecutively numbered CGs (animation frames,
+ * numeral fonts). Once a run is detected, the next few CGs are prefetched.
+ */
+#define CG_PREDICT_MIN_RUN 2
+#define CG_PREDICT_DISTANCE 4
+
+static void cg_predict(int id)
+{
+	// without the cache, predicted CGs would be held until loaded
+	if (cg_cache.max_entries <= 0)
+		return;
+	if (id == cg_decode.last_id + 1)
+		cg_decode.run_length++;
+	else if (id != cg_decode.last_id)
+		cg_decode.run_length = 0;
+	cg_decode.last_id = id;
+
+	if (cg_decode.run_length < CG_PREDICT_MIN_RUN)
+		return;
+	for (int i = 1; i <= CG_PREDICT_DISTANCE; i++) {
+		if (!asset_exists(ASSET_CG, id + i))
+			break;
+		asset_cg_prefetch(id + i);
+	}
+}
+
+void asset_cg_decode_get_stats(struct asset_cg_decode_stats *stats)
+{
+	if (cg_decode.initialized)
+		SDL_LockMutex(cg_decode.mutex);
+	stats->nr_jobs = cg_decode.nr_jobs;
+	stats->prefetches = cg_decode.prefetches;
+	stats->waits = cg_decode.waits;
+	if (cg_decode.initialized)
+		SDL_UnlockMutex(cg_decode.mutex);
 }
 
 struct cg *asset_cg_load(int id)
 {
+	struct cg *cg;
+	cg_decode_collect();
+	if (cg_cache.max_entries > 0 && (cg = cg_cache_get(id, NULL, NULL)))
+		goto predict;
+	if ((cg = cg_decode_claim(id, NULL, NULL)))
+		goto predict;
+
 	struct archive_data *data = asset_get(ASSET_CG, id);
 	if (!data)
 		return NULL;
-	struct cg *cg = cg_load_data(data);
+	cg = asset_cg_decode(data);
 	archive_free_data(data);
+
+	if (cg && cg_cache.max_entries > 0)
+		cg_cache_put(id, NULL, cg);
+predict:
+	cg_predict(id);
 	return cg;
 }
 
 struct cg *asset_cg_load_by_name(const char *name, int *id_out)
 {
-	struct archive_data *data = asset_get_by_name(ASSET_CG, name, id_out);
+	struct cg *cg;
+	cg_decode_collect();
+	if (cg_cache.max_entries > 0 && (cg = cg_cache_get(0, name, id_out)))
+		return cg;
+	if ((cg = cg_decode_claim(0, name, id_out)))
+		return cg;
+
+	int id;
+	struct archive_data *data = asset_get_by_name(ASSET_CG, name, &id);
 	if (!data)
 		return NULL;
-	struct cg *cg = cg_load_data(data);
+	cg = asset_cg_decode(data);
 	archive_free_data(data);
+
+	if (id_out)
+		*id_out = id;
+	if (cg && cg_cache.max_entries > 0)
+		cg_cache_put(id, name, cg);
 	return cg;
 }
 
@@ -148,7 +713,9 @@ bool asset_cg_get_metrics(int id, struct cg_metrics *metrics)
 	struct archive_data *data = asset_get(ASSET_CG, id);
 	if (!data)
 		return false;
+	cg_decoder_lock();
 	bool r = cg_get_metrics_data(data, metrics);
+	cg_decoder_unlock();
 	archive_free_data(data);
 	return r;
 }
@@ -158,7 +725,9 @@ bool asset_cg_get_metrics_by_name(const char *name, struct cg_metrics *metrics)
 	struct archive_data *data = asset_get_by_name(ASSET_CG, name, NULL);
 	if (!data)
 		return false;
+	cg_decoder_lock();
 	bool r = cg_get_metrics_data(data, metrics);
+	cg_decoder_unlock();
 	archive_free_data(data);
 	return r;
 }
@@ -438,4 +1007,7 @@ void asset_manager_init(void)
 	afa_init(ASSET_PACT, afa_filenames[ASSET_PACT]);
 	afa_init(ASSET_DATA, afa_filenames[ASSET_DATA]);
 	afa_init(ASSET_FLASH, afa_filenames[ASSET_FLASH]);
+
+	// enable the CG cache if configured (games may enlarge it later)
+	asset_cg_cache_init(0);
 }
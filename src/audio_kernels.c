@@ -0,0 +1,446 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "system4.h"
+
+#include "audio_kernels.h"
+
+#if defined(__SSE2__)
+#define HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+static inline float clamp_sample(float s)
+{
+	return s < -1.0f ? -1.0f : (s > 1.0f ? 1.0f : s);
+}
+
+/*
+ * Scalar kernels. These also handle the tails left over by the vector
+ * kernels.
+ */
+
+static void mix_scalar(float *acc, const float *src, float gain, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		acc[i] += clamp_sample(src[i] * gain);
+	}
+}
+
+static void scale_scalar(float *dst, const float *src, float gain, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		dst[i] = clamp_sample(src[i] * gain);
+	}
+}
+
+static void mono_to_stereo_scalar(float *data, unsigned frames)
+{
+	for (int i = frames - 1; i >= 0; i--) {
+		data[i*2+1] = data[i];
+		data[i*2] = data[i];
+	}
+}
+
+static void swap_lr_scalar(float *dst, const float *src, unsigned frames)
+{
+	for (unsigned i = 0; i < frames; i++) {
+		float l = src[i*2];
+		dst[i*2] = src[i*2+1];
+		dst[i*2+1] = l;
+	}
+}
+
+static const struct audio_kernels scalar_kernels = {
+	.name = "scalar",
+	.mix = mix_scalar,
+	.scale = scale_scalar,
+	.mono_to_stereo = mono_to_stereo_scalar,
+	.swap_lr = swap_lr_scalar,
+};
+
+/*
+ * The in-place mono to stereo expansion works backwards from the end of the
+ * buffer so that no sample is overwritten before it is read. The vector
+ * kernels first expand the samples beyond the last full vector, then each
+ * vector (which is loaded before its output is stored).
+ */
+
+#ifdef HAVE_SSE2_KERNELS
+static void mix_sse2(float *acc, const float *src, float gain, unsigned n)
+{
+	__m128 g = _mm_set1_ps(gain);
+	__m128 lo = _mm_set1_ps(-1.0f);
+	__m128 hi = _mm_set1_ps(1.0f);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+		s = _mm_min_ps(_mm_max_ps(s, lo), hi);
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), s));
+	}
+	mix_scalar(acc + i, src + i, gain, n - i);
+}
+
+static void scale_sse2(float *dst, const float *src, float gain, unsigned n)
+{
+	__m128 g = _mm_set1_ps(gain);
+	__m128 lo = _mm_set1_ps(-1.0f);
+	__m128 hi = _mm_set1_ps(1.0f);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+		_mm_storeu_ps(dst + i, _mm_min_ps(_mm_max_ps(s, lo), hi));
+	}
+	scale_scalar(dst + i, src + i, gain, n - i);
+}
+
+static void mono_to_stereo_sse2(float *data, unsigned frames)
+{
+	unsigned i = frames & ~3u;
+	for (unsigned j = frames; j > i; j--) {
+		data[(j-1)*2+1] = data[j-1];
+		data[(j-1)*2] = data[j-1];
+	}
+	while (i > 0) {
+		i -= 4;
+		__m128 v = _mm_loadu_ps(data + i);
+		_mm_storeu_ps(data + i*2 + 4, _mm_unpackhi_ps(v, v));
+		_mm_storeu_ps(data + i*2, _mm_unpacklo_ps(v, v));
+	}
+}
+
+static void swap_lr_sse2(float *dst, const float *src, unsigned frames)
+{
+	unsigned i = 0;
+	for (; i + 2 <= frames; i += 2) {
+		__m128 v = _mm_loadu_ps(src + i*2);
+		_mm_storeu_ps(dst + i*2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+	swap_lr_scalar(dst + i*2, src + i*2, frames - i);
+}
+
+static const struct audio_kernels sse2_kernels = {
+	.name = "sse2",
+	.mix = mix_sse2,
+	.scale = scale_sse2,
+	.mono_to_stereo = mono_to_stereo_sse2,
+	.swap_lr = swap_lr_sse2,
+};
+#endif /* HAVE_SSE2_KERNELS */
+
+#ifdef HAVE_AVX2_KERNELS
+TARGET_AVX2 static void mix_avx2(float *acc, const float *src, float gain, unsigned n)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	__m256 lo = _mm256_set1_ps(-1.0f);
+	__m256 hi = _mm256_set1_ps(1.0f);
+	unsigned i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+		s = _mm256_min_ps(_mm256_max_ps(s, lo), hi);
+		_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), s));
+	}
+	mix_scalar(acc + i, src + i, gain, n - i);
+}
+
+TARGET_AVX2 static void scale_avx2(float *dst, const float *src, float gain, unsigned n)
+{
+	__m256 g = _mm256_set1_ps(gain);
+	__m256 lo = _mm256_set1_ps(-1.0f);
+	__m256 hi = _mm256_set1_ps(1.0f);
+	unsigned i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+		_mm256_storeu_ps(dst + i, _mm256_min_ps(_mm256_max_ps(s, lo), hi));
+	}
+	scale_scalar(dst + i, src + i, gain, n - i);
+}
+
+TARGET_AVX2 static void mono_to_stereo_avx2(float *data, unsigned frames)
+{
+	unsigned i = frames & ~7u;
+	for (unsigned j = frames; j > i; j--) {
+		data[(j-1)*2+1] = data[j-1];
+		data[(j-1)*2] = data[j-1];
+	}
+	while (i > 0) {
+		i -= 8;
+		__m256 v = _mm256_loadu_ps(data + i);
+		// unpack works within 128-bit lanes; fix up the order after
+		__m256 lo = _mm256_unpacklo_ps(v, v);
+		__m256 hi = _mm256_unpackhi_ps(v, v);
+		_mm256_storeu_ps(data + i*2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+		_mm256_storeu_ps(data + i*2, _mm256_permute2f128_ps(lo, hi, 0x20));
+	}
+}
+
+TARGET_AVX2 static void swap_lr_avx2(float *dst, const float *src, unsigned frames)
+{
+	unsigned i = 0;
+	for (; i + 4 <= frames; i += 4) {
+		__m256 v = _mm256_loadu_ps(src + i*2);
+		_mm256_storeu_ps(dst + i*2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+	swap_lr_scalar(dst + i*2, src + i*2, frames - i);
+}
+
+static const struct audio_kernels avx2_kernels = {
+	.name = "avx2",
+	.mix = mix_avx2,
+	.scale = scale_avx2,
+	.mono_to_stereo = mono_to_stereo_avx2,
+	.swap_lr = swap_lr_avx2,
+};
+#endif /* HAVE_AVX2_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+static void mix_neon(float *acc, const float *src, float gain, unsigned n)
+{
+	float32x4_t lo = vdupq_n_f32(-1.0f);
+	float32x4_t hi = vdupq_n_f32(1.0f);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t s = vmulq_n_f32(vld1q_f32(src + i), gain);
+		s = vminq_f32(vmaxq_f32(s, lo), hi);
+		vst1q_f32(acc + i, vaddq_f32(vld1q_f32(acc + i), s));
+	}
+	mix_scalar(acc + i, src + i, gain, n - i);
+}
+
+static void scale_neon(float *dst, const float *src, float gain, unsigned n)
+{
+	float32x4_t lo = vdupq_n_f32(-1.0f);
+	float32x4_t hi = vdupq_n_f32(1.0f);
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t s = vmulq_n_f32(vld1q_f32(src + i), gain);
+		vst1q_f32(dst + i, vminq_f32(vmaxq_f32(s, lo), hi));
+	}
+	scale_scalar(dst + i, src + i, gain, n - i);
+}
+
+static void mono_to_stereo_neon(float *data, unsigned frames)
+{
+	unsigned i = frames & ~3u;
+	for (unsigned j = frames; j > i; j--) {
+		data[(j-1)*2+1] = data[j-1];
+		data[(j-1)*2] = data[j-1];
+	}
+	while (i > 0) {
+		i -= 4;
+		float32x4_t v = vld1q_f32(data + i);
+		float32x4x2_t z = vzipq_f32(v, v);
+		vst1q_f32(data + i*2 + 4, z.val[1]);
+		vst1q_f32(data + i*2, z.val[0]);
+	}
+}
+
+static void swap_lr_neon(float *dst, const float *src, unsigned frames)
+{
+	unsigned i = 0;
+	for (; i + 2 <= frames; i += 2) {
+		vst1q_f32(dst + i*2, vrev64q_f32(vld1q_f32(src + i*2)));
+	}
+	swap_lr_scalar(dst + i*2, src + i*2, frames - i);
+}
+
+static const struct audio_kernels neon_kernels = {
+	.name = "neon",
+	.mix = mix_neon,
+	.scale = scale_neon,
+	.mono_to_stereo = mono_to_stereo_neon,
+	.swap_lr = swap_lr_neon,
+};
+#endif /* HAVE_NEON_KERNELS */
+
+const struct audio_kernels *audio_kernels = &scalar_kernels;
+
+/*
+ * Returns the implementations supported by the CPU, best first.
+ */
+static int get_supported_kernels(const struct audio_kernels **out)
+{
+	int n = 0;
+#ifdef HAVE_AVX2_KERNELS
+	if (SDL_HasAVX2())
+		out[n++] = &avx2_kernels;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+	if (SDL_HasSSE2())
+		out[n++] = &sse2_kernels;
+#endif
+#ifdef HAVE_NEON_KERNELS
+	if (SDL_HasNEON())
+		out[n++] = &neon_kernels;
+#endif
+	out[n++] = &scalar_kernels;
+	return n;
+}
+
+void audio_kernels_init(void)
+{
+	const struct audio_kernels *kernels[4];
+	get_supported_kernels(kernels);
+	audio_kernels = kernels[0];
+}
+
+#define BENCH_FRAMES 1024
+#define BENCH_VOICES 64
+#define BENCH_ITERATIONS 200
+
+// Vector kernels may round differently from the scalar ones (e.g. by using
+// FMA), but shuffles must be exact.
+#define VERIFY_TOLERANCE 1e-6f
+
+static bool verify_samples(const char *kernel, const char *fn, unsigned n,
+		const float *actual, const float *expected, float tolerance)
+{
+	for (unsigned i = 0; i < n; i++) {
+		if (!(fabsf(actual[i] - expected[i]) <= tolerance)) {
+			printf("%-8s %s: MISMATCH at sample %u of %u: %f (expected %f)\n",
+					kernel, fn, i, n, actual[i], expected[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Check each function of KERN against the scalar implementation, for
+ * lengths which exercise the tail handling of the vector kernels.
+ */
+static bool verify_kernels(const struct audio_kernels *kern, const float *src)
+{
+	static const unsigned lengths[] = { 1, 3, 4, 7, 8, 9, 15, 16, 17, 31, 33, BENCH_FRAMES - 1 };
+	float *expected = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	float *actual = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	bool ok = true;
+
+	for (unsigned l = 0; ok && l < sizeof(lengths)/sizeof(*lengths); l++) {
+		unsigned n = lengths[l];
+
+		// gain > 1 so that some samples are clamped
+		for (unsigned i = 0; i < n; i++) {
+			expected[i] = actual[i] = src[n - i] * 0.25f;
+		}
+		scalar_kernels.mix(expected, src, 1.5f, n);
+		kern->mix(actual, src, 1.5f, n);
+		ok = verify_samples(kern->name, "mix", n, actual, expected, VERIFY_TOLERANCE);
+
+		scalar_kernels.scale(expected, src, 1.5f, n);
+		kern->scale(actual, src, 1.5f, n);
+		ok = ok && verify_samples(kern->name, "scale", n, actual, expected, VERIFY_TOLERANCE);
+
+		memcpy(expected, src, n * sizeof(float));
+		memcpy(actual, src, n * sizeof(float));
+		scalar_kernels.mono_to_stereo(expected, n);
+		kern->mono_to_stereo(actual, n);
+		ok = ok && verify_samples(kern->name, "mono_to_stereo", n * 2, actual, expected, 0.0f);
+
+		scalar_kernels.swap_lr(expected, src, n);
+		kern->swap_lr(actual, src, n);
+		ok = ok && verify_samples(kern->name, "swap_lr", n * 2, actual, expected, 0.0f);
+
+		memcpy(actual, src, n * 2 * sizeof(float));
+		kern->swap_lr(actual, actual, n);
+		ok = ok && verify_samples(kern->name, "swap_lr (in place)", n * 2, actual, expected, 0.0f);
+	}
+
+	free(expected);
+	free(actual);
+	return ok;
+}
+
+static double bench_elapsed_us(uint64_t start)
+{
+	return (double)(SDL_GetPerformanceCounter() - start) * 1000000.0
+		/ (double)SDL_GetPerformanceFrequency();
+}
+
+/*
+ * Simulates mixing BENCH_VOICES mono voices into a stereo buffer, which is
+ * about the worst case for the engine (every anonymous sound channel
+ * playing at once). Each implementation is first checked against the
+ * scalar one, and its output for the simulated buffer is compared as well.
+ */
+void audio_kernels_benchmark(void)
+{
+	const struct audio_kernels *kernels[4];
+	int nr_kernels = get_supported_kernels(kernels);
+
+	float *src = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	float *buf = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	float *acc = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	float *out = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	float *scalar_out = xmalloc(BENCH_FRAMES * 2 * sizeof(float));
+	for (int i = 0; i < BENCH_FRAMES * 2; i++) {
+		src[i] = (float)((i * 7919) % 2001 - 1000) / 800.0f;
+	}
+
+	double scalar_us = 0.0;
+	for (int k = nr_kernels - 1; k >= 0; k--) {
+		const struct audio_kernels *kern = kernels[k];
+		bool ok = kern == &scalar_kernels || verify_kernels(kern, src);
+		uint64_t start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < BENCH_ITERATIONS; it++) {
+			memset(acc, 0, BENCH_FRAMES * 2 * sizeof(float));
+			for (int v = 0; v < BENCH_VOICES; v++) {
+				memcpy(buf, src, BENCH_FRAMES * sizeof(float));
+				kern->mono_to_stereo(buf, BENCH_FRAMES);
+				if (v & 1)
+					kern->swap_lr(buf, buf, BENCH_FRAMES);
+				kern->mix(acc, buf, 0.5f, BENCH_FRAMES * 2);
+			}
+			kern->scale(out, acc, 0.8f, BENCH_FRAMES * 2);
+		}
+		double us = bench_elapsed_us(start) / BENCH_ITERATIONS;
+		if (kern == &scalar_kernels) {
+			scalar_us = us;
+			memcpy(scalar_out, out, BENCH_FRAMES * 2 * sizeof(float));
+		} else if (ok) {
+			// errors can accumulate over the voices
+			ok = verify_samples(kern->name, "buffer", BENCH_FRAMES * 2, out,
+					scalar_out, VERIFY_TOLERANCE * BENCH_VOICES);
+		}
+		printf("%-8s %8.1f us/buffer  (%.2fx)%s%s\n", kern->name, us,
+				us > 0.0 ? scalar_us / us : 0.0,
+				kern == audio_kernels ? "  [active]" : "",
+				ok ? "" : "  [MISMATCH]");
+	}
+
+	free(src);
+	free(buf);
+	free(acc);
+	free(out);
+	free(scalar_out);
+}
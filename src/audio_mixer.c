@@ -26,6 +26,7 @@
 
 #include "asset_manager.h"
 #include "audio.h"
+#include "audio_kernels.h"
 #include "mixer.h"
 #include "xsystem4.h"
 
@@ -42,6 +43,70 @@
 
 #define CHUNK_SIZE 1024
 
+/*
+ * Streams are decoded ahead of time by a worker thread into a ring of
+ * NR_BLOCKS chunks (~370ms at 44.1kHz), so that the audio callback only has
+ * to copy decoded frames. Loop points and seeks are handled on the decoder
+ * side; the ring holds frames in playback order.
+ */
+#define NR_BLOCKS 16
+#define PRIME_BLOCKS 2
+#define DECODER_INTERVAL 10
+
+struct audio_block {
+	float data[CHUNK_SIZE * 2];
+	uint_least32_t frames;
+	// stream position after this block
+	uint_least32_t pos;
+	// the stream ends after this block
+	bool last;
+};
+
+/*
+ * Decoded PCM cache.
+ *
+ * Short sound effects (clicks, hit sounds, voice blips) are played over and
+ * over. Rather than opening a new decoder every time, clips shorter than
+ * config.sound_cache_max_length are decoded once to interleaved stereo
+ * float (the mixer's sample format) and kept in LRU order. Channels opened
+ * from a cached clip share its buffer, and the audio callback reads from it
+ * directly (resampling to the output rate is done by the mixer, as for
+ * streams).
+ */
+#define PCM_CACHE_NR_BUCKETS 64
+#define PCM_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+struct pcm_buffer {
+	int no;
+	int data_no;
+	float *data;
+	uint_least32_t frames;
+	int samplerate;
+	size_t size;
+	// number of channels using this buffer
+	int refs;
+	bool cached;
+	// LRU list (most recently used first)
+	struct pcm_buffer *prev;
+	struct pcm_buffer *next;
+	struct pcm_buffer *hash_next;
+};
+
+static struct {
+	int nr_entries;
+	size_t bytes;
+	struct pcm_buffer *head;
+	struct pcm_buffer *tail;
+	struct pcm_buffer *buckets[PCM_CACHE_NR_BUCKETS];
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+} pcm_cache = {0};
+
+// Closed channels are kept for reuse, so that playing a cached clip
+// doesn't need to allocate.
+#define NR_FREE_CHANNELS 16
+
 struct fade {
 	atomic_bool fading;
 	bool stop;
@@ -62,6 +127,8 @@ struct channel {
 	SNDFILE *file;
 	SF_INFO info;
 	sf_count_t offset;
+	// decoded audio data (if opened from the PCM cache)
+	struct pcm_buffer *pcm;
 
 	// stream data
 	atomic_int voice;
@@ -73,10 +140,23 @@ struct channel {
 
 	atomic_uint volume;
 	atomic_bool swapped;
+	struct fade fade;
+
+	// decoder data (protected by lock)
+	SDL_mutex *lock;
+	uint_least32_t decode_frame;
 	uint_least32_t loop_start;
 	uint_least32_t loop_end;
 	atomic_uint loop_count;
-	struct fade fade;
+	bool active;
+	bool decode_done;
+	// set by the audio callback when the stream should restart from 0
+	atomic_bool rewind;
+
+	// ring of decoded blocks: written by the decoder, read by the callback
+	struct audio_block *blocks;
+	atomic_uint head;
+	atomic_uint tail;
 };
 
 struct mixer {
@@ -98,6 +178,24 @@ static int nr_mixers = 0;
 
 static SDL_AudioDeviceID audio_device = 0;
 
+/*
+ * decoder.lock protects the channel list; the decoder state of each channel
+ * is protected by the channel's own lock, so that the main thread only has
+ * to wait for the block currently being decoded. When both are needed,
+ * decoder.lock is taken first.
+ */
+static struct {
+	SDL_mutex *lock;
+	SDL_cond *cond;
+	SDL_Thread *thread;
+	bool quit;
+	struct channel **channels;
+	int nr_channels;
+} decoder = {0};
+
+static struct channel *free_channels[NR_FREE_CHANNELS];
+static int nr_free_channels = 0;
+
 /*
  * The SDL2 audio callback.
  */
@@ -113,17 +211,21 @@ static void audio_callback(possibly_unused void *data, Uint8 *stream, int len)
  * Seek to the specified position in the stream.
  * Returns true if the seek succeeded, otherwise returns false.
  */
-static bool cb_seek(struct channel *ch, uint_least32_t pos)
+static bool decoder_seek(struct channel *ch, uint_least32_t pos)
 {
 	if (pos > ch->info.frames) {
 		pos = ch->info.frames;
 	}
+	if (ch->pcm) {
+		ch->decode_frame = pos;
+		return true;
+	}
 	sf_count_t r = sf_seek(ch->file, pos, SEEK_SET);
 	if (r < 0) {
 		WARNING("sf_seek failed");
 		return false;
 	}
-	ch->frame = r;
+	ch->decode_frame = r;
 	return true;
 }
 
@@ -131,9 +233,9 @@ static bool cb_seek(struct channel *ch, uint_least32_t pos)
  * Seek to loop start, if the stream should loop.
  * Returns true if the stream should loop, false if it should stop.
  */
-static bool cb_loop(struct channel *ch)
+static bool decoder_loop(struct channel *ch)
 {
-	if (!cb_seek(ch, ch->loop_start) || ch->loop_count == 1) {
+	if (!decoder_seek(ch, ch->loop_start) || ch->loop_count == 1) {
 		return false;
 	}
 	if (ch->loop_count > 1) {
@@ -143,49 +245,166 @@ static bool cb_loop(struct channel *ch)
 }
 
 /*
- * Callback to refill the stream's audio data.
- * Called from sys_mixer_mix_audio.
+ * Discard any decoded data and restart decoding from POS.
+ * The channel must not be playing (or the audio device must be locked).
+ */
+static bool decoder_reset(struct channel *ch, uint_least32_t pos)
+{
+	bool r = decoder_seek(ch, pos);
+	atomic_store(&ch->head, 0);
+	atomic_store(&ch->tail, 0);
+	ch->decode_done = false;
+	ch->rewind = false;
+	ch->frame = ch->decode_frame;
+	return r;
+}
+
+static sf_count_t decoder_read(struct channel *ch, float *out, sf_count_t count)
+{
+	if (!ch->pcm)
+		return sf_readf_float(ch->file, out, count);
+	count = min(count, (sf_count_t)(ch->pcm->frames - ch->decode_frame));
+	memcpy(out, ch->pcm->data + ch->decode_frame * 2, count * 2 * sizeof(float));
+	return count;
+}
+
+/*
+ * Decode the next CHUNK_SIZE frames of the stream into OUT, following loop
+ * points (seamlessly) as needed. Returns true if the stream ends after
+ * these frames.
  */
-static int cb_read_frames(struct channel *ch, float *out, sf_count_t frame_count, uint_least32_t *num_read)
-{
-	*num_read = 0;
-
-	// handle case where chunk crosses loop point (seamless)
-	// NOTE: it's assumed that the length of the loop is greater than the chunk length
-	if (ch->frame + frame_count >= ch->loop_end) {
-		// read frames up to loop_end
-		*num_read = sf_readf_float(ch->file, out, ch->loop_end - ch->frame);
-		// adjust parameters for later
-		ch->frame += *num_read;
-		out += *num_read;
-		frame_count -= *num_read;
-		// seek to loop_start
-		if (!cb_loop(ch))
-			return STS_STREAM_COMPLETE;
-	} else if (ch->frame >= ch->loop_end) {
-		// seek to loop_start
-		if (!cb_loop(ch))
-			return STS_STREAM_COMPLETE;
-	}
-
-	// read remaining data
-	sf_count_t n = sf_readf_float(ch->file, out, frame_count);
-	*num_read += n;
-	ch->frame += n;
-	out += *num_read;
-	frame_count -= *num_read;
-
-	// XXX: This *shouldn't* be necessary, but sometimes libsndfile seems to stop reading
-	//      just before the end of file (i.e. ch->frame + frame_count is < ch->info.frames,
-	//      yet sf_readf_float returns less that the requested amount of frames).
-	//      Not sure if this is a bug in xsystem4 or libsndfile
-	if (frame_count > 0) {
-		if (!cb_loop(ch))
-			return STS_STREAM_COMPLETE;
-		*num_read += sf_readf_float(ch->file, out, frame_count);
+static bool decode_frames(struct channel *ch, float *out, uint_least32_t *frames)
+{
+	uint_least32_t n = 0;
+	bool looped = false;
+	bool last = false;
+	while (n < CHUNK_SIZE) {
+		if (ch->decode_frame >= ch->loop_end) {
+			// a loop which yields no frames would never end
+			if (looped || !decoder_loop(ch)) {
+				last = true;
+				break;
+			}
+			looped = true;
+			continue;
+		}
+		sf_count_t count = min(CHUNK_SIZE - n, ch->loop_end - ch->decode_frame);
+		sf_count_t r = decoder_read(ch, out + n * ch->info.channels, count);
+		// XXX: Sometimes libsndfile stops reading just before the end of
+		//      the file; treat this as reaching the loop point.
+		if (r <= 0) {
+			if (looped || !decoder_loop(ch)) {
+				last = true;
+				break;
+			}
+			looped = true;
+			continue;
+		}
+		looped = false;
+		n += r;
+		ch->decode_frame += r;
 	}
+	memset(out + n * ch->info.channels, 0, (CHUNK_SIZE - n) * ch->info.channels * sizeof(float));
 
-	return STS_STREAM_CONTINUE;
+	// convert mono to stereo
+	if (ch->info.channels == 1)
+		audio_kernels->mono_to_stereo(out, CHUNK_SIZE);
+
+	*frames = n;
+	return last;
+}
+
+static void decode_block(struct channel *ch, struct audio_block *b)
+{
+	b->last = decode_frames(ch, b->data, &b->frames);
+	b->pos = ch->decode_frame;
+}
+
+/*
+ * Decode up to MAX_BLOCKS blocks into the channel's ring.
+ * Returns the number of blocks decoded.
+ * Must be called with the channel's lock held.
+ */
+static int decoder_fill(struct channel *ch, int max_blocks)
+{
+	if (!ch->blocks || !ch->active || ch->decode_done)
+		return 0;
+	unsigned head = atomic_load_explicit(&ch->head, memory_order_relaxed);
+	int i;
+	for (i = 0; i < max_blocks; i++) {
+		unsigned tail = atomic_load_explicit(&ch->tail, memory_order_acquire);
+		if (head - tail >= NR_BLOCKS)
+			break;
+		struct audio_block *b = &ch->blocks[head % NR_BLOCKS];
+		decode_block(ch, b);
+		atomic_store_explicit(&ch->head, ++head, memory_order_release);
+		if (b->last) {
+			ch->decode_done = true;
+			i++;
+			break;
+		}
+	}
+	return i;
+}
+
+static int decoder_thread(possibly_unused void *data)
+{
+	SDL_LockMutex(decoder.lock);
+	while (!decoder.quit) {
+		// Decode one block per channel per pass. Only the channel's lock is
+		// held while decoding, so the main thread can play/stop/seek other
+		// channels (or add/remove channels) in the meantime.
+		bool progress = false;
+		for (int i = 0; i < decoder.nr_channels; i++) {
+			struct channel *ch = decoder.channels[i];
+			SDL_LockMutex(ch->lock);
+			SDL_UnlockMutex(decoder.lock);
+			if (decoder_fill(ch, 1))
+				progress = true;
+			SDL_UnlockMutex(ch->lock);
+			SDL_LockMutex(decoder.lock);
+		}
+		if (!progress && !decoder.quit)
+			SDL_CondWaitTimeout(decoder.cond, decoder.lock, DECODER_INTERVAL);
+	}
+	SDL_UnlockMutex(decoder.lock);
+	return 0;
+}
+
+static void decoder_add_channel(struct channel *ch)
+{
+	SDL_LockMutex(decoder.lock);
+	decoder.channels = xrealloc_array(decoder.channels, decoder.nr_channels,
+			decoder.nr_channels+1, sizeof(struct channel*));
+	decoder.channels[decoder.nr_channels++] = ch;
+	SDL_UnlockMutex(decoder.lock);
+}
+
+static void decoder_remove_channel(struct channel *ch)
+{
+	SDL_LockMutex(decoder.lock);
+	// wait for the decoder thread to finish with the channel
+	SDL_LockMutex(ch->lock);
+	for (int i = 0; i < decoder.nr_channels; i++) {
+		if (decoder.channels[i] == ch) {
+			decoder.channels[i] = decoder.channels[--decoder.nr_channels];
+			break;
+		}
+	}
+	SDL_UnlockMutex(ch->lock);
+	SDL_UnlockMutex(decoder.lock);
+}
+
+static void decoder_stop(void)
+{
+	if (!decoder.thread)
+		return;
+	SDL_LockMutex(decoder.lock);
+	decoder.quit = true;
+	SDL_CondSignal(decoder.cond);
+	SDL_UnlockMutex(decoder.lock);
+	SDL_WaitThread(decoder.thread, NULL);
+	decoder.thread = NULL;
 }
 
 /*
@@ -207,29 +426,38 @@ static float cb_calc_fade(struct fade *fade)
 static int refill_stream(sts_mixer_sample_t *sample, void *data)
 {
 	struct channel *ch = data;
-	uint_least32_t frames_read;
-	memset(ch->data, 0, sizeof(float) * sample->length);
-
-	// read audio data from file
-	int r = cb_read_frames(ch, ch->data, CHUNK_SIZE, &frames_read);
-
-	// convert mono to stereo
-	if (ch->info.channels == 1) {
-		for (int i = CHUNK_SIZE-1; i >= 0; i--) {
-			ch->data[i*2+1] = ch->data[i];
-			ch->data[i*2] = ch->data[i];
-		}
+	uint_least32_t frames_read = 0;
+	int r = STS_STREAM_CONTINUE;
+
+	// cached clips are read directly from memory
+	if (ch->pcm) {
+		if (decode_frames(ch, ch->data, &frames_read))
+			r = STS_STREAM_COMPLETE;
+		ch->frame = ch->decode_frame;
+		if (ch->swapped)
+			audio_kernels->swap_lr(ch->data, ch->data, CHUNK_SIZE);
+		goto update_gain;
 	}
 
-	// reverse LR channels
-	else if (ch->swapped) {
-		for (int i = 0; i < CHUNK_SIZE; i++) {
-			float tmp = ch->data[i*2];
-			ch->data[i*2] = ch->data[i*2+1];
-			ch->data[i*2+1] = tmp;
+	// copy the next decoded block (if the decoder fell behind, play silence)
+	unsigned tail = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+	if (tail == atomic_load_explicit(&ch->head, memory_order_acquire)) {
+		memset(ch->data, 0, sizeof(float) * sample->length);
+	} else {
+		struct audio_block *b = &ch->blocks[tail % NR_BLOCKS];
+		if (ch->swapped) {
+			audio_kernels->swap_lr(ch->data, b->data, CHUNK_SIZE);
+		} else {
+			memcpy(ch->data, b->data, sizeof(ch->data));
 		}
+		frames_read = b->frames;
+		ch->frame = b->pos;
+		if (b->last)
+			r = STS_STREAM_COMPLETE;
+		atomic_store_explicit(&ch->tail, tail + 1, memory_order_release);
 	}
 
+update_gain:
 	// set gain for fade
 	if (ch->fade.fading) {
 		float gain = cb_calc_fade(&ch->fade);
@@ -241,7 +469,7 @@ static int refill_stream(sts_mixer_sample_t *sample, void *data)
 			ch->fade.fading = false;
 			ch->volume = ch->fade.end_volume * 100.0;
 			if (ch->fade.stop) {
-				cb_seek(ch, 0);
+				ch->rewind = true;
 				r = STS_STREAM_COMPLETE;
 			}
 		}
@@ -268,30 +496,64 @@ static int refill_mixer(sts_mixer_sample_t *sample, void *data)
 	return STS_STREAM_CONTINUE;
 }
 
-int channel_play(struct channel *ch)
+/*
+ * Lock the decoder state of a channel. For cached clips the decoder state is
+ * used by the audio callback, so the audio device is locked as well.
+ */
+static void channel_lock(struct channel *ch)
 {
-	SDL_LockAudioDevice(audio_device);
-	if (ch->voice >= 0) {
+	SDL_LockMutex(ch->lock);
+	if (ch->pcm)
+		SDL_LockAudioDevice(audio_device);
+}
+
+static void channel_unlock(struct channel *ch)
+{
+	if (ch->pcm)
 		SDL_UnlockAudioDevice(audio_device);
+	SDL_UnlockMutex(ch->lock);
+}
+
+int channel_play(struct channel *ch)
+{
+	if (ch->voice >= 0)
 		return 1;
-	}
+
+	// prime the ring so that playback doesn't start with an underrun
+	SDL_LockMutex(ch->lock);
+	if (!ch->pcm && !ch->blocks)
+		ch->blocks = xcalloc(NR_BLOCKS, sizeof(struct audio_block));
+	if (ch->rewind)
+		decoder_reset(ch, 0);
+	else if (ch->decode_done)
+		decoder_reset(ch, ch->decode_frame);
+	ch->active = true;
+	decoder_fill(ch, PRIME_BLOCKS);
+	SDL_CondSignal(decoder.cond);
+
+	SDL_LockAudioDevice(audio_device);
 	memset(ch->data, 0, sizeof(ch->data));
 	ch->voice = sts_mixer_play_stream(&mixers[ch->mixer_no].mixer, &ch->stream, 1.0f);
 	SDL_UnlockAudioDevice(audio_device);
+	SDL_UnlockMutex(ch->lock);
 	return 1;
 }
 
 int channel_stop(struct channel *ch)
 {
+	SDL_LockMutex(ch->lock);
 	SDL_LockAudioDevice(audio_device);
 	if (ch->voice < 0) {
 		SDL_UnlockAudioDevice(audio_device);
+		SDL_UnlockMutex(ch->lock);
 		return 1;
 	}
-	cb_seek(ch, 0);
 	sts_mixer_stop_voice(&mixers[ch->mixer_no].mixer, ch->voice);
 	ch->voice = -1;
 	SDL_UnlockAudioDevice(audio_device);
+	decoder_reset(ch, 0);
+	ch->active = false;
+	SDL_UnlockMutex(ch->lock);
 	return 1;
 }
 
@@ -302,9 +564,9 @@ int channel_is_playing(struct channel *ch)
 
 int channel_set_loop_count(struct channel *ch, int count)
 {
-	SDL_LockAudioDevice(audio_device);
+	channel_lock(ch);
 	ch->loop_count = count;
-	SDL_UnlockAudioDevice(audio_device);
+	channel_unlock(ch);
 	return 1;
 }
 
@@ -315,17 +577,17 @@ int channel_get_loop_count(struct channel *ch)
 
 int channel_set_loop_start_pos(struct channel *ch, int pos)
 {
-	SDL_LockAudioDevice(audio_device);
+	channel_lock(ch);
 	ch->loop_start = pos;
-	SDL_UnlockAudioDevice(audio_device);
+	channel_unlock(ch);
 	return 1;
 }
 
 int channel_set_loop_end_pos(struct channel *ch, int pos)
 {
-	SDL_LockAudioDevice(audio_device);
+	channel_lock(ch);
 	ch->loop_end = pos;
-	SDL_UnlockAudioDevice(audio_device);
+	channel_unlock(ch);
 	return 1;
 }
 
@@ -417,9 +679,12 @@ int channel_get_sample_length(struct channel *ch)
 int channel_seek(struct channel *ch, int pos)
 {
 	// NOTE: SACT2.Music_Seek doesn't seem to do anything in Sengoku Rance...
+	SDL_LockMutex(ch->lock);
 	SDL_LockAudioDevice(audio_device);
-	int r = cb_seek(ch, muldiv(pos, ch->info.samplerate, 1000));
+	int r = decoder_reset(ch, muldiv(pos, ch->info.samplerate, 1000));
 	SDL_UnlockAudioDevice(audio_device);
+	decoder_fill(ch, PRIME_BLOCKS);
+	SDL_UnlockMutex(ch->lock);
 	return r;
 }
 
@@ -441,6 +706,8 @@ int channel_get_time_length(struct channel *ch)
 
 int channel_get_data_no(struct channel *ch)
 {
+	if (ch->pcm)
+		return ch->pcm->data_no;
 	return ch->dfile ? ch->dfile->no : -1;
 }
 
@@ -496,36 +763,32 @@ static SF_VIRTUAL_IO channel_vio = {
 	.tell = channel_vio_tell
 };
 
-struct channel *channel_open(enum asset_type type, int no)
+static struct channel *channel_alloc(void)
 {
-	// get file from archive
-	struct archive_data *dfile = asset_get(type, no);
-	if (!dfile) {
-		WARNING("Failed to load %s %d", type == ASSET_SOUND ? "WAV" : "BGM", no);
-		return NULL;
+	if (nr_free_channels > 0) {
+		struct channel *ch = free_channels[--nr_free_channels];
+		SDL_mutex *lock = ch->lock;
+		memset(ch, 0, sizeof(struct channel));
+		ch->lock = lock;
+		return ch;
 	}
-
-	struct channel *ch = channel_open_archive_data(dfile, type, no);
-	if (!ch) {
-		WARNING("Failed to open %s %d", type == ASSET_SOUND ? "WAV" : "BGM", no);
-		return NULL;
-	}
-
+	struct channel *ch = xcalloc(1, sizeof(struct channel));
+	ch->lock = SDL_CreateMutex();
 	return ch;
 }
 
-static bool init_channel(struct channel *ch)
+static void channel_free(struct channel *ch)
 {
-	if (sf_error(ch->file) != SF_ERR_NO_ERROR) {
-		WARNING("sf_open_virtual failed: %s", sf_strerror(ch->file));
-		return false;
-	}
-	if (ch->info.channels > 2) {
-		WARNING("Audio file has more than 2 channels");
-		return false;
+	if (nr_free_channels < NR_FREE_CHANNELS) {
+		free_channels[nr_free_channels++] = ch;
+	} else {
+		SDL_DestroyMutex(ch->lock);
+		free(ch);
 	}
+}
 
-	// create stream
+static void init_stream(struct channel *ch)
+{
 	ch->stream.userdata = ch;
 	ch->stream.callback = refill_stream;
 	ch->stream.sample.frequency = ch->info.samplerate;
@@ -541,13 +804,221 @@ static bool init_channel(struct channel *ch)
 	ch->mixer_no = 0;
 
 	ch->no = -1;
+}
+
+static bool init_channel(struct channel *ch)
+{
+	if (sf_error(ch->file) != SF_ERR_NO_ERROR) {
+		WARNING("sf_open_virtual failed: %s", sf_strerror(ch->file));
+		return false;
+	}
+	if (ch->info.channels > 2) {
+		WARNING("Audio file has more than 2 channels");
+		return false;
+	}
+
+	init_stream(ch);
+	decoder_add_channel(ch);
 	return true;
 }
 
+static void channel_apply_metadata(struct channel *ch, enum asset_type type, int metadata_no)
+{
+	if (type == ASSET_SOUND) {
+		struct wai *wai = wai_get(metadata_no);
+		ch->mixer_no = wai ? wai->channel : 1;
+	} else if (type == ASSET_BGM) {
+		struct bgi *bgi = bgi_get(metadata_no);
+		if (bgi) {
+			ch->volume = clamp(0, 100, bgi->volume);
+			ch->loop_start = clamp(0, ch->info.frames, bgi->loop_start);
+			ch->loop_end = clamp(0, ch->info.frames, bgi->loop_end);
+			ch->loop_count = max(0, bgi->loop_count);
+			ch->mixer_no = clamp(0, nr_mixers, bgi->channel);
+		} else {
+			ch->loop_count = 0;
+		}
+	}
+	ch->no = metadata_no;
+}
+
+static struct pcm_buffer **pcm_cache_find(int no)
+{
+	struct pcm_buffer **e = &pcm_cache.buckets[(unsigned)no % PCM_CACHE_NR_BUCKETS];
+	for (; *e; e = &(*e)->hash_next) {
+		if ((*e)->no == no)
+			return e;
+	}
+	return e;
+}
+
+static void pcm_cache_unlink(struct pcm_buffer *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		pcm_cache.head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		pcm_cache.tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void pcm_cache_push_front(struct pcm_buffer *e)
+{
+	e->next = pcm_cache.head;
+	e->prev = NULL;
+	if (pcm_cache.head)
+		pcm_cache.head->prev = e;
+	else
+		pcm_cache.tail = e;
+	pcm_cache.head = e;
+}
+
+static void pcm_buffer_free(struct pcm_buffer *buf)
+{
+	free(buf->data);
+	free(buf);
+}
+
+static void pcm_buffer_unref(struct pcm_buffer *buf)
+{
+	if (--buf->refs == 0 && !buf->cached)
+		pcm_buffer_free(buf);
+}
+
+static void pcm_cache_remove(struct pcm_buffer *e)
+{
+	struct pcm_buffer **p = pcm_cache_find(e->no);
+	assert(*p == e);
+	*p = e->hash_next;
+	pcm_cache_unlink(e);
+	pcm_cache.nr_entries--;
+	pcm_cache.bytes -= e->size;
+	// the buffer is freed when the last channel using it is closed
+	e->cached = false;
+	if (!e->refs)
+		pcm_buffer_free(e);
+}
+
+static struct pcm_buffer *pcm_cache_get(int no)
+{
+	struct pcm_buffer *e = *pcm_cache_find(no);
+	if (!e) {
+		pcm_cache.misses++;
+		return NULL;
+	}
+	pcm_cache.hits++;
+	pcm_cache_unlink(e);
+	pcm_cache_push_front(e);
+	return e;
+}
+
+static void pcm_cache_put(struct pcm_buffer *e)
+{
+	struct pcm_buffer **p = pcm_cache_find(e->no);
+	if (*p)
+		pcm_cache_remove(*p);
+	p = pcm_cache_find(e->no);
+	*p = e;
+	e->cached = true;
+	pcm_cache_push_front(e);
+	pcm_cache.nr_entries++;
+	pcm_cache.bytes += e->size;
+
+	while (pcm_cache.tail != e && pcm_cache.bytes > PCM_CACHE_MAX_BYTES) {
+		pcm_cache_remove(pcm_cache.tail);
+		pcm_cache.evictions++;
+	}
+}
+
+/*
+ * Decode the whole of a (freshly opened) channel's audio file into a PCM
+ * buffer.
+ */
+static struct pcm_buffer *pcm_decode(struct channel *ch, int no)
+{
+	uint_least32_t frames = ch->info.frames;
+	float *data = xmalloc(frames * 2 * sizeof(float));
+	sf_count_t n = sf_readf_float(ch->file, data, frames);
+	if (n <= 0) {
+		free(data);
+		return NULL;
+	}
+	if (ch->info.channels == 1)
+		audio_kernels->mono_to_stereo(data, n);
+
+	struct pcm_buffer *buf = xcalloc(1, sizeof(struct pcm_buffer));
+	buf->no = no;
+	buf->data_no = ch->dfile ? ch->dfile->no : -1;
+	buf->data = data;
+	buf->frames = n;
+	buf->samplerate = ch->info.samplerate;
+	buf->size = frames * 2 * sizeof(float);
+	return buf;
+}
+
+static struct channel *channel_open_pcm(struct pcm_buffer *buf)
+{
+	struct channel *ch = channel_alloc();
+	ch->pcm = buf;
+	buf->refs++;
+	ch->info.frames = buf->frames;
+	ch->info.samplerate = buf->samplerate;
+	ch->info.channels = 2;
+	init_stream(ch);
+	channel_apply_metadata(ch, ASSET_SOUND, buf->no);
+	return ch;
+}
+
+static bool pcm_cacheable(struct channel *ch)
+{
+	if (!config.sound_cache_max_length || ch->info.samplerate <= 0)
+		return false;
+	if (ch->info.frames <= 0 || ch->info.frames > UINT32_MAX / 8)
+		return false;
+	return muldiv(ch->info.frames, 1000, ch->info.samplerate) <= config.sound_cache_max_length;
+}
+
+struct channel *channel_open(enum asset_type type, int no)
+{
+	if (type == ASSET_SOUND) {
+		struct pcm_buffer *buf = pcm_cache_get(no);
+		if (buf)
+			return channel_open_pcm(buf);
+	}
+
+	// get file from archive
+	struct archive_data *dfile = asset_get(type, no);
+	if (!dfile) {
+		WARNING("Failed to load %s %d", type == ASSET_SOUND ? "WAV" : "BGM", no);
+		return NULL;
+	}
+
+	struct channel *ch = channel_open_archive_data(dfile, type, no);
+	if (!ch) {
+		WARNING("Failed to open %s %d", type == ASSET_SOUND ? "WAV" : "BGM", no);
+		return NULL;
+	}
+
+	// short sound effects are decoded once and played from memory
+	if (type == ASSET_SOUND && pcm_cacheable(ch)) {
+		struct pcm_buffer *buf = pcm_decode(ch, no);
+		if (buf) {
+			pcm_cache_put(buf);
+			channel_close(ch);
+			return channel_open_pcm(buf);
+		}
+	}
+
+	return ch;
+}
+
 struct channel *channel_open_archive_data(struct archive_data *dfile,
 					  enum asset_type type, int metadata_no)
 {
-	struct channel *ch = xcalloc(1, sizeof(struct channel));
+	struct channel *ch = channel_alloc();
 	ch->dfile = dfile;
 
 	// open file
@@ -557,33 +1028,17 @@ struct channel *channel_open_archive_data(struct archive_data *dfile,
 		archive_free_data(dfile);
 		if (ch->file)
 			sf_close(ch->file);
-		free(ch);
+		channel_free(ch);
 		return NULL;
 	}
-	if (metadata_no >= 0) {
-		if (type == ASSET_SOUND) {
-			struct wai *wai = wai_get(metadata_no);
-			ch->mixer_no = wai ? wai->channel : 1;
-		} else if (type == ASSET_BGM) {
-			struct bgi *bgi = bgi_get(metadata_no);
-			if (bgi) {
-				ch->volume = clamp(0, 100, bgi->volume);
-				ch->loop_start = clamp(0, ch->info.frames, bgi->loop_start);
-				ch->loop_end = clamp(0, ch->info.frames, bgi->loop_end);
-				ch->loop_count = max(0, bgi->loop_count);
-				ch->mixer_no = clamp(0, nr_mixers, bgi->channel);
-			} else {
-				ch->loop_count = 0;
-			}
-		}
-		ch->no = metadata_no;
-	}
+	if (metadata_no >= 0)
+		channel_apply_metadata(ch, type, metadata_no);
 	return ch;
 }
 
 struct channel *channel_open_file(const char *path)
 {
-	struct channel *ch = xcalloc(1, sizeof(struct channel));
+	struct channel *ch = channel_alloc();
 #ifdef _WIN32
 	wchar_t *wpath = utf8_to_wchar(path);
 	ch->file = sf_wchar_open(wpath, SFM_READ, &ch->info);
@@ -595,7 +1050,7 @@ struct channel *channel_open_file(const char *path)
 	if (!init_channel(ch)) {
 		if (ch->file)
 			sf_close(ch->file);
-		free(ch);
+		channel_free(ch);
 		return NULL;
 	}
 	return ch;
@@ -604,17 +1059,33 @@ struct channel *channel_open_file(const char *path)
 void channel_close(struct channel *ch)
 {
 	channel_stop(ch);
+	if (ch->pcm) {
+		pcm_buffer_unref(ch->pcm);
+		channel_free(ch);
+		return;
+	}
+	decoder_remove_channel(ch);
 	sf_close(ch->file);
+	free(ch->blocks);
 	if (ch->dfile)
 		archive_free_data(ch->dfile);
-	free(ch);
+	channel_free(ch);
 }
 
 #define SJIS_MASTER "\x83\x7d\x83\x58\x83\x5e\x81\x5b"
 #define SJIS_VOICE  "\x89\xb9\x90\xba"
 
+static void mixer_fini(void)
+{
+	if (audio_device)
+		SDL_CloseAudioDevice(audio_device);
+	decoder_stop();
+}
+
 void mixer_init(void)
 {
+	audio_kernels_init();
+
 	// initialize mixer naming
 	if (!config.mixer_nr_channels) {
 		nr_mixers = 3;
@@ -679,6 +1150,14 @@ void mixer_init(void)
 		mixers[i].voice = sts_mixer_play_stream(&mixers[i].parent->mixer, &mixers[i].stream, 1.0f);
 	}
 
+	// start the decoder thread
+	decoder.lock = SDL_CreateMutex();
+	decoder.cond = SDL_CreateCond();
+	decoder.thread = SDL_CreateThread(decoder_thread, "audio decoder", NULL);
+	if (!decoder.thread)
+		ERROR("SDL_CreateThread failed: %s", SDL_GetError());
+	atexit(mixer_fini);
+
 	// read audio metadata
 	if (config.bgi_path)
 		bgi_read(config.bgi_path);
@@ -0,0 +1,144 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "system4.h"
+#include "system4/ain.h"
+#include "system4/instructions.h"
+#include "system4/utfsjis.h"
+
+#include "cJSON.h"
+#include "vm.h"
+#include "vm/counters.h"
+
+struct hll_counter {
+	uint64_t calls;
+	uint64_t ticks; // inclusive, in SDL performance counter units
+};
+
+uint64_t vm_opcode_counts[NR_OPCODES] = {0};
+
+static struct hll_counter **hll_counters = NULL;
+static char *counters_path = NULL;
+
+uint64_t vm_counters_hll_begin(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+void vm_counters_hll_end(int libno, int fno, uint64_t start)
+{
+	if (!hll_counters)
+		return;
+	struct hll_counter *c = &hll_counters[libno][fno];
+	c->calls++;
+	c->ticks += SDL_GetPerformanceCounter() - start;
+}
+
+static cJSON *opcodes_to_json(void)
+{
+	cJSON *obj = cJSON_CreateObject();
+	for (int i = 0; i < NR_OPCODES; i++) {
+		if (vm_opcode_counts[i])
+			cJSON_AddNumberToObject(obj, instructions[i].name, vm_opcode_counts[i]);
+	}
+	return obj;
+}
+
+static double ticks_to_ns(uint64_t ticks)
+{
+	return (double)ticks * 1000000000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static cJSON *hll_to_json(void)
+{
+	cJSON *libs = cJSON_CreateObject();
+	for (int i = 0; i < ain->nr_libraries; i++) {
+		struct ain_library *lib = &ain->libraries[i];
+		uint64_t calls = 0, ticks = 0;
+		cJSON *funs = cJSON_CreateObject();
+		for (int j = 0; j < lib->nr_functions; j++) {
+			struct hll_counter *c = &hll_counters[i][j];
+			if (!c->calls)
+				continue;
+			calls += c->calls;
+			ticks += c->ticks;
+			char *name = sjis2utf(lib->functions[j].name, 0);
+			cJSON *fun = cJSON_AddObjectToObject(funs, name);
+			cJSON_AddNumberToObject(fun, "calls", c->calls);
+			cJSON_AddNumberToObject(fun, "ns", ticks_to_ns(c->ticks));
+			free(name);
+		}
+		if (!calls) {
+			cJSON_Delete(funs);
+			continue;
+		}
+		char *name = sjis2utf(lib->name, 0);
+		cJSON *obj = cJSON_AddObjectToObject(libs, name);
+		cJSON_AddNumberToObject(obj, "calls", calls);
+		cJSON_AddNumberToObject(obj, "ns", ticks_to_ns(ticks));
+		cJSON_AddItemToObject(obj, "functions", funs);
+		free(name);
+	}
+	return libs;
+}
+
+bool vm_counters_dump(const char *path)
+{
+	cJSON *root = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "opcodes", opcodes_to_json());
+	if (hll_counters)
+		cJSON_AddItemToObject(root, "hll", hll_to_json());
+
+	char *text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	bool ok = true;
+	if (!path) {
+		puts(text);
+	} else {
+		FILE *f = fopen(path, "w");
+		if (!f) {
+			WARNING("Failed to open counters output file: %s", path);
+			ok = false;
+		} else {
+			fputs(text, f);
+			fclose(f);
+		}
+	}
+	free(text);
+	return ok;
+}
+
+static void counters_exit(void)
+{
+	if (vm_counters_dump(counters_path))
+		NOTICE("Execution counters written to %s", counters_path);
+}
+
+void vm_counters_init(const char *path)
+{
+	hll_counters = xcalloc(ain->nr_libraries, sizeof(struct hll_counter*));
+	for (int i = 0; i < ain->nr_libraries; i++) {
+		hll_counters[i] = xcalloc(ain->libraries[i].nr_functions, sizeof(struct hll_counter));
+	}
+	counters_path = xstrdup(path);
+	atexit(counters_exit);
+}
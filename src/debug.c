@@ -146,7 +146,7 @@ static void add_breakpoint(uint32_t addr, struct breakpoint *bp)
 static void delete_breakpoint(uint32_t addr, struct breakpoint *bp)
 {
 	// restore opcode
-	LittleEndian_putW(ain->code, addr, bp->restore_op);
+	vm_patch_opcode(addr, bp->restore_op);
 
 	// remove from hash table
 	struct ht_slot *slot = ht_put_int(bp_table, addr, NULL);
@@ -215,7 +215,7 @@ bool dbg_set_function_breakpoint(const char *_name, void(*cb)(struct breakpoint*
 	bp->message = xmalloc(512);
 	snprintf(bp->message, 511, "Hit breakpoint at function '%s' (0x%08x)",
 			display_utf0(_name), f->address);
-	LittleEndian_putW(ain->code, f->address, BREAKPOINT | bp->restore_op);
+	vm_patch_opcode(f->address, BREAKPOINT | bp->restore_op);
 	add_breakpoint(f->address, bp);
 
 	log_message("debug", "Set breakpoint at function '%s' (0x%08x)\n", display_utf0(_name), f->address);
@@ -243,7 +243,7 @@ bool dbg_set_address_breakpoint(uint32_t address, void(*cb)(struct breakpoint*),
 	bp->data = data;
 	bp->message = xmalloc(512);
 	snprintf(bp->message, 511, "Hit breakpoint at 0x%08x", address);
-	LittleEndian_putW(ain->code, address, BREAKPOINT | bp->restore_op);
+	vm_patch_opcode(address, BREAKPOINT | bp->restore_op);
 	add_breakpoint(address, bp);
 
 	log_message("debug", "Set breakpoint at 0x%08x\n", address);
@@ -274,7 +274,7 @@ static void dbg_set_step_breakpoint(int32_t address, int call_index)
 	bp->cb = dbg_step_breakpoint_cb;
 	bp->data = (void*)(intptr_t)call_index;
 	bp->message = NULL;
-	LittleEndian_putW(ain->code, address, BREAKPOINT | bp->restore_op);
+	vm_patch_opcode(address, BREAKPOINT | bp->restore_op);
 	add_breakpoint(address, bp);
 }
 
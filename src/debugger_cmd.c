@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "system4.h"
 #include "system4/file.h"
@@ -31,9 +32,13 @@
 #include "system4/utfsjis.h"
 
 #include "vm.h"
+#include "vm/counters.h"
 #include "vm/heap.h"
 #include "vm/page.h"
 
+#include "asset_manager.h"
+#include "audio_kernels.h"
+#include "gfx/gfx.h"
 #include "scene.h"
 #include "debugger.h"
 #include "input.h"
@@ -67,6 +72,11 @@ struct dbg_cmd_node {
 
 static void dbg_cmd_help(unsigned nr_args, char **args);
 
+static void dbg_cmd_audio_bench(unsigned nr_args, char **args)
+{
+	audio_kernels_benchmark();
+}
+
 static void dbg_cmd_backtrace(unsigned nr_args, char **args)
 {
 	dbg_print_stack_trace();
@@ -99,11 +109,105 @@ static void dbg_cmd_breakpoint(unsigned nr_args, char **args)
 	}
 }
 
+static void dbg_cmd_cg_cache(unsigned nr_args, char **args)
+{
+	if (nr_args > 0) {
+		if (strcmp(args[0], "clear")) {
+			DBG_ERROR("Invalid argument: '%s' (expected 'clear')", args[0]);
+			return;
+		}
+		asset_cg_cache_clear();
+	}
+
+	struct asset_cg_cache_stats stats;
+	asset_cg_cache_get_stats(&stats);
+	unsigned long lookups = stats.hits + stats.misses;
+	printf("entries:   %d / %d\n", stats.nr_entries, stats.max_entries);
+	printf("memory:    %.1f MiB\n", (double)stats.bytes / (1024.0 * 1024.0));
+	printf("hits:      %lu (%.1f%%)\n", stats.hits, lookups ? stats.hits * 100.0 / lookups : 0.0);
+	printf("misses:    %lu\n", stats.misses);
+	printf("evictions: %lu\n", stats.evictions);
+
+	struct asset_cg_decode_stats decode;
+	asset_cg_decode_get_stats(&decode);
+	printf("prefetches: %lu (%d in flight, %lu waited on)\n", decode.prefetches,
+			decode.nr_jobs, decode.waits);
+}
+
 static void dbg_cmd_continue(unsigned nr_args, char **args)
 {
 	dbg_continue();
 }
 
+#ifdef VM_COUNTERS
+static void dbg_cmd_counters(unsigned nr_args, char **args)
+{
+	vm_counters_dump(nr_args > 0 ? args[0] : NULL);
+}
+#endif
+
+static void dbg_cmd_frame_stats(unsigned nr_args, char **args)
+{
+	if (nr_args > 0) {
+		if (!strcmp(args[0], "on")) {
+			gfx_frame_stats_set_overlay(true);
+		} else if (!strcmp(args[0], "off")) {
+			gfx_frame_stats_set_overlay(false);
+		} else {
+			DBG_ERROR("Invalid argument: '%s' (expected 'on' or 'off')", args[0]);
+			return;
+		}
+	}
+	// GPU timings become available a few frames after this
+	gfx_frame_stats_enable_gpu_timing();
+
+	struct gfx_frame_stats stats;
+	gfx_get_frame_stats(&stats);
+	printf("frame rate:      %.1f fps\n", gfx_get_frame_rate());
+	printf("draw calls:      %u\n", stats.draw_calls);
+	printf("shader switches: %u\n", stats.shader_switches);
+	printf("texture binds:   %u\n", stats.texture_binds);
+	printf("FBO switches:    %u\n", stats.fbo_switches);
+	printf("uploads:         %u (%.1f KiB)\n", stats.texture_uploads, stats.upload_bytes / 1024.0);
+	for (int i = 0; i < GFX_NR_PASSES; i++) {
+		if (stats.gpu_timing)
+			printf("gpu %-12s %.1f us\n", gfx_pass_name(i), stats.gpu_ns[i] / 1000.0);
+		else
+			printf("gpu %-12s n/a\n", gfx_pass_name(i));
+	}
+	printf("overlay is %s\n", gfx_frame_stats_get_overlay() ? "on" : "off");
+}
+
+static void dbg_cmd_heap_stats(unsigned nr_args, char **args)
+{
+	size_t nr_pages = 0, nr_strings = 0, string_bytes = 0;
+	for (size_t i = 0; i < heap_size; i++) {
+		if (heap[i].ref <= 0)
+			continue;
+		if (heap[i].type == VM_PAGE) {
+			nr_pages++;
+		} else if (heap[i].type == VM_STRING) {
+			nr_strings++;
+			if (heap[i].s)
+				string_bytes += heap[i].s->size;
+		}
+	}
+
+	struct heap_stats frame;
+	heap_stats_last_frame(&frame);
+	printf("heap slots:     %zu live / %zu\n", nr_pages + nr_strings, heap_size);
+	printf("  pages:        %zu (%.1f KiB)\n", nr_pages, heap_stats.page_bytes / 1024.0);
+	printf("  strings:      %zu (%.1f KiB)\n", nr_strings, string_bytes / 1024.0);
+	printf("page cache:     %zu pages (%.1f KiB)\n", heap_stats.cached_pages,
+			heap_stats.cached_bytes / 1024.0);
+	printf("last frame:     %"PRIu64" slot allocs, %"PRIu64" slot frees\n",
+			frame.slot_allocs, frame.slot_frees);
+	printf("                %"PRIu64" page allocs, %"PRIu64" page frees, %"PRIu64" mallocs\n",
+			frame.page_allocs, frame.page_frees, frame.page_mallocs);
+	printf("total:          %"PRIu64" slot allocs, %"PRIu64" page allocs, %"PRIu64" mallocs\n",
+			heap_stats.slot_allocs, heap_stats.page_allocs, heap_stats.page_mallocs);
+}
+
 static void dbg_cmd_frame(unsigned nr_args, char **args)
 {
 	int frame_no = atoi(args[0]);
@@ -149,6 +253,26 @@ static void log_handler(struct breakpoint *bp)
 	printf(")\n");
 }
 
+static void dbg_cmd_jit(unsigned nr_args, char **args)
+{
+	if (nr_args > 0) {
+		bool enable;
+		if (!strcmp(args[0], "on")) {
+			enable = true;
+		} else if (!strcmp(args[0], "off")) {
+			enable = false;
+		} else {
+			DBG_ERROR("Invalid argument: '%s' (expected 'on' or 'off')", args[0]);
+			return;
+		}
+		if (!vm_jit_set_enabled(enable)) {
+			DBG_ERROR("JIT compiler not available");
+			return;
+		}
+	}
+	printf("JIT compiler is %s\n", vm_jit_is_enabled() ? "on" : "off");
+}
+
 static void dbg_cmd_log(unsigned nr_args, char **args)
 {
 	int fno = ain_get_function(ain, args[0]);
@@ -262,12 +386,20 @@ static void dbg_cmd_vm_state(unsigned nr_args, char **args)
 }
 
 static struct dbg_cmd dbg_default_commands[] = {
+	{ "audio-bench", NULL, NULL, "Benchmark the audio mixing kernels", 0, 0, dbg_cmd_audio_bench },
 	{ "backtrace", "bt", NULL, "Display stack trace", 0, 0, dbg_cmd_backtrace },
 	{ "breakpoint", "bp", "<function> | <address> | <file> <line>", "Set breakpoint", 1, 2, dbg_cmd_breakpoint },
+	{ "cg-cache", NULL, "[clear]", "Print (or clear) CG cache statistics", 0, 1, dbg_cmd_cg_cache },
 	{ "continue", "c", NULL, "Resume execution", 0, 0, dbg_cmd_continue },
+#ifdef VM_COUNTERS
+	{ "counters", NULL, "[file-name]", "Dump execution counters as JSON", 0, 1, dbg_cmd_counters },
+#endif
 	{ "finish", "fin", NULL, "Execute until the current function returns", 0, 0, dbg_cmd_finish },
 	{ "frame", "f", "<frame-number>", "Set the current frame", 1, 1, dbg_cmd_frame },
+	{ "frame-stats", NULL, "[on|off]", "Print rendering statistics for the last frame (and show or hide the overlay)", 0, 1, dbg_cmd_frame_stats },
+	{ "heap-stats", NULL, NULL, "Print VM heap and allocator statistics", 0, 0, dbg_cmd_heap_stats },
 	{ "help", "h", "[command-name]", "Get help about a command", 0, 2, dbg_cmd_help },
+	{ "jit", NULL, "[on|off]", "Enable or disable the JIT compiler", 0, 1, dbg_cmd_jit },
 	{ "locals", "l", "[frame-number]", "Print local variables", 0, 1, dbg_cmd_locals },
 	{ "log", NULL, "<function-name>", "Log function calls", 1, 1, dbg_cmd_log },
 	{ "members", "m", "[frame-number]", "Print struct members", 0, 1, dbg_cmd_members },
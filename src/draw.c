@@ -15,6 +15,7 @@
  */
 
 #include <math.h>
+#include <stddef.h>
 #include <SDL.h>
 #include "gfx/gl.h"
 #include <cglm/cglm.h>
@@ -35,6 +36,7 @@ struct copy_shader {
 	GLint color;
 	GLint threshold;
 	GLint threshold2;
+	GLint vertex_clip;
 };
 
 struct copy_data {
@@ -78,6 +80,9 @@ static struct copy_shader amap_saturate_shader;
 static struct copy_shader blend_rmap_color_shader;
 static struct copy_shader dilate_shader;
 
+// vertex buffer for gfx_draw_glyphs
+static GLuint glyph_vbo;
+
 static void prepare_copy_shader(struct gfx_render_job *job, void *data)
 {
 	struct copy_shader *s = (struct copy_shader*)job->shader;
@@ -88,6 +93,9 @@ static void prepare_copy_shader(struct gfx_render_job *job, void *data)
 	glUniform4f(s->color, d->r, d->g, d->b, d->a);
 	glUniform1f(s->threshold, d->threshold);
 	glUniform1f(s->threshold2, d->threshold2);
+	// the whole texture (the attribute is per-vertex in gfx_draw_glyphs)
+	if (s->vertex_clip >= 0)
+		glVertexAttrib4f(s->vertex_clip, 0.f, 0.f, 1.f, 1.f);
 }
 
 static void load_copy_shader(struct copy_shader *s, const char *v_path, const char *f_path)
@@ -98,6 +106,7 @@ static void load_copy_shader(struct copy_shader *s, const char *v_path, const ch
 	s->color = glGetUniformLocation(s->s.program, "color");
 	s->threshold = glGetUniformLocation(s->s.program, "threshold");
 	s->threshold2 = glGetUniformLocation(s->s.program, "threshold2");
+	s->vertex_clip = glGetAttribLocation(s->s.program, "vertex_clip");
 	s->s.prepare = prepare_copy_shader;
 }
 
@@ -158,7 +167,10 @@ void gfx_draw_init(void)
 	load_copy_shader(&blend_rmap_color_shader, "shaders/render.v.glsl", "shaders/blend_rmap_color.f.glsl");
 
 	// shader that dilates every pixel (for bold/outline text rendering)
-	load_copy_shader(&dilate_shader, "shaders/render.v.glsl", "shaders/dilate.f.glsl");
+	load_copy_shader(&dilate_shader, "shaders/glyph.v.glsl", "shaders/dilate.f.glsl");
+
+	// vertex buffer for batched glyph rendering
+	glGenBuffers(1, &glyph_vbo);
 }
 
 static void run_draw_shader(Shader *s, Texture *dst, Texture *src, mat4 mw_transform, mat4 wv_transform, struct copy_data *data)
@@ -184,7 +196,7 @@ static void _run_copy_shader(Shader *s, Texture *dst, Texture *src, GLfloat src_
 	GLfloat scale_y = (GLfloat)data->h / data->sh;
 
 	mat4 mw_transform = MAT4(
-	     src_w * scale_x, 0,               0, -data->sx * scale_y,
+	     src_w * scale_x, 0,               0, -data->sx * scale_x,
 	     0,               src_h * scale_y, 0, -data->sy * scale_y,
 	     0,               0,               1, 0,
 	     0,               0,               0, 1);
@@ -1183,7 +1195,7 @@ void gfx_draw_quadrilateral(Texture *dst, Texture *src, struct gfx_vertex vertic
 }
 
 // XXX: Not an actual DrawGraph function; used for rendering text
-void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, SDL_Color color, float scale_x, float bold_width, bool blend)
+void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_cell, SDL_Color color, float scale_x, float bold_width, bool blend)
 {
 	if (blend) {
 		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
@@ -1194,8 +1206,8 @@ void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, SDL_Color co
 
 	dx = roundf(dx);
 	struct copy_data data = STRETCH_DATA(
-			dx, dy, glyph->w * scale_x, glyph->h,
-			0,  0,  glyph->w,           glyph->h);
+			dx,           dy,           glyph_cell.w * scale_x, glyph_cell.h,
+			glyph_cell.x, glyph_cell.y, glyph_cell.w,           glyph_cell.h);
 	data.r = color.r / 255.0;
 	data.g = color.g / 255.0;
 	data.b = color.b / 255.0;
@@ -1211,30 +1223,115 @@ void gfx_draw_glyph(Texture *dst, float dx, int dy, Texture *glyph, SDL_Color co
 	restore_blend_mode();
 }
 
-void gfx_draw_glyph_to_pmap(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_pos, SDL_Color color, float scale_x)
-{
-	struct copy_data data = STRETCH_DATA(
-			dx,          dy,          glyph_pos.w * scale_x, glyph_pos.h,
-			glyph_pos.x, glyph_pos.y, glyph_pos.w,           glyph_pos.h);
-	data.r = color.r / 255.0;
-	data.g = color.g / 255.0;
-	data.b = color.b / 255.0;
-	data.a = 0.01;  // discard threshold
-	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
-	run_copy_shader(&blend_rmap_color_shader.s, dst, glyph, &data);
-	restore_blend_mode();
-}
+struct glyph_vertex {
+	GLfloat x, y, z, w;
+	GLfloat u, v;
+	// texel centers at the edges of the glyph's atlas cell
+	GLfloat clip[4];
+};
 
-void gfx_draw_glyph_to_amap(Texture *dst, float dx, int dy, Texture *glyph, Rectangle glyph_pos, float scale_x)
+static struct glyph_vertex *glyph_vertices = NULL;
+static int glyph_vertices_size = 0;
+
+/*
+ * Draw a run of glyphs from a single atlas texture with one draw call.
+ * Each quad covers exactly the area that gfx_draw_glyph would have clipped
+ * to with its viewport, so the result is the same as drawing the glyphs one
+ * at a time (quads are rasterized in order).
+ */
+void gfx_draw_glyphs(Texture *dst, Texture *atlas, struct gfx_glyph_quad *quads, int nr_quads,
+		SDL_Color color, float bold_width, enum gfx_glyph_mode mode)
 {
-	struct copy_data data = STRETCH_DATA(
-			dx,          dy,          glyph_pos.w * scale_x, glyph_pos.h,
-			glyph_pos.x, glyph_pos.y, glyph_pos.w,           glyph_pos.h);
-	data.r = 1.0;
-	data.g = 1.0;
-	data.b = 1.0;
-	data.a = 0.0;  // discard threshold
-	glBlendFuncSeparate(GL_ZERO, GL_ONE, GL_ONE, GL_ZERO);
-	run_copy_shader(&blend_rmap_color_shader.s, dst, glyph, &data);
+	if (!nr_quads)
+		return;
+
+	struct copy_shader *s = &blend_rmap_color_shader;
+	GLfloat r = color.r / 255.0, g = color.g / 255.0, b = color.b / 255.0;
+	GLfloat a = 0.01;  // discard threshold
+	switch (mode) {
+	case GFX_GLYPH_COPY:
+		glBlendFunc(GL_ONE, GL_ZERO);
+		glBlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
+		if (bold_width >= 0.01)
+			s = &dilate_shader;
+		break;
+	case GFX_GLYPH_BLEND:
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+		if (bold_width >= 0.01)
+			s = &dilate_shader;
+		break;
+	case GFX_GLYPH_PMAP:
+		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+		break;
+	case GFX_GLYPH_AMAP:
+		glBlendFuncSeparate(GL_ZERO, GL_ONE, GL_ONE, GL_ZERO);
+		r = g = b = 1.0;
+		a = 0.0;
+		break;
+	}
+
+	// two triangles per glyph
+	if (nr_quads * 6 > glyph_vertices_size) {
+		glyph_vertices_size = nr_quads * 6;
+		glyph_vertices = xrealloc(glyph_vertices, sizeof(struct glyph_vertex) * glyph_vertices_size);
+	}
+	for (int i = 0; i < nr_quads; i++) {
+		struct gfx_glyph_quad *q = &quads[i];
+		GLfloat x0 = q->dx, x1 = q->dx + q->dw;
+		GLfloat y0 = q->dy, y1 = q->dy + q->dh;
+		GLfloat u0 = (GLfloat)q->src.x / atlas->w;
+		GLfloat u1 = (GLfloat)(q->src.x + q->src.w) / atlas->w;
+		GLfloat v0 = (GLfloat)q->src.y / atlas->h;
+		GLfloat v1 = (GLfloat)(q->src.y + q->src.h) / atlas->h;
+		GLfloat cu0 = (q->src.x + 0.5f) / atlas->w;
+		GLfloat cu1 = (q->src.x + q->src.w - 0.5f) / atlas->w;
+		GLfloat cv0 = (q->src.y + 0.5f) / atlas->h;
+		GLfloat cv1 = (q->src.y + q->src.h - 0.5f) / atlas->h;
+		struct glyph_vertex *v = &glyph_vertices[i*6];
+		v[0] = (struct glyph_vertex) { x0, y0, 0, 1, u0, v0, { cu0, cv0, cu1, cv1 } };
+		v[1] = (struct glyph_vertex) { x1, y0, 0, 1, u1, v0, { cu0, cv0, cu1, cv1 } };
+		v[2] = (struct glyph_vertex) { x1, y1, 0, 1, u1, v1, { cu0, cv0, cu1, cv1 } };
+		v[3] = v[0];
+		v[4] = v[2];
+		v[5] = (struct glyph_vertex) { x0, y1, 0, 1, u0, v1, { cu0, cv0, cu1, cv1 } };
+	}
+
+	GLuint fbo = gfx_set_framebuffer(GL_DRAW_FRAMEBUFFER, dst, 0, 0, dst->w, dst->h);
+
+	mat4 mw_transform = GLM_MAT4_IDENTITY_INIT;
+	mat4 wv_transform = WV_TRANSFORM(dst->w, dst->h);
+	gfx_batch_invalidate();
+	glUseProgram(s->s.program);
+	gfx_stats.shader_switches++;
+	glUniformMatrix4fv(s->s.world_transform, 1, GL_FALSE, mw_transform[0]);
+	glUniformMatrix4fv(s->s.view_transform, 1, GL_FALSE, wv_transform[0]);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, atlas->handle);
+	gfx_stats.texture_binds++;
+	glUniform1i(s->s.texture, 0);
+	glUniform4f(s->color, r, g, b, a);
+	glUniform1f(s->threshold, bold_width);
+
+	glBindVertexArray(sdl.gl.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, glyph_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(struct glyph_vertex) * nr_quads * 6, glyph_vertices, GL_STREAM_DRAW);
+	glEnableVertexAttribArray(s->s.vertex_pos);
+	glEnableVertexAttribArray(s->s.vertex_uv);
+	glVertexAttribPointer(s->s.vertex_pos, 4, GL_FLOAT, GL_FALSE, sizeof(struct glyph_vertex), NULL);
+	glVertexAttribPointer(s->s.vertex_uv, 2, GL_FLOAT, GL_FALSE, sizeof(struct glyph_vertex), (void*)offsetof(struct glyph_vertex, u));
+	if (s->vertex_clip >= 0) {
+		glEnableVertexAttribArray(s->vertex_clip);
+		glVertexAttribPointer(s->vertex_clip, 4, GL_FLOAT, GL_FALSE, sizeof(struct glyph_vertex), (void*)offsetof(struct glyph_vertex, clip));
+	}
+	glDrawArrays(GL_TRIANGLES, 0, nr_quads * 6);
+	gfx_stats.draw_calls++;
+	glDisableVertexAttribArray(s->s.vertex_pos);
+	glDisableVertexAttribArray(s->s.vertex_uv);
+	if (s->vertex_clip >= 0)
+		glDisableVertexAttribArray(s->vertex_clip);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	gfx_reset_framebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 	restore_blend_mode();
 }
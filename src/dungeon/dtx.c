@@ -23,6 +23,7 @@
 #include "system4/file.h"
 #include "system4/little_endian.h"
 
+#include "asset_manager.h"
 #include "xsystem4.h"
 #include "dungeon/dtx.h"
 #include "dungeon/mtrand43.h"
@@ -118,7 +119,7 @@ struct cg *dtx_create_cg(struct dtx *dtx, enum dtx_texture_type type, int index)
 	struct dtx_entry *entry = &dtx->entries[row * dtx->nr_columns + index];
 	if (!entry->data)
 		return NULL;
-	return cg_load_buffer(entry->data, entry->size);
+	return asset_cg_decode_buffer(entry->data, entry->size);
 }
 
 struct dtx *dtx_load_from_dtl(const char *path, uint32_t seed)
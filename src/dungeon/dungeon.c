@@ -27,6 +27,7 @@
 #include "system4/dlf.h"
 #include "system4/file.h"
 
+#include "asset_manager.h"
 #include "dungeon/dgn.h"
 #include "dungeon/dtx.h"
 #include "dungeon/dungeon.h"
@@ -125,7 +126,7 @@ static GLuint *load_event_textures(int *nr_textures_out)
 		struct archive_data *dfile = archive_get(&alk->ar, i);
 		if (!dfile)
 			continue;
-		struct cg *cg = cg_load_data(dfile);
+		struct cg *cg = asset_cg_decode(dfile);
 		archive_free_data(dfile);
 		if (!cg) {
 			WARNING("Event.alk: cannot load cg %d", i);
@@ -409,7 +410,9 @@ static void dungeon_render(struct sact_sprite *sp)
 	}
 	int nr_cells;
 	struct dgn_cell **cells = dgn_get_visible_cells(ctx->dgn, dgn_x, dgn_y, dgn_z, &nr_cells);
+	gfx_pass_begin(GFX_PASS_DUNGEON);
 	dungeon_renderer_render(ctx->renderer, cells, nr_cells, ctx->characters, view_transform, ctx->proj_transform);
+	gfx_pass_end(GFX_PASS_DUNGEON);
 
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
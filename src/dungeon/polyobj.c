@@ -20,6 +20,7 @@
 #include "system4/cg.h"
 #include "system4/file.h"
 
+#include "asset_manager.h"
 #include "dungeon/polyobj.h"
 
 struct polyobj *polyobj_load(const char *path)
@@ -65,7 +66,7 @@ struct cg *polyobj_get_texture(struct polyobj *po, int index)
 	if (index < 0 || index >= po->nr_textures)
 		return NULL;
 	struct polyobj_location *loc = &po->textures[index];
-	return cg_load_buffer(po->data + loc->offset, loc->length);
+	return asset_cg_decode_buffer(po->data + loc->offset, loc->length);
 }
 
 struct polyobj_object *polyobj_get_object(struct polyobj *po, int index)
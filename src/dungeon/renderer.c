@@ -524,6 +524,7 @@ static void draw(struct dungeon_renderer *r, struct geometry *geometry, GLuint t
 
 	glBindVertexArray(geometry->vao);
 	glDrawArrays(geometry->mode, 0, geometry->nr_vertices);
+	gfx_stats.draw_calls++;
 	glBindVertexArray(0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
@@ -135,6 +135,7 @@ void skybox_render(struct skybox *s, const mat4 view_transform, const mat4 proj_
 	glUniform1i(s->shader.texture, 0);
 
 	glDrawElements(GL_TRIANGLES, s->nr_indices, GL_UNSIGNED_SHORT, NULL);
+	gfx_stats.draw_calls++;
 
 	glBindVertexArray(0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
@@ -341,6 +341,7 @@ int effect_update(float rate)
 		return 0;
 	}
 
+	gfx_pass_begin(GFX_PASS_EFFECT);
 	if (effect_functions[effect.type]) {
 		effect_functions[effect.type](&effect.view, &effect.old, gfx_main_surface(), rate);
 	} else {
@@ -349,6 +350,7 @@ int effect_update(float rate)
 		render_effect_shader(effect_shaders[effect.type], &effect.view, &effect.old, &new, rate);
 		gfx_delete_texture(&new);
 	}
+	gfx_pass_end(GFX_PASS_EFFECT);
 
 	gfx_swap();
 	return 1;
@@ -21,15 +21,20 @@
 #include <ffi.h>
 #include "system4/ain.h"
 #include "system4/utfsjis.h"
+#include "profile.h"
 #include "vm.h"
+#include "vm/counters.h"
 #include "vm/heap.h"
 #include "vm/page.h"
 #include "xsystem4.h"
 
 #define HLL_MAX_ARGS 64
 
+typedef void (*hll_thunk)(void *fun, union vm_value *r, union vm_value *vals);
+
 struct hll_function {
 	void *fun;
+	hll_thunk thunk;
 	ffi_cif cif;
 	unsigned int nr_args;
 	ffi_type **args;
@@ -292,6 +297,173 @@ static void trace_hll_call(struct ain_library *lib, struct ain_hll_function *f,
 }
 #endif /* TRACE_HLL */
 
+/*
+ * Direct-call thunks for common HLL signatures.
+ *
+ * Most HLL functions take a handful of int/float/string/struct/array
+ * arguments, so rather than marshalling them for ffi_call on every CALLHLL
+ * we generate a thunk for each such signature (up to HLL_THUNK_MAX_ARGS
+ * arguments) which reads the arguments straight off the VM stack and calls
+ * the function through a correctly typed function pointer. The thunk is
+ * chosen once at link time; other signatures (e.g. those with reference
+ * arguments, which must be written back after the call) fall back to the
+ * generic path through libffi.
+ *
+ * Argument kinds: i = int32 (int/bool), f = float, p = string/page pointer.
+ * Return kinds: v = void, i = int32, b = bool, f = float, p = pointer.
+ */
+#define HLL_THUNK_MAX_ARGS 4
+#define HLL_THUNK_NR_ARG_KINDS 3
+#define HLL_THUNK_NR_RET_KINDS 5
+// 1 + 3 + 3^2 + 3^3 + 3^4
+#define HLL_THUNK_NR_SIGNATURES 121
+
+#define T_i int32_t
+#define T_b bool
+#define T_f float
+#define T_p void*
+#define T_v void
+
+#define A_i(n) vals[n].i
+#define A_f(n) vals[n].f
+// strings and pages share the heap slot's pointer
+#define A_p(n) ((void*)heap[vals[n].i].page)
+#define A(k, n) A_##k(n)
+
+#define RET_v(call) (void)r; call
+#define RET_i(call) r->i = call
+#define RET_b(call) *(bool*)r = call
+#define RET_f(call) r->f = call
+#define RET_p(call) r->ref = call
+
+#define THUNK0(R) \
+	static void hll_thunk_##R(void *fun, union vm_value *r, union vm_value *vals) \
+	{ (void)vals; RET_##R(((T_##R(*)(void))fun)()); }
+#define THUNK1(R, a) \
+	static void hll_thunk_##R##_##a(void *fun, union vm_value *r, union vm_value *vals) \
+	{ RET_##R(((T_##R(*)(T_##a))fun)(A(a,0))); }
+#define THUNK2(R, a, b) \
+	static void hll_thunk_##R##_##a##b(void *fun, union vm_value *r, union vm_value *vals) \
+	{ RET_##R(((T_##R(*)(T_##a,T_##b))fun)(A(a,0), A(b,1))); }
+#define THUNK3(R, a, b, c) \
+	static void hll_thunk_##R##_##a##b##c(void *fun, union vm_value *r, union vm_value *vals) \
+	{ RET_##R(((T_##R(*)(T_##a,T_##b,T_##c))fun)(A(a,0), A(b,1), A(c,2))); }
+#define THUNK4(R, a, b, c, d) \
+	static void hll_thunk_##R##_##a##b##c##d(void *fun, union vm_value *r, union vm_value *vals) \
+	{ RET_##R(((T_##R(*)(T_##a,T_##b,T_##c,T_##d))fun)(A(a,0), A(b,1), A(c,2), A(d,3))); }
+
+#define NAME0(R) hll_thunk_##R,
+#define NAME1(R, a) hll_thunk_##R##_##a,
+#define NAME2(R, a, b) hll_thunk_##R##_##a##b,
+#define NAME3(R, a, b, c) hll_thunk_##R##_##a##b##c,
+#define NAME4(R, a, b, c, d) hll_thunk_##R##_##a##b##c##d,
+
+// Expand X for every signature of a given return kind, ordered by arity and
+// then by argument kinds in base-3 (i < f < p).
+#define SIGS1(X, R) X##1(R,i) X##1(R,f) X##1(R,p)
+#define SIGS2_(X, R, a) X##2(R,a,i) X##2(R,a,f) X##2(R,a,p)
+#define SIGS2(X, R) SIGS2_(X,R,i) SIGS2_(X,R,f) SIGS2_(X,R,p)
+#define SIGS3__(X, R, a, b) X##3(R,a,b,i) X##3(R,a,b,f) X##3(R,a,b,p)
+#define SIGS3_(X, R, a) SIGS3__(X,R,a,i) SIGS3__(X,R,a,f) SIGS3__(X,R,a,p)
+#define SIGS3(X, R) SIGS3_(X,R,i) SIGS3_(X,R,f) SIGS3_(X,R,p)
+#define SIGS4___(X, R, a, b, c) X##4(R,a,b,c,i) X##4(R,a,b,c,f) X##4(R,a,b,c,p)
+#define SIGS4__(X, R, a, b) SIGS4___(X,R,a,b,i) SIGS4___(X,R,a,b,f) SIGS4___(X,R,a,b,p)
+#define SIGS4_(X, R, a) SIGS4__(X,R,a,i) SIGS4__(X,R,a,f) SIGS4__(X,R,a,p)
+#define SIGS4(X, R) SIGS4_(X,R,i) SIGS4_(X,R,f) SIGS4_(X,R,p)
+#define SIGS(X, R) X##0(R) SIGS1(X,R) SIGS2(X,R) SIGS3(X,R) SIGS4(X,R)
+
+SIGS(THUNK, v)
+SIGS(THUNK, i)
+SIGS(THUNK, b)
+SIGS(THUNK, f)
+SIGS(THUNK, p)
+
+static const hll_thunk hll_thunks[HLL_THUNK_NR_RET_KINDS][HLL_THUNK_NR_SIGNATURES] = {
+	{ SIGS(NAME, v) },
+	{ SIGS(NAME, i) },
+	{ SIGS(NAME, b) },
+	{ SIGS(NAME, f) },
+	{ SIGS(NAME, p) },
+};
+
+#undef T_i
+#undef T_b
+#undef T_f
+#undef T_p
+#undef T_v
+#undef A_i
+#undef A_f
+#undef A_p
+#undef A
+#undef RET_v
+#undef RET_i
+#undef RET_b
+#undef RET_f
+#undef RET_p
+
+// Returns the thunk argument kind for TYPE (0 = int, 1 = float, 2 = pointer),
+// or -1 if it can't be passed through a thunk.
+static int hll_thunk_arg_kind(enum ain_data_type type)
+{
+	switch (type) {
+	case AIN_INT:
+	case AIN_BOOL:
+		return 0;
+	case AIN_FLOAT:
+		return 1;
+	case AIN_STRING:
+	case AIN_STRUCT:
+	case AIN_ARRAY_TYPE:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+static int hll_thunk_ret_kind(enum ain_data_type type)
+{
+	switch (type) {
+	case AIN_VOID:
+		return 0;
+	case AIN_INT:
+		return 1;
+	case AIN_BOOL:
+		return 2;
+	case AIN_FLOAT:
+		return 3;
+	case AIN_LONG_INT:
+		return -1;
+	default:
+		return 4;
+	}
+}
+
+static hll_thunk hll_thunk_lookup(struct ain_hll_function *f)
+{
+#ifdef TRACE_HLL
+	// tracing needs the marshalled arguments
+	return NULL;
+#endif
+	if (f->nr_arguments > HLL_THUNK_MAX_ARGS)
+		return NULL;
+
+	int ret = hll_thunk_ret_kind(f->return_type.data);
+	if (ret < 0)
+		return NULL;
+
+	// signatures of arity n start at (3^n - 1) / 2
+	int index = 0, base = 0, n = 1;
+	for (int i = 0; i < f->nr_arguments; i++) {
+		int kind = hll_thunk_arg_kind(f->arguments[i].type.data);
+		if (kind < 0)
+			return NULL;
+		index = index * HLL_THUNK_NR_ARG_KINDS + kind;
+		base += n;
+		n *= HLL_THUNK_NR_ARG_KINDS;
+	}
+	return hll_thunks[ret][base + index];
+}
+
 void hll_call(int libno, int fno)
 {
 	struct ain_hll_function *f = &ain->libraries[libno].functions[fno];
@@ -310,57 +482,73 @@ void hll_call(int libno, int fno)
 	void *heap_ptrs[HLL_MAX_ARGS];
 	int heap_slots[HLL_MAX_ARGS];
 
-	for (int i = f->nr_arguments - 1; i >= 0; i--) {
-		switch (f->arguments[i].type.data) {
-		case AIN_REF_INT:
-		case AIN_REF_LONG_INT:
-		case AIN_REF_BOOL:
-		case AIN_REF_FLOAT: {
-			// need to create pointer for immediate ref types
-			stack_ptr -= 2;
-			int pageno = stack[stack_ptr].i;
-			int varno  = stack[stack_ptr+1].i;
-			ptrs[i] = &heap[pageno].page->values[varno];
-			args[i] = &ptrs[i];
-			break;
-		}
-		case AIN_STRING:
-			stack_ptr--;
-			args[i] = &heap[stack[stack_ptr].i].s;
-			break;
-		case AIN_REF_STRING:
-			stack_ptr--;
-			heap_slots[i] = stack[stack_ptr].i;
-			heap_ptrs[i] = heap[stack[stack_ptr].i].s;
-			ptrs[i] = &heap_ptrs[i];
-			args[i] = &ptrs[i];
-			break;
-		case AIN_STRUCT:
-		case AIN_ARRAY_TYPE:
-			stack_ptr--;
-			args[i] = &heap[stack[stack_ptr].i].page;
-			break;
-		case AIN_REF_STRUCT:
-		case AIN_REF_ARRAY_TYPE:
-			stack_ptr--;
-			heap_slots[i] = stack[stack_ptr].i;
-			heap_ptrs[i] = heap[stack[stack_ptr].i].page;
-			ptrs[i] = &heap_ptrs[i];
-			args[i] = &ptrs[i];
-			break;
-		default:
-			stack_ptr--;
-			args[i] = &stack[stack_ptr];
-			break;
+	if (fun->thunk) {
+		// the thunk reads its arguments directly (one slot each)
+		stack_ptr -= f->nr_arguments;
+	} else {
+		for (int i = f->nr_arguments - 1; i >= 0; i--) {
+			switch (f->arguments[i].type.data) {
+			case AIN_REF_INT:
+			case AIN_REF_LONG_INT:
+			case AIN_REF_BOOL:
+			case AIN_REF_FLOAT: {
+				// need to create pointer for immediate ref types
+				stack_ptr -= 2;
+				int pageno = stack[stack_ptr].i;
+				int varno  = stack[stack_ptr+1].i;
+				ptrs[i] = &heap[pageno].page->values[varno];
+				args[i] = &ptrs[i];
+				break;
+			}
+			case AIN_STRING:
+				stack_ptr--;
+				args[i] = &heap[stack[stack_ptr].i].s;
+				break;
+			case AIN_REF_STRING:
+				stack_ptr--;
+				heap_slots[i] = stack[stack_ptr].i;
+				heap_ptrs[i] = heap[stack[stack_ptr].i].s;
+				ptrs[i] = &heap_ptrs[i];
+				args[i] = &ptrs[i];
+				break;
+			case AIN_STRUCT:
+			case AIN_ARRAY_TYPE:
+				stack_ptr--;
+				args[i] = &heap[stack[stack_ptr].i].page;
+				break;
+			case AIN_REF_STRUCT:
+			case AIN_REF_ARRAY_TYPE:
+				stack_ptr--;
+				heap_slots[i] = stack[stack_ptr].i;
+				heap_ptrs[i] = heap[stack[stack_ptr].i].page;
+				ptrs[i] = &heap_ptrs[i];
+				args[i] = &ptrs[i];
+				break;
+			default:
+				stack_ptr--;
+				args[i] = &stack[stack_ptr];
+				break;
+			}
 		}
 	}
 
-	union vm_value r;
+	union vm_value r = { .ref = NULL };
+	int32_t prev_hll = profile_hll_enter(libno, fno);
+#ifdef VM_COUNTERS
+	uint64_t start_time = vm_counters_hll_begin();
+#endif
 #ifdef TRACE_HLL
 	trace_hll_call(&ain->libraries[libno], f, fun, &r, args);
 #else
-	ffi_call(&fun->cif, (void*)fun->fun, &r, args);
+	if (fun->thunk)
+		fun->thunk(fun->fun, &r, &stack[stack_ptr]);
+	else
+		ffi_call(&fun->cif, (void*)fun->fun, &r, args);
 #endif
+#ifdef VM_COUNTERS
+	vm_counters_hll_end(libno, fno, start_time);
+#endif
+	profile_hll_leave(prev_hll);
 
 
 	for (int i = 0, j = 0; i < f->nr_arguments; i++, j++) {
@@ -699,6 +887,8 @@ static void link_static_library_function(struct hll_function *dst, struct ain_hl
 
 	if (ffi_prep_cif(&dst->cif, FFI_DEFAULT_ABI, dst->nr_args, dst->return_type, dst->args) != FFI_OK)
 		ERROR("Failed to link HLL function");
+
+	dst->thunk = hll_thunk_lookup(src);
 }
 
 /*
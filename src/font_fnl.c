@@ -165,7 +165,11 @@ static bool fnl_font_get_glyph(struct font_size *_size, struct glyph *glyph, uin
 		pixels[(dst_row+off_y)*width + (dst_col+off_x)] = p;
 	}
 
-	gfx_init_texture_rmap(&glyph->t[weight], width, height, pixels);
+	if (!glyph_atlas_add(_size, glyph, weight, width, height, pixels)) {
+		free(pixels);
+		free(acc);
+		return false;
+	}
 	glyph->rect.x = off_x;
 	glyph->rect.y = off_y;
 	glyph->rect.w = block_width;
@@ -93,9 +93,10 @@ static float ft_font_get_actual_size(struct font *_, float size)
 // FIXME: the outline rendering code should be fixed so this isn't necessary.
 #define GLYPH_BORDER_SIZE 4
 
-// Convert a glyph rendered by FreeType to a block-sized texture.
+// Convert a glyph rendered by FreeType to a block-sized atlas cell.
 // Block size is size x 1.5*size (full-width) or size/2 x 1.5*size (half-width)
-static Rectangle init_glyph_texture(Texture *dst, FT_Bitmap *glyph, int bitmap_left, int bitmap_top, int size, bool half_width)
+static bool init_glyph_cell(struct font_size *fs, struct glyph *dst, enum font_weight weight,
+		FT_Bitmap *glyph, int bitmap_left, int bitmap_top, int size, bool half_width)
 {
 	// calculate block size and offsets
 	int block_width = max(half_width ? size/2 : size, max(0, bitmap_left) + glyph->width);
@@ -114,16 +115,17 @@ static Rectangle init_glyph_texture(Texture *dst, FT_Bitmap *glyph, int bitmap_l
 		}
 	}
 
-	// create texture from block-size bitmap
-	gfx_init_texture_rmap(dst, width, height, bitmap);
+	// add block-size bitmap to the atlas
+	bool r = glyph_atlas_add(fs, dst, weight, width, height, bitmap);
 	free(bitmap);
 
-	return (Rectangle) {
+	dst->rect = (Rectangle) {
 		.x = GLYPH_BORDER_SIZE,
 		.y = GLYPH_BORDER_SIZE,
 		.w = block_width,
 		.h = block_height
 	};
+	return r;
 }
 
 static void ft_font_set_size(struct font_ft *font, unsigned size)
@@ -136,8 +138,6 @@ static void ft_font_set_size(struct font_ft *font, unsigned size)
 
 static bool ft_font_get_glyph(struct font_size *size, struct glyph *glyph, uint32_t code, enum font_weight weight)
 {
-	Texture *t = &glyph->t[weight];
-
 	// render bitmap
 	bool half_width = is_half_width(code);
 	struct font_ft *font = (struct font_ft*)size->font;
@@ -152,11 +152,12 @@ static bool ft_font_get_glyph(struct font_size *size, struct glyph *glyph, uint3
 		FT_Bitmap_Embolden(ft_lib, &font->font->glyph->bitmap, bold_weight, 0);
 	}
 
-	// create texture from bitmap
+	// create atlas cell from bitmap
 	FT_Bitmap *bitmap = &font->font->glyph->bitmap;
 	if (bitmap->pixel_mode == FT_PIXEL_MODE_GRAY) {
-		glyph->rect = init_glyph_texture(t, bitmap, font->font->glyph->bitmap_left,
-				font->font->glyph->bitmap_top, size->size, half_width);
+		if (!init_glyph_cell(size, glyph, weight, bitmap, font->font->glyph->bitmap_left,
+				font->font->glyph->bitmap_top, size->size, half_width))
+			return false;
 	} else if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO) {
 		FT_Bitmap tmp;
 		FT_Bitmap_New(&tmp);
@@ -170,9 +171,11 @@ static bool ft_font_get_glyph(struct font_size *size, struct glyph *glyph, uint3
 			if (tmp.buffer[i])
 				tmp.buffer[i] = 255;
 		}
-		glyph->rect = init_glyph_texture(t, &tmp, font->font->glyph->bitmap_left,
+		bool r = init_glyph_cell(size, glyph, weight, &tmp, font->font->glyph->bitmap_left,
 				font->font->glyph->bitmap_top, size->size, half_width);
 		FT_Bitmap_Done(ft_lib, &tmp);
+		if (!r)
+			return false;
 	} else {
 		WARNING("Font returned glyph with unsupported pixel mode");
 		return false;
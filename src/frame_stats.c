@@ -0,0 +1,369 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "system4.h"
+
+#include "gfx/gfx.h"
+#include "gfx/font.h"
+#include "gfx/gl.h"
+#include "xsystem4.h"
+
+/*
+ * Per-frame rendering statistics. The counters in `gfx_stats` are bumped
+ * by the renderers as they issue GL calls, and are collected (and reset)
+ * each time a frame is presented by gfx_swap.
+ *
+ * GPU time is measured with timestamp queries around each pass. Results
+ * are read back NR_QUERY_FRAMES frames later to avoid stalling the
+ * pipeline, so the reported timings lag slightly behind the counters.
+ * Passes may be nested (e.g. parts and 3D are drawn within the scene pass),
+ * in which case the time is counted for both. A pass which begins right
+ * after another pass of the same type ended, with nothing drawn in
+ * between, extends that pass's query instead of starting a new one (the
+ * parts pass is entered once per part).
+ */
+
+#define NR_QUERY_FRAMES 4
+#define MAX_PASS_QUERIES 256
+#define MAX_PASS_DEPTH 16
+#define OVERLAY_INTERVAL 250
+
+struct gfx_frame_stats gfx_stats = {0};
+
+static struct gfx_frame_stats last_stats = {0};
+static unsigned frame_no = 0;
+static uint64_t frame_start = 0;
+static float frame_ms = 0.f;
+
+static const char * const pass_names[GFX_NR_PASSES] = {
+	[GFX_PASS_SCENE] = "scene",
+	[GFX_PASS_PARTS] = "parts",
+	[GFX_PASS_3D] = "3d",
+	[GFX_PASS_DUNGEON] = "dungeon",
+	[GFX_PASS_EFFECT] = "effect",
+};
+
+static struct {
+	bool enabled;
+	GLuint ids[NR_QUERY_FRAMES][MAX_PASS_QUERIES * 2];
+	enum gfx_pass pass[NR_QUERY_FRAMES][MAX_PASS_QUERIES];
+	int nr_queries[NR_QUERY_FRAMES];
+	int frame;
+	int stack[MAX_PASS_DEPTH];
+	int depth;
+	// the most recently ended query, for merging consecutive passes
+	int last_end;
+	int last_end_depth;
+	unsigned last_end_draw_calls;
+	bool overflow_warned;
+} timer = {0};
+
+static FILE *csv = NULL;
+
+#define OVERLAY_LINE_SIZE 256
+
+static struct {
+	bool enabled;
+	Texture texture;
+	uint64_t last_update;
+	char lines[2][OVERLAY_LINE_SIZE];
+} overlay = {0};
+
+const char *gfx_pass_name(enum gfx_pass pass)
+{
+	return pass_names[pass];
+}
+
+static void timer_init(void)
+{
+	if (timer.enabled)
+		return;
+#ifdef USE_GLES
+	// timestamp queries are an extension on GLES
+	return;
+#else
+	if (!GLEW_ARB_timer_query) {
+		WARNING("GPU timer queries are not supported");
+		return;
+	}
+	for (int i = 0; i < NR_QUERY_FRAMES; i++) {
+		glGenQueries(MAX_PASS_QUERIES * 2, timer.ids[i]);
+		timer.nr_queries[i] = 0;
+	}
+	timer.frame = 0;
+	timer.depth = 0;
+	timer.last_end = -1;
+	timer.enabled = true;
+#endif
+}
+
+void gfx_pass_begin(possibly_unused enum gfx_pass pass)
+{
+	if (!timer.enabled)
+		return;
+#ifndef USE_GLES
+	int i = timer.nr_queries[timer.frame];
+	if (i > 0 && timer.last_end == i - 1 && timer.last_end_depth == timer.depth
+			&& timer.pass[timer.frame][i-1] == pass
+			&& timer.last_end_draw_calls == gfx_stats.draw_calls) {
+		// continue the previous query; its end timestamp is rewritten
+		if (timer.depth < MAX_PASS_DEPTH)
+			timer.stack[timer.depth] = i - 1;
+		timer.depth++;
+		return;
+	}
+	if (timer.depth < MAX_PASS_DEPTH)
+		timer.stack[timer.depth] = i < MAX_PASS_QUERIES ? i : -1;
+	timer.depth++;
+	if (i >= MAX_PASS_QUERIES) {
+		if (!timer.overflow_warned) {
+			WARNING("More than %d GPU timer queries in a frame; GPU timings will be incomplete",
+					MAX_PASS_QUERIES);
+			timer.overflow_warned = true;
+		}
+		return;
+	}
+	timer.pass[timer.frame][i] = pass;
+	timer.nr_queries[timer.frame] = i + 1;
+	glQueryCounter(timer.ids[timer.frame][i*2], GL_TIMESTAMP);
+#endif
+}
+
+void gfx_pass_end(possibly_unused enum gfx_pass pass)
+{
+	if (!timer.enabled || timer.depth <= 0)
+		return;
+#ifndef USE_GLES
+	timer.depth--;
+	if (timer.depth >= MAX_PASS_DEPTH)
+		return;
+	int i = timer.stack[timer.depth];
+	if (i < 0)
+		return;
+	glQueryCounter(timer.ids[timer.frame][i*2+1], GL_TIMESTAMP);
+	timer.last_end = i;
+	timer.last_end_depth = timer.depth;
+	timer.last_end_draw_calls = gfx_stats.draw_calls;
+#endif
+}
+
+/*
+ * Read back the queries issued NR_QUERY_FRAMES-1 frames ago and start
+ * recording the next frame into their slot.
+ */
+static void timer_end_frame(struct gfx_frame_stats *stats)
+{
+	stats->gpu_timing = false;
+	if (!timer.enabled)
+		return;
+#ifndef USE_GLES
+	timer.frame = (timer.frame + 1) % NR_QUERY_FRAMES;
+	timer.depth = 0;
+	timer.last_end = -1;
+
+	int f = timer.frame;
+	int n = timer.nr_queries[f];
+	timer.nr_queries[f] = 0;
+	if (!n)
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(timer.ids[f][n*2-1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	for (int i = 0; i < n; i++) {
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(timer.ids[f][i*2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(timer.ids[f][i*2+1], GL_QUERY_RESULT, &end);
+		if (end > begin)
+			stats->gpu_ns[timer.pass[f][i]] += end - begin;
+	}
+	stats->gpu_timing = true;
+#endif
+}
+
+static void csv_close(void)
+{
+	if (csv)
+		fclose(csv);
+	csv = NULL;
+}
+
+static void csv_open(const char *path)
+{
+	if (!(csv = fopen(path, "w"))) {
+		WARNING("Failed to open frame statistics file: %s", path);
+		return;
+	}
+	fputs("frame,ms,draw_calls,shader_switches,texture_binds,fbo_switches,"
+			"texture_uploads,upload_bytes", csv);
+	for (int i = 0; i < GFX_NR_PASSES; i++) {
+		fprintf(csv, ",gpu_%s_us", pass_names[i]);
+	}
+	fputc('\n', csv);
+	atexit(csv_close);
+}
+
+static void csv_write(struct gfx_frame_stats *s)
+{
+	fprintf(csv, "%u,%.3f,%u,%u,%u,%u,%u,%llu", frame_no, frame_ms,
+			s->draw_calls, s->shader_switches, s->texture_binds,
+			s->fbo_switches, s->texture_uploads,
+			(unsigned long long)s->upload_bytes);
+	for (int i = 0; i < GFX_NR_PASSES; i++) {
+		if (s->gpu_timing)
+			fprintf(csv, ",%.1f", s->gpu_ns[i] / 1000.0);
+		else
+			fputc(',', csv);
+	}
+	fputc('\n', csv);
+}
+
+static void overlay_update(void)
+{
+	static struct text_style ts = {
+		.face = FONT_GOTHIC,
+		.size = 14.0f,
+		.bold_width = 0.0f,
+		.weight = FW_NORMAL,
+		.edge_left = 1.0f,
+		.edge_up = 1.0f,
+		.edge_right = 1.0f,
+		.edge_down = 1.0f,
+		.color = { .r = 255, .g = 255, .b = 255, .a = 255 },
+		.edge_color = { .r = 0, .g = 0, .b = 0, .a = 255 },
+		.scale_x = 1.0f,
+		.space_scale_x = 1.0f,
+		.font_spacing = 0.0f,
+		.font_size = NULL
+	};
+
+	// Text rendering is expensive, so the overlay is only redrawn a few
+	// times per second, and only when the text has changed.
+	uint64_t now = SDL_GetTicks64();
+	if (overlay.texture.handle && now < overlay.last_update + OVERLAY_INTERVAL)
+		return;
+	overlay.last_update = now;
+
+	struct gfx_frame_stats *s = &last_stats;
+	char lines[2][OVERLAY_LINE_SIZE];
+	snprintf(lines[0], OVERLAY_LINE_SIZE, "%.1f fps  %.2f ms  draws %u  shaders %u  binds %u  fbos %u  uploads %u (%llu KiB)",
+			gfx_get_frame_rate(), frame_ms, s->draw_calls, s->shader_switches,
+			s->texture_binds, s->fbo_switches, s->texture_uploads,
+			(unsigned long long)s->upload_bytes / 1024);
+	if (!s->gpu_timing) {
+		snprintf(lines[1], OVERLAY_LINE_SIZE, "gpu: n/a");
+	} else {
+		int len = snprintf(lines[1], OVERLAY_LINE_SIZE, "gpu us:");
+		for (int i = 0; i < GFX_NR_PASSES && len < OVERLAY_LINE_SIZE; i++) {
+			len += snprintf(lines[1] + len, OVERLAY_LINE_SIZE - len, "  %s %.0f",
+					pass_names[i], s->gpu_ns[i] / 1000.0);
+		}
+	}
+	if (overlay.texture.handle && !memcmp(lines, overlay.lines, sizeof(lines)))
+		return;
+	memcpy(overlay.lines, lines, sizeof(lines));
+
+	if (!overlay.texture.handle) {
+		gfx_font_init();
+		gfx_init_texture_rgba(&overlay.texture, min(config.view_width, 720), 40,
+				COLOR(0, 0, 0, 128));
+	} else {
+		gfx_fill_with_alpha(&overlay.texture, 0, 0, overlay.texture.w,
+				overlay.texture.h, 0, 0, 0, 128);
+	}
+	gfx_render_text(&overlay.texture, 4, 2, overlay.lines[0], &ts, true);
+	gfx_render_text(&overlay.texture, 4, 20, overlay.lines[1], &ts, true);
+}
+
+/*
+ * Called by gfx_swap before the frame is presented. Collects the counters
+ * for the frame and prepares the overlay (if enabled).
+ */
+void gfx_frame_stats_end_frame(void)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (frame_start)
+		frame_ms = (now - frame_start) * 1000.0 / SDL_GetPerformanceFrequency();
+	frame_start = now;
+
+	last_stats = gfx_stats;
+	memset(last_stats.gpu_ns, 0, sizeof(last_stats.gpu_ns));
+	timer_end_frame(&last_stats);
+	memset(&gfx_stats, 0, sizeof(gfx_stats));
+	frame_no++;
+
+	if (csv)
+		csv_write(&last_stats);
+	if (overlay.enabled) {
+		overlay_update();
+		// don't count the overlay towards the next frame
+		memset(&gfx_stats, 0, sizeof(gfx_stats));
+	}
+}
+
+/*
+ * Called by gfx_swap to draw the overlay on top of the presented frame.
+ */
+void gfx_frame_stats_render_overlay(void)
+{
+	if (!overlay.enabled || !overlay.texture.handle)
+		return;
+	struct gfx_frame_stats saved = gfx_stats;
+	Rectangle r = RECT(0, 0, overlay.texture.w, overlay.texture.h);
+	gfx_present_texture(&overlay.texture, &r);
+	gfx_stats = saved;
+}
+
+void gfx_get_frame_stats(struct gfx_frame_stats *stats)
+{
+	*stats = last_stats;
+}
+
+void gfx_frame_stats_enable_gpu_timing(void)
+{
+	timer_init();
+}
+
+void gfx_frame_stats_set_overlay(bool enabled)
+{
+	overlay.enabled = enabled;
+	if (enabled)
+		timer_init();
+	else
+		gfx_delete_texture(&overlay.texture);
+}
+
+bool gfx_frame_stats_get_overlay(void)
+{
+	return overlay.enabled;
+}
+
+void gfx_frame_stats_init(void)
+{
+	if (config.frame_stats_csv) {
+		csv_open(config.frame_stats_csv);
+		if (csv)
+			timer_init();
+	}
+	if (config.frame_stats_overlay)
+		gfx_frame_stats_set_overlay(true);
+}
@@ -26,7 +26,6 @@
 #include "xsystem4.h"
 
 #define INITIAL_HEAP_SIZE  4096
-#define HEAP_ALLOC_STEP    4096
 
 struct vm_pointer *heap = NULL;
 size_t heap_size = 0;
@@ -37,6 +36,10 @@ uint32_t heap_next_seq;
 int32_t *heap_free_stack = NULL;
 size_t heap_free_ptr = 0;
 
+struct heap_stats heap_stats = {0};
+static struct heap_stats frame_start_stats = {0};
+static struct heap_stats last_frame_stats = {0};
+
 static const char *vm_ptrtype_strtab[] = {
 	[VM_PAGE] = "VM_PAGE",
 	[VM_STRING] = "VM_STRING",
@@ -80,10 +83,11 @@ void heap_init(void)
 int32_t heap_alloc_slot(enum vm_pointer_type type)
 {
 	if (heap_free_ptr >= heap_size) {
-		heap_grow(heap_size+HEAP_ALLOC_STEP);
+		heap_grow(heap_size * 2);
 	}
 
 	int32_t slot = heap_free_stack[heap_free_ptr++];
+	heap_stats.slot_allocs++;
 	heap[slot].ref = 1;
 	heap[slot].seq = heap_next_seq++;
 	heap[slot].type = type;
@@ -102,6 +106,27 @@ static void heap_free_slot(int32_t slot)
 {
 	heap[slot].seq = 0;
 	heap_free_stack[--heap_free_ptr] = slot;
+	heap_stats.slot_frees++;
+}
+
+void heap_stats_end_frame(void)
+{
+	last_frame_stats = (struct heap_stats) {
+		.slot_allocs = heap_stats.slot_allocs - frame_start_stats.slot_allocs,
+		.slot_frees = heap_stats.slot_frees - frame_start_stats.slot_frees,
+		.page_allocs = heap_stats.page_allocs - frame_start_stats.page_allocs,
+		.page_frees = heap_stats.page_frees - frame_start_stats.page_frees,
+		.page_mallocs = heap_stats.page_mallocs - frame_start_stats.page_mallocs,
+		.page_bytes = heap_stats.page_bytes,
+		.cached_pages = heap_stats.cached_pages,
+		.cached_bytes = heap_stats.cached_bytes,
+	};
+	frame_start_stats = heap_stats;
+}
+
+void heap_stats_last_frame(struct heap_stats *out)
+{
+	*out = last_frame_stats;
 }
 
 static void heap_double_free(int32_t slot)
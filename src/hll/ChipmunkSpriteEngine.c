@@ -24,6 +24,7 @@
 #include "gfx/gfx.h"
 #include "gfx/font.h"
 #include "vm/page.h"
+#include "vm.h"
 #include "input.h"
 #include "sact.h"
 #include "CharSpriteManager.h"
@@ -124,7 +125,7 @@ static void ChipmunkSpriteEngine_Sleep(void)
 
 	if (delta >= 12)
 		return;
-	SDL_Delay(12 - delta);
+	vm_sleep(12 - delta);
 }
 
 //static bool ChipmunkSpriteEngine_SP_SetCutCG(int sp_no, int cg_no, int cut_x, int cut_y, int cut_w, int cut_h);
@@ -27,6 +27,7 @@
 #include "system4/string.h"
 #include "system4/little_endian.h"
 
+#include "asset_manager.h"
 #include "audio.h"
 #include "hll.h"
 #include "sact.h"
@@ -276,7 +277,7 @@ static bool ChrLoader_LoadCG(int sprite, int x, int y, int id, int type)
 	if (!blob)
 		return false;
 
-	struct cg *cg = cg_load_buffer(blob, size);
+	struct cg *cg = asset_cg_decode_buffer(blob, size);
 	if (!cg)
 		return false;
 	sprite_set_cg(sp, cg);
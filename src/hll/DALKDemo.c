@@ -23,6 +23,7 @@
 #include "system4/archive.h"
 #include "system4/cg.h"
 
+#include "asset_manager.h"
 #include "audio.h"
 #include "effect.h"
 #include "gfx/gfx.h"
@@ -68,9 +69,9 @@ static struct dalkdemo *dd;
 
 static bool dalkdemo_run_effect(int (*update)(float), int time)
 {
-	uint32_t start = SDL_GetTicks();
+	uint32_t start = vm_time();
 	bool prev_keydown = false;
-	uint32_t t = SDL_GetTicks() - start;
+	uint32_t t = vm_time() - start;
 	while (t < time) {
 		update((float)t / (float)time);
 		handle_events();
@@ -79,9 +80,9 @@ static bool dalkdemo_run_effect(int (*update)(float), int time)
 			return true;
 		prev_keydown = keydown;
 
-		uint32_t t2 = SDL_GetTicks() - start;
+		uint32_t t2 = vm_time() - start;
 		if (t2 < t + 16) {
-			SDL_Delay(t + 16 - t2);
+			vm_sleep(t + 16 - t2);
 			t += 16;
 		} else {
 			t = t2;
@@ -367,7 +368,7 @@ static int DALKDemo_Init(possibly_unused void *imainsystem)
 			DALKDemo_Release();
 			return 0;
 		}
-		struct cg *cg = cg_load_data(dfile);
+		struct cg *cg = asset_cg_decode(dfile);
 		archive_free_data(dfile);
 		if (!cg) {
 			WARNING("daDemo.alk: cannot decode CG %d", i);
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include "system4/archive.h"
 #include "system4/buffer.h"
+#include "system4/hashtable.h"
 #include "system4/mt19937int.h"
 #include "system4/string.h"
 #include "system4/zlib.h"
@@ -42,9 +43,20 @@ struct gdat_row {
 	uint32_t nr_cols;
 };
 
+/*
+ * Lookup indices for SarchString/SarchInt, built on first use for each
+ * column. Values map to (row number + 1) of their first occurrence.
+ */
+struct gdat_column_index {
+	struct hash_table *strings;
+	struct hash_table *ints;
+};
+
 struct gdat_table {
 	struct gdat_row *rows;
 	uint32_t nr_rows;
+	struct gdat_column_index *index;
+	uint32_t nr_index_cols;
 };
 
 struct gdat {
@@ -58,6 +70,8 @@ struct gdat {
 	uint32_t nr_floats;
 	struct string **strings;
 	uint32_t nr_strings;
+	// label -> (table number + 1)
+	struct hash_table *label_index;
 };
 
 static struct gdat *current_gdat;
@@ -73,13 +87,23 @@ static void gdat_free(struct gdat *dat)
 	}
 	if (dat->tables) {
 		for (uint32_t i = 0; i < dat->nr_tables; i++) {
-			for (uint32_t j = 0; j < dat->tables[i].nr_rows; j++) {
-				free(dat->tables[i].rows[j].cols);
+			struct gdat_table *tbl = &dat->tables[i];
+			for (uint32_t j = 0; j < tbl->nr_rows; j++) {
+				free(tbl->rows[j].cols);
 			}
-			free(dat->tables[i].rows);
+			free(tbl->rows);
+			for (uint32_t j = 0; j < tbl->nr_index_cols; j++) {
+				if (tbl->index[j].strings)
+					ht_free(tbl->index[j].strings);
+				if (tbl->index[j].ints)
+					ht_free_int(tbl->index[j].ints);
+			}
+			free(tbl->index);
 		}
 		free(dat->tables);
 	}
+	if (dat->label_index)
+		ht_free(dat->label_index);
 	if (dat->ints)
 		free(dat->ints);
 	if (dat->floats)
@@ -292,14 +316,67 @@ static int DataFile_Open(int link)
 	return current_gdat ? 1 : 0;
 }
 
+static struct gdat_column_index *gdat_get_column_index(struct gdat_table *tbl, int col)
+{
+	if (!tbl->index) {
+		for (uint32_t i = 0; i < tbl->nr_rows; i++) {
+			tbl->nr_index_cols = max(tbl->nr_index_cols, tbl->rows[i].nr_cols);
+		}
+		tbl->index = xcalloc(max(tbl->nr_index_cols, 1), sizeof(struct gdat_column_index));
+	}
+	if ((uint32_t)col >= tbl->nr_index_cols)
+		return NULL;
+	return &tbl->index[col];
+}
+
+static struct hash_table *gdat_build_string_index(struct gdat *dat, struct gdat_table *tbl, int col)
+{
+	struct hash_table *ht = ht_create(tbl->nr_rows * 3 / 2 + 1);
+	for (uint32_t i = 0; i < tbl->nr_rows; i++) {
+		struct gdat_row *row = &tbl->rows[i];
+		if ((uint32_t)col >= row->nr_cols || row->cols[col].type != GDAT_STRING)
+			continue;
+		if (row->cols[col].index >= dat->nr_strings)
+			continue;
+		struct ht_slot *slot = ht_put(ht, dat->strings[row->cols[col].index]->text, NULL);
+		if (!slot->value)
+			slot->value = (void*)(uintptr_t)(i + 1);
+	}
+	return ht;
+}
+
+static struct hash_table *gdat_build_int_index(struct gdat *dat, struct gdat_table *tbl, int col)
+{
+	struct hash_table *ht = ht_create(tbl->nr_rows * 3 / 2 + 1);
+	for (uint32_t i = 0; i < tbl->nr_rows; i++) {
+		struct gdat_row *row = &tbl->rows[i];
+		if ((uint32_t)col >= row->nr_cols || row->cols[col].type != GDAT_INT)
+			continue;
+		if (row->cols[col].index >= dat->nr_ints)
+			continue;
+		struct ht_slot *slot = ht_put_int(ht, dat->ints[row->cols[col].index], NULL);
+		if (!slot->value)
+			slot->value = (void*)(uintptr_t)(i + 1);
+	}
+	return ht;
+}
+
 static int DataFile_SarchLabel(struct string *label)
 {
 	if (!current_gdat)
 		return -1;
-	for (uint32_t i = 0; i < current_gdat->nr_labels; i++) {
-		if (!strcmp(current_gdat->labels[i], label->text))
-			return i;
+	if (!current_gdat->label_index) {
+		current_gdat->label_index = ht_create(current_gdat->nr_labels * 3 / 2 + 1);
+		for (uint32_t i = 0; i < current_gdat->nr_labels; i++) {
+			struct ht_slot *slot = ht_put(current_gdat->label_index,
+					current_gdat->labels[i], NULL);
+			if (!slot->value)
+				slot->value = (void*)(uintptr_t)(i + 1);
+		}
 	}
+	uintptr_t i = (uintptr_t)ht_get(current_gdat->label_index, label->text, NULL);
+	if (i)
+		return i - 1;
 	WARNING("Label '%s' not found", label->text);
 	return -1;
 }
@@ -323,14 +400,12 @@ static int DataFile_SarchString(int label, int horizontal, struct string *data)
 		return -1;
 	if (horizontal < 0)
 		return -1;
-	for (uint32_t i = 0; i < tbl->nr_rows; i++) {
-		struct gdat_row *row = &tbl->rows[i];
-		if ((uint32_t)horizontal < row->nr_cols &&
-			row->cols[horizontal].type == GDAT_STRING &&
-			!strcmp(current_gdat->strings[row->cols[horizontal].index]->text, data->text))
-			return i;
-	}
-	return -1;
+	struct gdat_column_index *index = gdat_get_column_index(tbl, horizontal);
+	if (!index)
+		return -1;
+	if (!index->strings)
+		index->strings = gdat_build_string_index(current_gdat, tbl, horizontal);
+	return (intptr_t)ht_get(index->strings, data->text, NULL) - 1;
 }
 
 static int DataFile_SarchInt(int label, int horizontal, int data)
@@ -340,14 +415,12 @@ static int DataFile_SarchInt(int label, int horizontal, int data)
 		return -1;
 	if (horizontal < 0)
 		return -1;
-	for (uint32_t i = 0; i < tbl->nr_rows; i++) {
-		struct gdat_row *row = &tbl->rows[i];
-		if ((uint32_t)horizontal < row->nr_cols &&
-			row->cols[horizontal].type == GDAT_INT &&
-			current_gdat->ints[row->cols[horizontal].index] == data)
-			return i;
-	}
-	return -1;
+	struct gdat_column_index *index = gdat_get_column_index(tbl, horizontal);
+	if (!index)
+		return -1;
+	if (!index->ints)
+		index->ints = gdat_build_int_index(current_gdat, tbl, horizontal);
+	return (intptr_t)ht_get_int(index->ints, data, NULL) - 1;
 }
 
 static int DataFile_GetInt(int label, int vartical, int horizontal)
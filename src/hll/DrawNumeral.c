@@ -51,6 +51,9 @@ static bool DrawNumeral_LoadCG(int cg_no)
 
 	struct cg_entry *entry = xmalloc(sizeof(struct cg_entry));
 	entry->refcnt = 0;
+	for (int i = 0; i < 10; i++) {
+		asset_cg_prefetch(cg_no + i);
+	}
 	for (int i = 0; i < 10; i++) {
 		struct cg *cg = asset_cg_load(cg_no + i);
 		if (!cg) {
@@ -694,7 +694,7 @@ static int fullscreen_effect(int effect, int dst_surf, int src_surf, int ms)
 	for (int i = 0; i < ms; i += 16) {
 		effect_update_texture(effect, dst, old, new, (float)i / (float)ms);
 		Gpx2Plus_Update(0, 0, config.view_width, config.view_height);
-		SDL_Delay(16);
+		vm_sleep(16);
 	}
 	effect_update_texture(effect, dst, old, new, 1.0);
 	Gpx2Plus_Update(0, 0, config.view_width, config.view_height);
@@ -741,7 +741,7 @@ static int Gpx2Plus_EffectCopy(int effect, int wx, int wy,
 	for (int i = 0; i < totalTime; i += 16) {
 		effect_func(&params, (float)i / (float)totalTime);
 		Gpx2Plus_Update(wx, wy, width, height);
-		SDL_Delay(16);
+		vm_sleep(16);
 	}
 	effect_func(&params, 1.0);
 	Gpx2Plus_Update(wx, wy, width, height);
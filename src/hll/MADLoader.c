@@ -23,6 +23,7 @@
 #include "system4/string.h"
 #include "system4/cg.h"
 
+#include "asset_manager.h"
 #include "hll.h"
 #include "id_pool.h"
 #include "xsystem4.h"
@@ -132,7 +133,7 @@ static int MADLoader_Open(struct string *filename)
 		uint8_t *image_data = xmalloc(image_size);
 		if (fread(image_data, image_size, 1, fp) != 1)
 			VM_ERROR("MADLoader: failed to read image data %d of %s", i, display_sjis0(filename->text));
-		struct cg *cg = cg_load_buffer(image_data, image_size);
+		struct cg *cg = asset_cg_decode_buffer(image_data, image_size);
 		if (!cg)
 			VM_ERROR("MADLoader: failed to load cg %d of %s", i, display_sjis0(filename->text));
 		gfx_init_texture_with_cg(&mad->textures[i], cg);
@@ -22,6 +22,7 @@
 #include "system4/mt19937int.h"
 #include "system4/little_endian.h"
 
+#include "asset_manager.h"
 #include "hll.h"
 #include "sact.h"
 #include "xsystem4.h"
@@ -73,7 +74,7 @@ static bool map_load_cg(int sprite, int index)
 		return false;
 	size_t offset = LittleEndian_getDW(map_data, 8 + index * 8);
 	size_t length = LittleEndian_getDW(map_data, 8 + index * 8 + 4);
-	struct cg *cg = cg_load_buffer(map_data + offset, length);
+	struct cg *cg = asset_cg_decode_buffer(map_data + offset, length);
 	if (!cg)
 		return false;
 	sprite_set_cg(sp, cg);
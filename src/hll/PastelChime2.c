@@ -31,6 +31,7 @@
 #include "dungeon/map.h"
 #include "queue.h"
 #include "sact.h"
+#include "vm.h"
 #include "vm/heap.h"
 #include "vm/page.h"
 #include "xsystem4.h"
@@ -1842,7 +1843,7 @@ static void PastelChime2_AutoDungeonE_Create(
 		return;
 
 	uint8_t *cell_flags = xcalloc(field_size_y, field_size_x);
-	uint32_t seed = SDL_GetTicks();
+	uint32_t seed = vm_time();
 	NOTICE("PastelChime2.AutoDungeonE_Create: seed = %u, complexity = %d", seed, complex);
 	struct dgn *dgn = dgn_generate_drawfield(
 		floor, complex, wall_arrange_method, floor_arrange_method,
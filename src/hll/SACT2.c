@@ -97,7 +97,7 @@ struct sact_sprite *sact_try_get_sprite(int sp)
 	return sprites[sp];
 }
 
-int sact_init(possibly_unused int cg_cache_size, enum sprite_engine_type engine)
+int sact_init(int cg_cache_size, enum sprite_engine_type engine)
 {
 	if (engine_type != UNINITIALIZED_SPRITE_ENGINE) {
 		if (engine_type != engine)
@@ -110,6 +110,7 @@ int sact_init(possibly_unused int cg_cache_size, enum sprite_engine_type engine)
 	gfx_init();
 	gfx_font_init();
 	audio_init();
+	asset_cg_cache_init(cg_cache_size);
 
 	nr_sprites = 256;
 	sprites = xmalloc(sizeof(struct sact_sprite*) * 257);
@@ -180,27 +181,24 @@ int sact_Update(void)
 {
 	handle_events();
 	sprite_call_plugins();
-	if (scene_is_dirty) {
-		scene_render();
-		gfx_swap();
-		scene_is_dirty = false;
-	}
+	if (scene_is_dirty)
+		scene_update();
 	return 1;
 }
 
 int sact_Effect(int type, int time, possibly_unused int key)
 {
-	uint32_t start = SDL_GetTicks();
+	uint32_t start = vm_time();
 	if (!effect_init(type))
 		return 0;
 	scene_render();
 
-	uint32_t t = SDL_GetTicks() - start;
+	uint32_t t = vm_time() - start;
 	while (t < time) {
 		effect_update((float)t / (float)time);
-		uint32_t t2 = SDL_GetTicks() - start;
+		uint32_t t2 = vm_time() - start;
 		if (t2 < t + 16) {
-			SDL_Delay(t + 16 - t2);
+			vm_sleep(t + 16 - t2);
 			t += 16;
 		} else {
 			t = t2;
@@ -229,7 +227,7 @@ void sact_QuakeScreen(int amp_x, int amp_y, int time, int key)
 		gfx_clear();
 		gfx_copy(dst, delta_x, delta_y, &tex, 0, 0, dst->w, dst->h);
 		gfx_swap();
-		SDL_Delay(16);
+		vm_sleep(16);
 	}
 }
 
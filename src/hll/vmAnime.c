@@ -23,6 +23,7 @@
 #include "gfx/gfx.h"
 #include "hll.h"
 #include "id_pool.h"
+#include "vm.h"
 
 struct vm_anime {
 	int cg;
@@ -118,7 +119,11 @@ static void vmAnime_Draw(int handle, int return_)
 	gfx_copy_main_surface(&old);
 	Texture *dst = gfx_main_surface();
 
-	uint64_t start_time = SDL_GetTicks64();
+	for (int i = 0; i < anime->length; i++) {
+		asset_cg_prefetch(anime->cg + i);
+	}
+
+	int start_time = vm_time();
 	for (int i = 0; i < anime->length; i++) {
 		struct cg *cg = asset_cg_load(anime->cg + i);
 		Texture src;
@@ -128,7 +133,9 @@ static void vmAnime_Draw(int handle, int return_)
 		gfx_delete_texture(&src);
 		cg_free(cg);
 		gfx_swap();
-		SDL_Delay(start_time + (i + 1) * anime->interval - SDL_GetTicks64());
+		int ms = start_time + (i + 1) * anime->interval - vm_time();
+		if (ms > 0)
+			vm_sleep(ms);
 	}
 	if (return_) {
 		gfx_copy(dst, 0, 0, &old, 0, 0, old.w, old.h);
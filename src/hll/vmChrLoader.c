@@ -22,6 +22,7 @@
 #include "system4/cg.h"
 #include "system4/string.h"
 
+#include "asset_manager.h"
 #include "gfx/gfx.h"
 #include "hll.h"
 #include "ChrLoader.h"
@@ -63,7 +64,7 @@ static int vmChrLoader_MemoryToSurface(int memory, int x, int y, int surface)
 	if (!data)
 		return 0;
 
-	struct cg *cg = cg_load_buffer(data, size);
+	struct cg *cg = asset_cg_decode_buffer(data, size);
 	if (!cg)
 		return 0;
 
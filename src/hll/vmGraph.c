@@ -18,6 +18,7 @@
 #include "gfx/gfx.h"
 #include "vmSurface.h"
 #include "hll.h"
+#include "vm.h"
 
 HLL_QUIET_UNIMPLEMENTED( , void, vmGraph, Init, void *imainsystem);
 //void vmGraph_SetUseCPUEx(int nUse);
@@ -187,17 +188,17 @@ HLL_WARN_UNIMPLEMENTED( , void, vmGraph, SetClickCancel, int click);
 
 static int vmGraph_EffectCopy(int dx, int dy, int src_surface, int sx, int sy, int width, int height, int effect, int total_time)
 {
-	uint32_t start = SDL_GetTicks();
+	uint32_t start = vm_time();
 	if (!effect_init(effect))
 		return 0;
 	vmGraph_Copy(vm_surface_get_main_surface(), dx, dy, src_surface, sx, sy, width, height);
 
-	uint32_t t = SDL_GetTicks() - start;
+	uint32_t t = vm_time() - start;
 	while (t < total_time) {
 		effect_update((float)t / (float)total_time);
-		uint32_t t2 = SDL_GetTicks() - start;
+		uint32_t t2 = vm_time() - start;
 		if (t2 < t + 16) {
-			SDL_Delay(t + 16 - t2);
+			vm_sleep(t + 16 - t2);
 			t += 16;
 		} else {
 			t = t2;
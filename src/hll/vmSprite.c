@@ -25,6 +25,7 @@
 #include "json.h"
 #include "sact.h"
 #include "scene.h"
+#include "vm.h"
 #include "vm/page.h"
 #include "vmSurface.h"
 
@@ -39,7 +40,7 @@ struct animation {
 	int frame_e;
 	int nr_frames;
 	int current_frame;
-	uint64_t time_origin;
+	uint32_t time_origin;
 	int total_frame_time;
 	int frame_times[];
 };
@@ -80,7 +81,7 @@ static void vm_sprite_dirty(struct vm_sprite *sp)
 
 static void update_animation(void)
 {
-	uint64_t now = SDL_GetTicks64();
+	uint32_t now = vm_time();
 
 	for (int id = id_pool_get_first(&pool); id >= 0; id = id_pool_get_next(&pool, id)) {
 		struct vm_sprite *sp = id_pool_get(&pool, id);
@@ -293,7 +294,7 @@ static int vmSprite_SetCurrent(int sprite, int current)
 	if (sp->current != current) {
 		sp->current = current;
 		if (sp->anime) {
-			sp->anime->time_origin = SDL_GetTicks64();
+			sp->anime->time_origin = vm_time();
 		}
 		vm_sprite_dirty(sp);
 	}
@@ -398,7 +399,7 @@ static int vmSprite_SetAnime(int sprite, int frame_s, int frame_e, struct page *
 	a->frame_e = frame_e;
 	a->nr_frames = nr_frames;
 	a->current_frame = 0;
-	a->time_origin = SDL_GetTicks64();
+	a->time_origin = vm_time();
 	a->total_frame_time = 0;
 	for (int i = 0; i < a->nr_frames; i++) {
 		a->total_frame_time += a->frame_times[i] = array->values[i].i;
@@ -474,7 +475,7 @@ static void vmSprite_DrawEffect(int effect, int time)
 
 	if (SDL_RectEmpty(&dirty_rect))
 		return;
-	uint64_t start = SDL_GetTicks64();
+	uint32_t start = vm_time();
 	Texture *screen = gfx_main_surface();
 	Texture base, src;
 	gfx_init_texture_blank(&src, dirty_rect.w, dirty_rect.h);
@@ -482,7 +483,7 @@ static void vmSprite_DrawEffect(int effect, int time)
 	scene_render();
 	gfx_copy_main_surface(&base);
 
-	uint64_t t = SDL_GetTicks64() - start;
+	uint32_t t = vm_time() - start;
 	float cx = dirty_rect.x + dirty_rect.w / 2.0f;
 	float cy = dirty_rect.y + dirty_rect.h / 2.0f;
 	while (t < time) {
@@ -493,9 +494,9 @@ static void vmSprite_DrawEffect(int effect, int time)
 		gfx_copy_rot_zoom2(screen, cx, cy, &src, src.w / 2.0f, src.h / 2.0f, rate * -360, 1.0f - rate);
 		gfx_swap();
 
-		uint64_t t2 = SDL_GetTicks64() - start;
+		uint32_t t2 = vm_time() - start;
 		if (t2 < t + 16) {
-			SDL_Delay(t + 16 - t2);
+			vm_sleep(t + 16 - t2);
 			t += 16;
 		} else {
 			t = t2;
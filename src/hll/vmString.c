@@ -22,10 +22,11 @@
 #include "system4/utfsjis.h"
 
 #include "hll.h"
+#include "vm/string_index.h"
 
 static int vmString_GetLength(struct string *string)
 {
-	return sjis_count_char(string->text);
+	return vm_string_length(string);
 }
 
 static int vmString_GetLengthA(struct string *string)
@@ -71,7 +72,7 @@ static int vmString_StringToInt(struct string *string)
 
 static struct string *vmString_GetString(struct string *string, int index, int length)
 {
-	return string_copy(string, index, length);
+	return vm_string_copy(string, index, length);
 }
 
 //struct string *vmString_CutTag(struct string *pIString);
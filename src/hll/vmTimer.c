@@ -14,8 +14,6 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
-#include <SDL.h>
-
 #include "hll.h"
 #include "id_pool.h"
 
@@ -64,7 +62,7 @@ static void vmTimer_Set(int handle, int time)
 	struct vm_timer *timer = id_pool_get(&pool, handle);
 	if (!timer)
 		return;
-	timer->origin = SDL_GetTicks64() - time;
+	timer->origin = vm_time() - time;
 }
 
 static int vmTimer_Get(int handle)
@@ -72,12 +70,12 @@ static int vmTimer_Get(int handle)
 	struct vm_timer *timer = id_pool_get(&pool, handle);
 	if (!timer)
 		return 0;
-	return SDL_GetTicks64() - timer->origin;
+	return vm_time() - timer->origin;
 }
 
 static void vmTimer_Wait(int time)
 {
-	SDL_Delay(time);
+	vm_sleep(time);
 }
 
 static void vmTimer_Pass(int handle, int time)
@@ -85,9 +83,9 @@ static void vmTimer_Pass(int handle, int time)
 	struct vm_timer *timer = id_pool_get(&pool, handle);
 	if (!timer)
 		return;
-	int ms = timer->origin + time - SDL_GetTicks64();
+	int ms = timer->origin + time - vm_time();
 	if (ms > 0)
-		SDL_Delay(ms);
+		vm_sleep(ms);
 }
 
 HLL_LIBRARY(vmTimer,
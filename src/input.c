@@ -15,6 +15,8 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <SDL.h>
 #include "system4.h"
@@ -22,6 +24,7 @@
 #include "gfx/gfx.h"
 #include "gfx/private.h"
 #include "input.h"
+#include "replay.h"
 #include "scene.h"
 #include "vm.h"
 #include "xsystem4.h"
@@ -224,11 +227,20 @@ void key_clear_flag(bool no_ctrl)
 
 void mouse_get_pos(int *x, int *y)
 {
+	if (replay_mode == REPLAY_PLAY) {
+		char *rec = replay_next(REPLAY_MOUSE);
+		if (rec && sscanf(rec, "%d %d", x, y) == 2)
+			return;
+	}
+
 	int wx, wy;
 	SDL_PumpEvents();
 	SDL_GetMouseState(&wx, &wy);
 	*x = (wx - sdl.viewport.x) * sdl.w / sdl.viewport.w;
 	*y = (wy - sdl.viewport.y) * sdl.h / sdl.viewport.h;
+
+	if (replay_mode == REPLAY_RECORD)
+		replay_record(REPLAY_MOUSE, "%d %d", *x, *y);
 }
 
 void mouse_set_pos(int x, int y)
@@ -260,13 +272,26 @@ static void(*input_handler)(const char*);
 static void(*editing_handler)(const char*, int, int);
 static void(*key_handler)(int);
 
+static void text_input(const char *text)
+{
+	if (!input_handler)
+		return;
+	if (replay_mode == REPLAY_RECORD)
+		replay_record(REPLAY_TEXT, "%s", text);
+	input_handler(text);
+}
+
 static void key_event(SDL_KeyboardEvent *e, bool pressed)
 {
 	enum sact_keycode code = sdl_to_sact_key(e->keysym.scancode, e->keysym.mod);
 	if (code) {
 		key_state[code] = pressed;
-		if (pressed && key_handler)
+		if (pressed && key_handler) {
+			// recorded per call, since autorepeat doesn't change key_state
+			if (replay_mode == REPLAY_RECORD)
+				replay_record(REPLAY_KEY, "%d", code);
 			key_handler(code);
+		}
 	}
 }
 
@@ -577,8 +602,7 @@ static void fire_deferred_events(void)
 		struct deferred_keyevent *ev = STAILQ_FIRST(&deferred_keyevent_queue);
 		switch (ev->e.type) {
 		case SDL_TEXTINPUT:
-			if (input_handler)
-				input_handler(ev->e.text.text);
+			text_input(ev->e.text.text);
 			break;
 		case SDL_KEYDOWN:
 		case SDL_KEYUP:
@@ -632,7 +656,79 @@ void handle_window_events(void)
 	}
 }
 
-void handle_events(void)
+/*
+ * Apply the next set of input changes from the replay log. Returns false if
+ * the replay has ended, in which case live input should be used.
+ */
+static bool replay_events(void)
+{
+	// window events are still handled live, but input events are discarded
+	handle_window_events();
+	if (dbg_dap)
+		dbg_dap_handle_messages();
+
+	// text and key handler calls are replayed in the order they were made
+	for (char type = replay_peek(); type == REPLAY_TEXT || type == REPLAY_KEY; type = replay_peek()) {
+		char *rec = replay_next(type);
+		if (type == REPLAY_TEXT) {
+			if (input_handler)
+				input_handler(rec);
+			continue;
+		}
+		long code = strtol(rec, NULL, 10);
+		if (code <= 0 || code >= VK_NR_KEYCODES) {
+			WARNING("Invalid replay record: %s", rec);
+			continue;
+		}
+		key_state[code] = true;
+		if (key_handler)
+			key_handler(code);
+	}
+
+	char *rec = replay_next(REPLAY_EVENTS);
+	if (!rec)
+		return false;
+
+	while (*rec) {
+		char *end;
+		if (*rec == ' ') {
+			rec++;
+		} else if (*rec == 'W') {
+			wheel_dir = strtol(rec + 1, &end, 10);
+			rec = end;
+		} else {
+			long code = strtol(rec, &end, 10);
+			if (end == rec || *end != ':' || code <= 0 || code >= VK_NR_KEYCODES) {
+				WARNING("Invalid replay record: %s", rec);
+				return true;
+			}
+			key_state[code] = end[1] == '1';
+			rec = end + 2;
+		}
+	}
+	return true;
+}
+
+/*
+ * Write the input changes made by a handle_events call to the replay log.
+ */
+static void record_events(bool *prev_key_state, int prev_wheel_dir)
+{
+	// room for every key changing state, plus the wheel
+	char buf[(VK_NR_KEYCODES + 1) * 16];
+	size_t len = 0;
+	for (int i = 0; i < VK_NR_KEYCODES; i++) {
+		if (key_state[i] != prev_key_state[i])
+			len += snprintf(buf + len, sizeof(buf) - len, " %d:%d", i, key_state[i]);
+	}
+	if (wheel_dir != prev_wheel_dir)
+		len += snprintf(buf + len, sizeof(buf) - len, " W%d", wheel_dir);
+	if (len >= sizeof(buf))
+		ERROR("Replay record too long");
+	replay_record(REPLAY_EVENTS, "%s", len ? buf + 1 : "");
+}
+
+static void handle_live_events(void)
 {
 	fire_deferred_events();
 
@@ -752,7 +848,7 @@ void handle_events(void)
 				STAILQ_INSERT_TAIL(&deferred_keyevent_queue, ev, entry);
 #endif
 			} else {
-				input_handler(e.text.text);
+				text_input(e.text.text);
 			}
 			break;
 		case SDL_TEXTEDITING:
@@ -766,3 +862,20 @@ void handle_events(void)
 	if (dbg_dap)
 		dbg_dap_handle_messages();
 }
+
+void handle_events(void)
+{
+	if (replay_mode == REPLAY_PLAY && replay_events())
+		return;
+
+	if (replay_mode == REPLAY_RECORD) {
+		bool prev_key_state[VK_NR_KEYCODES];
+		int prev_wheel_dir = wheel_dir;
+		memcpy(prev_key_state, key_state, sizeof(key_state));
+		handle_live_events();
+		record_events(prev_key_state, prev_wheel_dir);
+		return;
+	}
+
+	handle_live_events();
+}
@@ -0,0 +1,817 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#define VM_PRIVATE
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "vm/jit.h"
+
+#ifdef VM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "system4.h"
+#include "system4/ain.h"
+#include "system4/instructions.h"
+#include "system4/little_endian.h"
+
+#include "vm.h"
+#include "vm/heap.h"
+#include "vm/page.h"
+
+/*
+ * Baseline (template) JIT compiler for x86-64.
+ *
+ * Each instruction is translated independently. Simple integer stack
+ * operations, local variable access and branches within the function are
+ * emitted inline; every other instruction is executed by calling back into
+ * the switch interpreter (jit_exec_insn). If such an instruction transfers
+ * control (CALLFUNC, RETURN, SWITCH, ...), the native code returns to the
+ * interpreter, which continues from instr_ptr. Since return addresses are
+ * valid entry points, a compiled function is re-entered when a call
+ * returns.
+ *
+ * Register assignment within compiled code:
+ *
+ *   rbx: stack (base pointer)
+ *   r12: stack_ptr (written back before calling into C and when exiting)
+ *   r13: local page values
+ *   r14: local page slot
+ *
+ * Every instruction boundary is in this canonical state, so native code can
+ * be entered at any instruction which has an entry point.
+ */
+
+#define REG_RAX 0
+#define REG_RCX 1
+#define REG_RDX 2
+
+// x86 condition codes
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+
+#define NO_OFFSET 0xFFFFFFFF
+
+struct jit_function {
+	int fno;
+	uint32_t start;
+	uint32_t end;
+	uint8_t *code;
+	size_t code_size;
+	// (address - start) / 2 -> offset into code, or NO_OFFSET
+	uint32_t *entry;
+	// next function waiting to be freed
+	struct jit_function *next;
+};
+
+struct jit_buffer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+};
+
+struct jit_fixup {
+	size_t pos;      // position of rel32 operand
+	uint32_t target; // bytecode address
+};
+
+struct jit_state {
+	struct jit_buffer b;
+	struct jit_function *f;
+	// bytecode offset -> native offset (for branch targets)
+	uint32_t *label;
+	// instructions which are the target of a branch within the function
+	bool *is_target;
+	struct jit_fixup *fixups;
+	unsigned nr_fixups;
+	size_t exit_sync;
+	size_t exit_nosync;
+};
+
+typedef void (*jit_trampoline_fn)(void *target, union vm_value *locals, int32_t local_slot);
+
+static jit_trampoline_fn jit_trampoline = NULL;
+static uint64_t jit_epoch = 0;
+
+// number of jit_enter calls on the C stack
+static int jit_depth = 0;
+// functions which were freed while native code was on the C stack
+static struct jit_function *jit_retired = NULL;
+
+// Written by jit_exec_insn; reloaded into r13/r14 after returning to native code.
+static union vm_value *jit_locals = NULL;
+static int64_t jit_local_slot = 0;
+
+/*
+ * Execute the instruction at ADDR with the interpreter. Returns 0 if native
+ * execution can continue at NEXT, or nonzero if the native code must exit.
+ */
+static int jit_exec_insn(uint32_t addr, uint32_t next)
+{
+	uint64_t epoch = jit_epoch;
+	int32_t csp = call_stack_ptr;
+	instr_ptr = addr;
+	vm_execute_instruction();
+	if (instr_ptr != next || call_stack_ptr != csp || epoch != jit_epoch)
+		return 1;
+	jit_local_slot = call_stack[call_stack_ptr-1].page_slot;
+	jit_locals = heap[jit_local_slot].page->values;
+	return 0;
+}
+
+void jit_invalidate(void)
+{
+	jit_epoch++;
+}
+
+//
+// --- Code Emission ---
+//
+
+static void emit_byte(struct jit_buffer *b, uint8_t v)
+{
+	if (b->len >= b->size) {
+		b->size = b->size ? b->size * 2 : 4096;
+		b->buf = xrealloc(b->buf, b->size);
+	}
+	b->buf[b->len++] = v;
+}
+
+static void emit_bytes(struct jit_buffer *b, int n, ...)
+{
+	va_list ap;
+	va_start(ap, n);
+	for (int i = 0; i < n; i++) {
+		emit_byte(b, va_arg(ap, int));
+	}
+	va_end(ap);
+}
+
+static void emit_dword(struct jit_buffer *b, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) {
+		emit_byte(b, (v >> (i*8)) & 0xFF);
+	}
+}
+
+static void emit_qword(struct jit_buffer *b, uint64_t v)
+{
+	for (int i = 0; i < 8; i++) {
+		emit_byte(b, (v >> (i*8)) & 0xFF);
+	}
+}
+
+static void patch_dword(struct jit_buffer *b, size_t pos, uint32_t v)
+{
+	for (int i = 0; i < 4; i++) {
+		b->buf[pos+i] = (v >> (i*8)) & 0xFF;
+	}
+}
+
+// mov rax, imm64
+static void emit_mov_rax_imm64(struct jit_buffer *b, uint64_t v)
+{
+	emit_bytes(b, 2, 0x48, 0xB8);
+	emit_qword(b, v);
+}
+
+/*
+ * Stack slots are addressed as [rbx + r12*8 + disp8]. Slot N is the Nth value
+ * from the top of the stack (0 = top), slot -1 is the first free slot.
+ */
+static void emit_slot_modrm(struct jit_buffer *b, int reg, int n)
+{
+	emit_byte(b, 0x44 | ((reg & 7) << 3)); // mod=01 rm=SIB
+	emit_byte(b, 0xE3);                    // scale=8 index=r12 base=rbx
+	emit_byte(b, (uint8_t)(-8 * (n + 1)));
+}
+
+// mov r32, [slot]
+static void emit_load_slot32(struct jit_buffer *b, int reg, int n)
+{
+	emit_bytes(b, 2, 0x42, 0x8B);
+	emit_slot_modrm(b, reg, n);
+}
+
+// mov [slot], r32
+static void emit_store_slot32(struct jit_buffer *b, int reg, int n)
+{
+	emit_bytes(b, 2, 0x42, 0x89);
+	emit_slot_modrm(b, reg, n);
+}
+
+// mov r64, [slot]
+static void emit_load_slot64(struct jit_buffer *b, int reg, int n)
+{
+	emit_bytes(b, 2, 0x4A, 0x8B);
+	emit_slot_modrm(b, reg, n);
+}
+
+// mov [slot], r64
+static void emit_store_slot64(struct jit_buffer *b, int reg, int n)
+{
+	emit_bytes(b, 2, 0x4A, 0x89);
+	emit_slot_modrm(b, reg, n);
+}
+
+// mov dword [slot], imm32
+static void emit_store_slot_imm(struct jit_buffer *b, int n, int32_t v)
+{
+	emit_bytes(b, 2, 0x42, 0xC7);
+	emit_slot_modrm(b, 0, n);
+	emit_dword(b, v);
+}
+
+// add r12, n (n may be negative)
+static void emit_adjust_sp(struct jit_buffer *b, int n)
+{
+	if (n == 1) {
+		emit_bytes(b, 3, 0x49, 0xFF, 0xC4); // inc r12
+	} else if (n == -1) {
+		emit_bytes(b, 3, 0x49, 0xFF, 0xCC); // dec r12
+	} else if (n) {
+		emit_bytes(b, 4, 0x49, 0x83, 0xC4, (uint8_t)n);
+	}
+}
+
+/*
+ * Local variables are addressed as [r13 + disp32]. OP is the opcode byte and
+ * REG the ModRM reg field (a register or an opcode extension).
+ */
+static void emit_local_op(struct jit_buffer *b, uint8_t op, int reg, int varno)
+{
+	emit_bytes(b, 3, 0x41, op, 0x85 | ((reg & 7) << 3));
+	emit_dword(b, varno * sizeof(union vm_value));
+}
+
+// mov [rax], r12d
+static void emit_store_stack_ptr(struct jit_buffer *b)
+{
+	emit_mov_rax_imm64(b, (uintptr_t)&stack_ptr);
+	emit_bytes(b, 3, 0x44, 0x89, 0x20);
+}
+
+// movsxd r12, [rax]
+static void emit_load_stack_ptr(struct jit_buffer *b)
+{
+	emit_mov_rax_imm64(b, (uintptr_t)&stack_ptr);
+	emit_bytes(b, 3, 0x4C, 0x63, 0x20);
+}
+
+// jmp/jcc rel32 to native offset POS (which must already be emitted)
+static void emit_jump_to(struct jit_buffer *b, int cc, size_t pos)
+{
+	if (cc < 0) {
+		emit_byte(b, 0xE9);
+	} else {
+		emit_bytes(b, 2, 0x0F, 0x80 | cc);
+	}
+	emit_dword(b, (uint32_t)(pos - (b->len + 4)));
+}
+
+// jmp/jcc rel32 to bytecode address TARGET (resolved at the end of compilation)
+static void emit_branch(struct jit_state *s, int cc, uint32_t target)
+{
+	if (cc < 0) {
+		emit_byte(&s->b, 0xE9);
+	} else {
+		emit_bytes(&s->b, 2, 0x0F, 0x80 | cc);
+	}
+	s->fixups = xrealloc_array(s->fixups, s->nr_fixups, s->nr_fixups+1, sizeof(struct jit_fixup));
+	s->fixups[s->nr_fixups++] = (struct jit_fixup) { .pos = s->b.len, .target = target };
+	emit_dword(&s->b, 0);
+}
+
+// Set instr_ptr to ADDR and return to the interpreter.
+static void emit_exit(struct jit_state *s, uint32_t addr)
+{
+	emit_mov_rax_imm64(&s->b, (uintptr_t)&instr_ptr);
+	emit_bytes(&s->b, 3, 0x48, 0xC7, 0x00); // mov qword [rax], imm32
+	emit_dword(&s->b, addr);
+	emit_jump_to(&s->b, -1, s->exit_sync);
+}
+
+// Execute the instruction at ADDR by calling into the interpreter.
+static void emit_interpreted(struct jit_state *s, uint32_t addr, uint32_t next)
+{
+	struct jit_buffer *b = &s->b;
+	emit_store_stack_ptr(b);
+	emit_byte(b, 0xBF); // mov edi, imm32
+	emit_dword(b, addr);
+	emit_byte(b, 0xBE); // mov esi, imm32
+	emit_dword(b, next);
+	emit_mov_rax_imm64(b, (uintptr_t)jit_exec_insn);
+	emit_bytes(b, 2, 0xFF, 0xD0);       // call rax
+	emit_bytes(b, 2, 0x85, 0xC0);       // test eax, eax
+	emit_jump_to(b, CC_NE, s->exit_nosync);
+	emit_load_stack_ptr(b);
+	emit_mov_rax_imm64(b, (uintptr_t)&jit_locals);
+	emit_bytes(b, 3, 0x4C, 0x8B, 0x28); // mov r13, [rax]
+	emit_mov_rax_imm64(b, (uintptr_t)&jit_local_slot);
+	emit_bytes(b, 3, 0x4C, 0x8B, 0x30); // mov r14, [rax]
+}
+
+// Binary integer operation on the top two stack values.
+static void emit_binop(struct jit_buffer *b, enum opcode op)
+{
+	emit_load_slot32(b, REG_RAX, 1);
+	emit_load_slot32(b, REG_RCX, 0);
+	switch (op) {
+	case ADD:    emit_bytes(b, 2, 0x01, 0xC8); break;       // add eax, ecx
+	case SUB:    emit_bytes(b, 2, 0x29, 0xC8); break;       // sub eax, ecx
+	case MUL:    emit_bytes(b, 3, 0x0F, 0xAF, 0xC1); break; // imul eax, ecx
+	case AND:    emit_bytes(b, 2, 0x21, 0xC8); break;       // and eax, ecx
+	case OR:     emit_bytes(b, 2, 0x09, 0xC8); break;       // or eax, ecx
+	case XOR:    emit_bytes(b, 2, 0x31, 0xC8); break;       // xor eax, ecx
+	case LSHIFT: emit_bytes(b, 2, 0xD3, 0xE0); break;       // shl eax, cl
+	case RSHIFT: emit_bytes(b, 2, 0xD3, 0xF8); break;       // sar eax, cl
+	default:     ERROR("Invalid binary operator: %d", op);
+	}
+	emit_store_slot32(b, REG_RAX, 1);
+	emit_adjust_sp(b, -1);
+}
+
+static int comparison_cc(enum opcode op)
+{
+	switch (op) {
+	case LT:     return CC_L;
+	case GT:     return CC_G;
+	case LTE:    return CC_LE;
+	case GTE:    return CC_GE;
+	case NOTE:   return CC_NE;
+	case EQUALE: return CC_E;
+	default:     return -1;
+	}
+}
+
+// Pop and compare the top two stack values, leaving the flags set.
+static void emit_compare(struct jit_buffer *b)
+{
+	emit_load_slot32(b, REG_RAX, 1);
+	emit_load_slot32(b, REG_RCX, 0);
+	emit_adjust_sp(b, -2);
+	emit_bytes(b, 2, 0x39, 0xC8); // cmp eax, ecx
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc(struct jit_buffer *b, int cc)
+{
+	emit_bytes(b, 3, 0x0F, 0x90 | cc, 0xC0);
+	emit_bytes(b, 3, 0x0F, 0xB6, 0xC0);
+}
+
+//
+// --- Compilation ---
+//
+
+static uint16_t code_opcode(uint32_t addr)
+{
+	return LittleEndian_getW(ain->code, addr);
+}
+
+static int32_t code_arg(uint32_t addr, int n)
+{
+	return LittleEndian_getDW(ain->code, addr + 2 + n*4);
+}
+
+static bool in_function(struct jit_state *s, uint32_t addr)
+{
+	return addr >= s->f->start && addr < s->f->end && !(addr & 1);
+}
+
+// Check if the instruction at ADDR can be fused with the preceding one.
+static bool can_fuse(struct jit_state *s, uint32_t addr, enum opcode op)
+{
+	return addr < s->f->end
+		&& code_opcode(addr) == op
+		&& !s->is_target[(addr - s->f->start) / 2];
+}
+
+static int branch_argument(enum opcode op)
+{
+	switch (op) {
+	case JUMP:
+	case IFZ:
+	case IFNZ:
+		return 0;
+	case SH_IF_LOC_LT_IMM:
+	case SH_IF_LOC_GE_IMM:
+	case SH_IF_LOC_GT_IMM:
+	case SH_IF_LOC_NE_IMM:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Emit code for the instruction at ADDR. Returns the number of instructions
+ * consumed (more than one if a sequence was fused).
+ */
+static int compile_instruction(struct jit_state *s, uint32_t addr)
+{
+	struct jit_buffer *b = &s->b;
+	uint16_t opcode = code_opcode(addr);
+	uint32_t next = addr + instruction_width(opcode & ~OPTYPE_MASK);
+
+	// breakpoints are always handled by the interpreter
+	if (opcode & OPTYPE_MASK) {
+		emit_exit(s, addr);
+		return 1;
+	}
+
+	switch ((enum opcode)opcode) {
+	case FUNC:
+		break;
+	case PUSH:
+	case F_PUSH:
+		emit_store_slot_imm(b, -1, code_arg(addr, 0));
+		emit_adjust_sp(b, 1);
+		break;
+	case POP:
+		emit_adjust_sp(b, -1);
+		break;
+	case DUP:
+		emit_load_slot64(b, REG_RAX, 0);
+		emit_store_slot64(b, REG_RAX, -1);
+		emit_adjust_sp(b, 1);
+		break;
+	case DUP2:
+		emit_load_slot64(b, REG_RAX, 1);
+		emit_load_slot64(b, REG_RCX, 0);
+		emit_store_slot64(b, REG_RAX, -1);
+		emit_store_slot64(b, REG_RCX, -2);
+		emit_adjust_sp(b, 2);
+		break;
+	case DUP_U2:
+		emit_load_slot64(b, REG_RAX, 1);
+		emit_store_slot64(b, REG_RAX, -1);
+		emit_adjust_sp(b, 1);
+		break;
+	case SWAP:
+		emit_load_slot64(b, REG_RAX, 1);
+		emit_load_slot64(b, REG_RCX, 0);
+		emit_store_slot64(b, REG_RCX, 1);
+		emit_store_slot64(b, REG_RAX, 0);
+		break;
+	case PUSHGLOBALPAGE:
+		emit_store_slot_imm(b, -1, 0);
+		emit_adjust_sp(b, 1);
+		break;
+	case PUSHLOCALPAGE: {
+		// PUSHLOCALPAGE; PUSH n; {REF,INC,DEC} -> direct local variable access.
+		// The page index is checked against the function's local count here,
+		// since it isn't checked at runtime.
+		int32_t varno = can_fuse(s, next, PUSH) ? code_arg(next, 0) : -1;
+		uint32_t third = next + instruction_width(PUSH);
+		if (varno >= 0 && varno < ain->functions[s->f->fno].nr_vars) {
+			if (can_fuse(s, third, REF)) {
+				emit_local_op(b, 0x8B, REG_RAX, varno); // mov eax, [local]
+				emit_store_slot32(b, REG_RAX, -1);
+				emit_adjust_sp(b, 1);
+				return 3;
+			}
+			if (can_fuse(s, third, INC)) {
+				emit_local_op(b, 0xFF, 0, varno);       // inc dword [local]
+				return 3;
+			}
+			if (can_fuse(s, third, DEC)) {
+				emit_local_op(b, 0xFF, 1, varno);       // dec dword [local]
+				return 3;
+			}
+		}
+		// mov [slot], r14d
+		emit_bytes(b, 2, 0x46, 0x89);
+		emit_slot_modrm(b, 6, -1);
+		emit_adjust_sp(b, 1);
+		break;
+	}
+	case SH_LOCALREF:
+		emit_local_op(b, 0x8B, REG_RAX, code_arg(addr, 0));
+		emit_store_slot32(b, REG_RAX, -1);
+		emit_adjust_sp(b, 1);
+		break;
+	case SH_LOCALASSIGN:
+		emit_local_op(b, 0xC7, 0, code_arg(addr, 0));   // mov dword [local], imm32
+		emit_dword(b, code_arg(addr, 1));
+		break;
+	case SH_LOCALINC:
+		emit_local_op(b, 0xFF, 0, code_arg(addr, 0));
+		break;
+	case SH_LOCALDEC:
+		emit_local_op(b, 0xFF, 1, code_arg(addr, 0));
+		break;
+	case SH_LOCALASSIGN_SUB_IMM:
+		emit_local_op(b, 0x81, 5, code_arg(addr, 0));   // sub dword [local], imm32
+		emit_dword(b, code_arg(addr, 1));
+		break;
+	case ADD:
+	case SUB:
+	case MUL:
+	case AND:
+	case OR:
+	case XOR:
+	case LSHIFT:
+	case RSHIFT:
+		emit_binop(b, opcode);
+		break;
+	case LT:
+	case GT:
+	case LTE:
+	case GTE:
+	case NOTE:
+	case EQUALE: {
+		int cc = comparison_cc(opcode);
+		// compare followed by a conditional branch
+		if (can_fuse(s, next, IFZ) || can_fuse(s, next, IFNZ)) {
+			bool ifz = code_opcode(next) == IFZ;
+			uint32_t target = code_arg(next, 0);
+			if (in_function(s, target)) {
+				emit_compare(b);
+				emit_branch(s, ifz ? cc ^ 1 : cc, target);
+				return 2;
+			}
+		}
+		emit_compare(b);
+		emit_setcc(b, cc);
+		emit_store_slot32(b, REG_RAX, -1);
+		emit_adjust_sp(b, 1);
+		break;
+	}
+	case INV:
+		emit_load_slot32(b, REG_RAX, 0);
+		emit_bytes(b, 2, 0xF7, 0xD8); // neg eax
+		emit_store_slot32(b, REG_RAX, 0);
+		break;
+	case COMPL:
+		emit_load_slot32(b, REG_RAX, 0);
+		emit_bytes(b, 2, 0xF7, 0xD0); // not eax
+		emit_store_slot32(b, REG_RAX, 0);
+		break;
+	case NOT:
+	case ITOB:
+		emit_load_slot32(b, REG_RAX, 0);
+		emit_bytes(b, 2, 0x85, 0xC0); // test eax, eax
+		emit_setcc(b, opcode == NOT ? CC_E : CC_NE);
+		emit_store_slot32(b, REG_RAX, 0);
+		break;
+	case JUMP:
+	case IFZ:
+	case IFNZ:
+	case SH_IF_LOC_LT_IMM:
+	case SH_IF_LOC_GE_IMM:
+	case SH_IF_LOC_GT_IMM:
+	case SH_IF_LOC_NE_IMM: {
+		uint32_t target = code_arg(addr, branch_argument(opcode));
+		if (!in_function(s, target)) {
+			emit_interpreted(s, addr, next);
+			break;
+		}
+		int cc;
+		if (opcode == JUMP) {
+			cc = -1;
+		} else if (opcode == IFZ || opcode == IFNZ) {
+			emit_load_slot32(b, REG_RAX, 0);
+			emit_adjust_sp(b, -1);
+			emit_bytes(b, 2, 0x85, 0xC0); // test eax, eax
+			cc = opcode == IFZ ? CC_E : CC_NE;
+		} else {
+			emit_local_op(b, 0x81, 7, code_arg(addr, 0)); // cmp dword [local], imm32
+			emit_dword(b, code_arg(addr, 1));
+			cc = opcode == SH_IF_LOC_LT_IMM ? CC_L
+				: opcode == SH_IF_LOC_GE_IMM ? CC_GE
+				: opcode == SH_IF_LOC_GT_IMM ? CC_G
+				: CC_NE;
+		}
+		emit_branch(s, cc, target);
+		break;
+	}
+	default:
+		emit_interpreted(s, addr, next);
+		break;
+	}
+	return 1;
+}
+
+static void mark_branch_targets(struct jit_state *s)
+{
+	uint32_t addr = s->f->start;
+	while (addr < s->f->end) {
+		enum opcode op = code_opcode(addr) & ~OPTYPE_MASK;
+		int arg = branch_argument(op);
+		if (arg >= 0) {
+			uint32_t target = code_arg(addr, arg);
+			if (in_function(s, target))
+				s->is_target[(target - s->f->start) / 2] = true;
+		}
+		addr += instruction_width(op);
+	}
+}
+
+static uint8_t *alloc_code(size_t size)
+{
+	uint8_t *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static bool finish_code(struct jit_buffer *b, uint8_t **code_out, size_t *size_out)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t size = (b->len + page_size - 1) & ~(page_size - 1);
+	uint8_t *code = alloc_code(size);
+	if (!code)
+		return false;
+	memcpy(code, b->buf, b->len);
+	if (mprotect(code, size, PROT_READ | PROT_EXEC)) {
+		munmap(code, size);
+		return false;
+	}
+	*code_out = code;
+	*size_out = size;
+	return true;
+}
+
+/*
+ * The trampoline saves callee-saved registers, loads the canonical register
+ * state and calls into compiled code. Compiled code exits with `ret`.
+ */
+static bool init_trampoline(void)
+{
+	struct jit_buffer b = {0};
+	emit_byte(&b, 0x55);                   // push rbp
+	emit_byte(&b, 0x53);                   // push rbx
+	emit_bytes(&b, 2, 0x41, 0x54);         // push r12
+	emit_bytes(&b, 2, 0x41, 0x55);         // push r13
+	emit_bytes(&b, 2, 0x41, 0x56);         // push r14
+	emit_bytes(&b, 4, 0x48, 0x83, 0xEC, 0x08); // sub rsp, 8
+	emit_mov_rax_imm64(&b, (uintptr_t)&stack);
+	emit_bytes(&b, 3, 0x48, 0x8B, 0x18);   // mov rbx, [rax]
+	emit_load_stack_ptr(&b);
+	emit_bytes(&b, 3, 0x49, 0x89, 0xF5);   // mov r13, rsi
+	emit_bytes(&b, 3, 0x4C, 0x63, 0xF2);   // movsxd r14, edx
+	emit_bytes(&b, 2, 0xFF, 0xD7);         // call rdi
+	emit_bytes(&b, 4, 0x48, 0x83, 0xC4, 0x08); // add rsp, 8
+	emit_bytes(&b, 2, 0x41, 0x5E);         // pop r14
+	emit_bytes(&b, 2, 0x41, 0x5D);         // pop r13
+	emit_bytes(&b, 2, 0x41, 0x5C);         // pop r12
+	emit_byte(&b, 0x5B);                   // pop rbx
+	emit_byte(&b, 0x5D);                   // pop rbp
+	emit_byte(&b, 0xC3);                   // ret
+
+	uint8_t *code;
+	size_t size;
+	bool ok = finish_code(&b, &code, &size);
+	free(b.buf);
+	if (ok)
+		jit_trampoline = (jit_trampoline_fn)(uintptr_t)code;
+	return ok;
+}
+
+struct jit_function *jit_compile(int fno, uint32_t start, uint32_t end)
+{
+	if (!jit_trampoline && !init_trampoline()) {
+		WARNING("Failed to allocate executable memory for JIT");
+		return NULL;
+	}
+
+	struct jit_function *f = xcalloc(1, sizeof(struct jit_function));
+	f->fno = fno;
+	f->start = start;
+	f->end = end;
+
+	size_t nr_slots = (end - start) / 2 + 1;
+	struct jit_state s = {
+		.f = f,
+		.label = xmalloc(nr_slots * sizeof(uint32_t)),
+		.is_target = xcalloc(nr_slots, sizeof(bool)),
+	};
+	f->entry = xmalloc(nr_slots * sizeof(uint32_t));
+	memset(s.label, 0xFF, nr_slots * sizeof(uint32_t));
+	memset(f->entry, 0xFF, nr_slots * sizeof(uint32_t));
+
+	mark_branch_targets(&s);
+
+	// shared exit paths
+	s.exit_sync = s.b.len;
+	emit_store_stack_ptr(&s.b);
+	emit_byte(&s.b, 0xC3); // ret
+	s.exit_nosync = s.b.len;
+	emit_byte(&s.b, 0xC3); // ret
+
+	uint32_t addr = start;
+	while (addr < end) {
+		uint32_t i = (addr - start) / 2;
+		s.label[i] = s.b.len;
+		if (!(code_opcode(addr) & OPTYPE_MASK))
+			f->entry[i] = s.b.len;
+		int n = compile_instruction(&s, addr);
+		for (int k = 0; k < n; k++) {
+			addr += instruction_width(code_opcode(addr) & ~OPTYPE_MASK);
+		}
+	}
+	// falling off the end of the compiled range
+	s.label[(end - start) / 2] = s.b.len;
+	emit_exit(&s, end);
+
+	// resolve branches
+	for (unsigned i = 0; i < s.nr_fixups; i++) {
+		uint32_t target = s.label[(s.fixups[i].target - start) / 2];
+		if (target == NO_OFFSET) {
+			// target is in the middle of a fused sequence; exit to the
+			// interpreter instead
+			size_t stub = s.b.len;
+			emit_exit(&s, s.fixups[i].target);
+			target = stub;
+		}
+		patch_dword(&s.b, s.fixups[i].pos, target - (s.fixups[i].pos + 4));
+	}
+
+	bool ok = finish_code(&s.b, &f->code, &f->code_size);
+	free(s.b.buf);
+	free(s.label);
+	free(s.is_target);
+	free(s.fixups);
+	if (!ok) {
+		WARNING("Failed to allocate executable memory for JIT");
+		free(f->entry);
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+
+void *jit_entry_point(struct jit_function *f, uint32_t addr)
+{
+	if (addr < f->start || addr >= f->end || (addr & 1))
+		return NULL;
+	uint32_t off = f->entry[(addr - f->start) / 2];
+	return off == NO_OFFSET ? NULL : f->code + off;
+}
+
+static void free_function(struct jit_function *f)
+{
+	munmap(f->code, f->code_size);
+	free(f->entry);
+	free(f);
+}
+
+static void free_retired(void)
+{
+	while (jit_retired) {
+		struct jit_function *f = jit_retired;
+		jit_retired = f->next;
+		free_function(f);
+	}
+}
+
+void jit_free(struct jit_function *f)
+{
+	// Any compiled function may be on the C stack (e.g. when a breakpoint
+	// is set from within a nested vm_call), so wait until it is unwound.
+	if (jit_depth > 0) {
+		f->next = jit_retired;
+		jit_retired = f;
+		return;
+	}
+	free_function(f);
+}
+
+void jit_reset_stack(void)
+{
+	jit_depth = 0;
+	free_retired();
+}
+
+void jit_enter(void *entry)
+{
+	int32_t slot = call_stack[call_stack_ptr-1].page_slot;
+	jit_depth++;
+	jit_trampoline(entry, heap[slot].page->values, slot);
+	if (--jit_depth == 0)
+		free_retired();
+}
+
+#endif /* VM_JIT */
@@ -14,16 +14,35 @@
  * along with this program; if not, see <http://gnu.org/licenses/>.
  */
 
+#include <stdint.h>
 #include <string.h>
 #include "system4.h"
 #include "system4/ain.h"
+#include "system4/instructions.h"
+#include "system4/little_endian.h"
 #include "system4/string.h"
 #include "vm.h"
 #include "vm/heap.h"
 #include "vm/page.h"
 
-#define NR_CACHES 8
-#define CACHE_SIZE 64
+#if UINTPTR_MAX == UINT64_MAX && defined(__SSE2__)
+#define HAVE_SSE2_FIND
+#include <emmintrin.h>
+#elif UINTPTR_MAX == UINT64_MAX && (defined(__ARM_NEON) || defined(__aarch64__))
+#define HAVE_NEON_FIND
+#include <arm_neon.h>
+#endif
+
+/*
+ * Pages are allocated in size classes: one per size up to 8 values, then
+ * four per power of two up to PAGE_CLASS_MAX_VARS. Freed pages are kept on
+ * per-class free lists (linked through values[0]), and resized arrays stay
+ * in their allocation while they fit, so that pushing to an array only
+ * reallocates when it outgrows its size class.
+ */
+#define NR_PAGE_CLASSES 28
+#define PAGE_CLASS_MAX_VARS 256
+#define PAGE_CACHE_MAX_BYTES (8 * 1024 * 1024)
 
 static const char *pagetype_strtab[] = {
 	[GLOBAL_PAGE] = "GLOBAL_PAGE",
@@ -40,32 +59,102 @@ const char *pagetype_string(enum page_type type)
 	return "INVALID PAGE TYPE";
 }
 
-struct page_cache {
-	unsigned int cached;
-	struct page *pages[CACHE_SIZE];
-};
+static struct page *page_free_list[NR_PAGE_CLASSES];
+
+static size_t page_bytes(int capacity)
+{
+	return sizeof(struct page) + sizeof(union vm_value) * capacity;
+}
 
-struct page_cache page_cache[NR_CACHES];
+// Get the smallest size class which fits N values.
+static int page_class(int n)
+{
+	if (n <= 8)
+		return max(n, 1) - 1;
+	int k = 31 - __builtin_clz(n - 1);
+	int sub = (n - 1) >> (k - 2);
+	return 8 + (k - 3) * 4 + (sub - 4);
+}
 
-struct page *_alloc_page(int nr_vars)
+static int page_class_capacity(int c)
 {
-	int cache_nr = nr_vars - 1;
-	if (cache_nr >= 0 && cache_nr < NR_CACHES && page_cache[cache_nr].cached) {
-		struct page *page = page_cache[cache_nr].pages[--page_cache[cache_nr].cached];
-		memset(page->values, 0, sizeof(union vm_value) * nr_vars);
+	if (c < 8)
+		return c + 1;
+	int k = (c - 8) / 4 + 3;
+	int sub = (c - 8) % 4 + 4;
+	return (sub + 1) << (k - 2);
+}
+
+static struct page *_alloc_page(int nr_vars)
+{
+	heap_stats.page_allocs++;
+	if (nr_vars > PAGE_CLASS_MAX_VARS) {
+		struct page *page = xcalloc(1, page_bytes(nr_vars));
+		page->capacity = nr_vars;
+		heap_stats.page_mallocs++;
+		heap_stats.page_bytes += page_bytes(nr_vars);
 		return page;
 	}
-	return xcalloc(1, sizeof(struct page) + sizeof(union vm_value) * nr_vars);
+
+	int c = page_class(nr_vars);
+	int capacity = page_class_capacity(c);
+	struct page *page = page_free_list[c];
+	if (page) {
+		page_free_list[c] = page->values[0].ref;
+		memset(page, 0, page_bytes(nr_vars));
+		heap_stats.cached_pages--;
+		heap_stats.cached_bytes -= page_bytes(capacity);
+	} else {
+		page = xcalloc(1, page_bytes(capacity));
+		heap_stats.page_mallocs++;
+	}
+	page->capacity = capacity;
+	heap_stats.page_bytes += page_bytes(capacity);
+	return page;
 }
 
 void free_page(struct page *page)
 {
-	int cache_no = page->nr_vars - 1;
-	if (cache_no < 0 || cache_no >= NR_CACHES || page_cache[cache_no].cached >= CACHE_SIZE) {
+	size_t bytes = page_bytes(page->capacity);
+	heap_stats.page_frees++;
+	heap_stats.page_bytes -= bytes;
+	if (page->capacity > PAGE_CLASS_MAX_VARS
+			|| heap_stats.cached_bytes + bytes > PAGE_CACHE_MAX_BYTES) {
 		free(page);
 		return;
 	}
-	page_cache[cache_no].pages[page_cache[cache_no].cached++] = page;
+	// capacity is always a class size here
+	int c = page_class(page->capacity);
+	page->values[0].ref = page_free_list[c];
+	page_free_list[c] = page;
+	heap_stats.cached_pages++;
+	heap_stats.cached_bytes += bytes;
+}
+
+/*
+ * Resize PAGE to hold NR_VARS values (without changing page->nr_vars). The
+ * allocation is kept if it is large enough and not more than twice the
+ * required size.
+ */
+static struct page *page_resize(struct page *page, int nr_vars)
+{
+	if (nr_vars <= page->capacity && nr_vars >= page->capacity / 2)
+		return page;
+
+	int capacity;
+	if (nr_vars <= PAGE_CLASS_MAX_VARS)
+		capacity = page_class_capacity(page_class(nr_vars));
+	else if (nr_vars > page->capacity)
+		capacity = max(nr_vars, page->capacity + page->capacity / 2);
+	else
+		capacity = nr_vars;
+
+	heap_stats.page_bytes -= page_bytes(page->capacity);
+	heap_stats.page_bytes += page_bytes(capacity);
+	heap_stats.page_mallocs++;
+	page = xrealloc(page, page_bytes(capacity));
+	page->capacity = capacity;
+	return page;
 }
 
 struct page *alloc_page(enum page_type type, int type_index, int nr_vars)
@@ -337,7 +426,7 @@ struct page *realloc_array(struct page *src, int rank, union vm_value *dimension
 		}
 	}
 
-	src = xrealloc(src, sizeof(struct page) + sizeof(union vm_value) * dimensions->i);
+	src = page_resize(src, dimensions->i);
 
 	// if growing array, init new children
 	enum ain_data_type type = array_type(data_type);
@@ -486,7 +575,7 @@ struct page *array_erase(struct page *page, int i, bool *success)
 		page->values[j-1] = page->values[j];
 	}
 	page->nr_vars--;
-	page = xrealloc(page, sizeof(struct page) + sizeof(union vm_value) * page->nr_vars);
+	page = page_resize(page, page->nr_vars);
 
 	*success = true;
 	return page;
@@ -509,7 +598,7 @@ struct page *array_insert(struct page *page, int i, union vm_value v, enum ain_d
 		i = 0;
 
 	page->nr_vars++;
-	page = xrealloc(page, sizeof(struct page) + sizeof(union vm_value) * page->nr_vars);
+	page = page_resize(page, page->nr_vars);
 	for (int j = page->nr_vars - 1; j > i; j--) {
 		page->values[j] = page->values[j-1];
 	}
@@ -517,55 +606,235 @@ struct page *array_insert(struct page *page, int i, union vm_value v, enum ain_d
 	return page;
 }
 
-static int array_compare_int(const void *_a, const void *_b)
+/*
+ * Arrays are sorted with a stable merge sort over (key, value) pairs. Keys
+ * are extracted once up front, so e.g. sorting by struct member doesn't
+ * resolve the member on every comparison.
+ */
+struct sort_entry {
+	union {
+		int32_t i;
+		float f;
+		const char *s;
+	} key;
+	union vm_value v;
+};
+
+typedef int (*sort_compare_fn)(const struct sort_entry *a, const struct sort_entry *b);
+
+#define INSERTION_SORT_MAX 16
+
+static void insertion_sort(struct sort_entry *a, int n, sort_compare_fn cmp)
 {
-	union vm_value a = *((union vm_value*)_a);
-	union vm_value b = *((union vm_value*)_b);
-	return (a.i > b.i) - (a.i < b.i);
+	for (int i = 1; i < n; i++) {
+		struct sort_entry e = a[i];
+		int j = i;
+		for (; j > 0 && cmp(&a[j-1], &e) > 0; j--) {
+			a[j] = a[j-1];
+		}
+		a[j] = e;
+	}
 }
 
-static int array_compare_float(const void *_a, const void *_b)
+static void merge_sort(struct sort_entry *a, struct sort_entry *tmp, int n, sort_compare_fn cmp)
 {
-	union vm_value a = *((union vm_value*)_a);
-	union vm_value b = *((union vm_value*)_b);
-	return (a.f > b.f) - (a.f < b.f);
+	if (n <= INSERTION_SORT_MAX) {
+		insertion_sort(a, n, cmp);
+		return;
+	}
+
+	int mid = n / 2;
+	merge_sort(a, tmp, mid, cmp);
+	merge_sort(a + mid, tmp, n - mid, cmp);
+	// already in order
+	if (cmp(&a[mid-1], &a[mid]) <= 0)
+		return;
+
+	memcpy(tmp, a, mid * sizeof(struct sort_entry));
+	int i = 0, j = mid, k = 0;
+	while (i < mid && j < n) {
+		if (cmp(&a[j], &tmp[i]) < 0)
+			a[k++] = a[j++];
+		else
+			a[k++] = tmp[i++];
+	}
+	while (i < mid)
+		a[k++] = tmp[i++];
 }
 
-static int array_compare_string(const void *_a, const void *_b)
+static void sort_entries(struct page *page, struct sort_entry *entries, sort_compare_fn cmp)
 {
-	union vm_value a = *((union vm_value*)_a);
-	union vm_value b = *((union vm_value*)_b);
-	return strcmp(heap_get_string(a.i)->text, heap_get_string(b.i)->text);
+	struct sort_entry *tmp = xmalloc((page->nr_vars / 2 + 1) * sizeof(struct sort_entry));
+	merge_sort(entries, tmp, page->nr_vars, cmp);
+	free(tmp);
+	for (int i = 0; i < page->nr_vars; i++) {
+		page->values[i] = entries[i].v;
+	}
+	free(entries);
 }
 
-// Used for stable sorting arrays with qsort()
-struct sortable {
-	union vm_value v;
-	int index;
-};
+static int sort_compare_int(const struct sort_entry *a, const struct sort_entry *b)
+{
+	return (a->key.i > b->key.i) - (a->key.i < b->key.i);
+}
+
+static int sort_compare_float(const struct sort_entry *a, const struct sort_entry *b)
+{
+	return (a->key.f > b->key.f) - (a->key.f < b->key.f);
+}
+
+static int sort_compare_string(const struct sort_entry *a, const struct sort_entry *b)
+{
+	return strcmp(a->key.s, b->key.s);
+}
+
+// Native versions of the comparators `return a - b` and `return b - a`.
+static int sort_compare_sub(const struct sort_entry *a, const struct sort_entry *b)
+{
+	return (int32_t)((uint32_t)a->key.i - (uint32_t)b->key.i);
+}
+
+static int sort_compare_sub_reverse(const struct sort_entry *a, const struct sort_entry *b)
+{
+	return (int32_t)((uint32_t)b->key.i - (uint32_t)a->key.i);
+}
 
 static int current_sort_function;
 
-static int array_compare_custom(const void *_a, const void *_b)
+static int sort_compare_custom(const struct sort_entry *a, const struct sort_entry *b)
 {
-	const struct sortable *a = _a;
-	const struct sortable *b = _b;
 	stack_push(a->v);
 	stack_push(b->v);
 	vm_call(current_sort_function, -1);
-	int d = stack_pop().i;
-	return d ? d : a->index - b->index;
+	return stack_pop().i;
 }
 
-static int array_compare_custom_string(const void *_a, const void *_b)
+static int sort_compare_custom_string(const struct sort_entry *a, const struct sort_entry *b)
 {
-	const struct sortable *a = _a;
-	const struct sortable *b = _b;
 	stack_push(vm_string_ref(heap_get_string(a->v.i)));
 	stack_push(vm_string_ref(heap_get_string(b->v.i)));
 	vm_call(current_sort_function, -1);
-	int d = stack_pop().i;
-	return d ? d : a->index - b->index;
+	return stack_pop().i;
+}
+
+/*
+ * Recognize comparator functions of the form
+ *
+ *     int f(int a, int b) { return a - b; }
+ *     int f(ref S a, ref S b) { return a.m - b.m; }
+ *
+ * (or with a and b swapped), which can be evaluated without calling into
+ * the VM. On success, *MEMBER is set to the member number (or -1) and
+ * *REVERSE is set if the operands are swapped.
+ */
+struct comparator_operand {
+	int varno;
+	int member;
+};
+
+static bool code_match(uint32_t addr, enum opcode op)
+{
+	if (addr + instruction_width(op) > ain->code_size)
+		return false;
+	return LittleEndian_getW(ain->code, addr) == op;
+}
+
+static int32_t code_arg(uint32_t addr, int n)
+{
+	return LittleEndian_getDW(ain->code, addr + 2 + n*4);
+}
+
+static bool match_comparator_operand(uint32_t *addr, struct comparator_operand *o)
+{
+	// SH_LOCALREF n | PUSHLOCALPAGE; PUSH n; REF
+	if (code_match(*addr, SH_LOCALREF)) {
+		o->varno = code_arg(*addr, 0);
+		*addr += instruction_width(SH_LOCALREF);
+	} else if (code_match(*addr, PUSHLOCALPAGE)) {
+		*addr += instruction_width(PUSHLOCALPAGE);
+		if (!code_match(*addr, PUSH))
+			return false;
+		o->varno = code_arg(*addr, 0);
+		*addr += instruction_width(PUSH);
+		if (!code_match(*addr, REF))
+			return false;
+		*addr += instruction_width(REF);
+	} else {
+		return false;
+	}
+
+	// optional member access: PUSH m; REF
+	o->member = -1;
+	if (code_match(*addr, PUSH)) {
+		o->member = code_arg(*addr, 0);
+		*addr += instruction_width(PUSH);
+		if (!code_match(*addr, REF))
+			return false;
+		*addr += instruction_width(REF);
+	}
+	return true;
+}
+
+static bool match_sub_comparator(int fno, int *member, bool *reverse)
+{
+	if (fno <= 0 || fno >= ain->nr_functions)
+		return false;
+	struct ain_function *f = &ain->functions[fno];
+	if (f->nr_args != 2 || f->nr_vars != 2)
+		return false;
+
+	uint32_t addr = f->address;
+	struct comparator_operand a, b;
+	if (!match_comparator_operand(&addr, &a) || !match_comparator_operand(&addr, &b))
+		return false;
+	if (!code_match(addr, SUB))
+		return false;
+	addr += instruction_width(SUB);
+	if (!code_match(addr, RETURN))
+		return false;
+
+	if (a.member != b.member)
+		return false;
+	if (a.varno == 0 && b.varno == 1)
+		*reverse = false;
+	else if (a.varno == 1 && b.varno == 0)
+		*reverse = true;
+	else
+		return false;
+	*member = a.member;
+	return true;
+}
+
+// Try to sort PAGE with a native version of the comparator COMPARE_FNO.
+static bool array_sort_native(struct page *page, int compare_fno)
+{
+	int member;
+	bool reverse;
+	if (!match_sub_comparator(compare_fno, &member, &reverse))
+		return false;
+
+	enum ain_data_type type = array_type(page->a_type);
+	if (member < 0) {
+		if (type != AIN_INT)
+			return false;
+	} else {
+		if (type != AIN_STRUCT)
+			return false;
+		struct ain_struct *s = &ain->structures[page->array.struct_type];
+		if (member >= s->nr_members || s->members[member].type.data != AIN_INT)
+			return false;
+	}
+
+	struct sort_entry *entries = xmalloc(page->nr_vars * sizeof(struct sort_entry));
+	for (int i = 0; i < page->nr_vars; i++) {
+		entries[i].v = page->values[i];
+		if (member < 0)
+			entries[i].key.i = page->values[i].i;
+		else
+			entries[i].key.i = heap_get_page(page->values[i].i)->values[member].i;
+	}
+	sort_entries(page, entries, reverse ? sort_compare_sub_reverse : sort_compare_sub);
+	return true;
 }
 
 void array_sort(struct page *page, int compare_fno)
@@ -574,56 +843,48 @@ void array_sort(struct page *page, int compare_fno)
 		return;
 
 	if (compare_fno) {
-		struct sortable *values = xcalloc(page->nr_vars, sizeof(struct sortable));
+		if (array_sort_native(page, compare_fno))
+			return;
+		struct sort_entry *entries = xmalloc(page->nr_vars * sizeof(struct sort_entry));
 		for (int i = 0; i < page->nr_vars; i++) {
-			values[i].v = page->values[i];
-			values[i].index = i;
+			entries[i].v = page->values[i];
 		}
 		current_sort_function = compare_fno;
-		qsort(values, page->nr_vars, sizeof(struct sortable),
-			page->a_type == AIN_ARRAY_STRING ? array_compare_custom_string : array_compare_custom);
+		sort_entries(page, entries, page->a_type == AIN_ARRAY_STRING
+				? sort_compare_custom_string : sort_compare_custom);
+		return;
+	}
+
+	sort_compare_fn cmp;
+	struct sort_entry *entries = xmalloc(page->nr_vars * sizeof(struct sort_entry));
+	switch (page->a_type) {
+	case AIN_ARRAY_INT:
+	case AIN_ARRAY_LONG_INT:
 		for (int i = 0; i < page->nr_vars; i++) {
-			page->values[i] = values[i].v;
+			entries[i].key.i = page->values[i].i;
 		}
-		free(values);
-	} else {
-		switch (page->a_type) {
-		case AIN_ARRAY_INT:
-		case AIN_ARRAY_LONG_INT:
-			qsort(page->values, page->nr_vars, sizeof(union vm_value), array_compare_int);
-			break;
-		case AIN_ARRAY_FLOAT:
-			qsort(page->values, page->nr_vars, sizeof(union vm_value), array_compare_float);
-			break;
-		case AIN_ARRAY_STRING:
-			qsort(page->values, page->nr_vars, sizeof(union vm_value), array_compare_string);
-			break;
-		default:
-			VM_ERROR("A_SORT(&NULL) called on ain_data_type %d", page->a_type);
+		cmp = sort_compare_int;
+		break;
+	case AIN_ARRAY_FLOAT:
+		for (int i = 0; i < page->nr_vars; i++) {
+			entries[i].key.f = page->values[i].f;
+		}
+		cmp = sort_compare_float;
+		break;
+	case AIN_ARRAY_STRING:
+		for (int i = 0; i < page->nr_vars; i++) {
+			entries[i].key.s = heap_get_string(page->values[i].i)->text;
 		}
+		cmp = sort_compare_string;
+		break;
+	default:
+		free(entries);
+		VM_ERROR("A_SORT(&NULL) called on ain_data_type %d", page->a_type);
 	}
-}
-
-static int current_sort_member;
-
-static int array_compare_member(const void *_a, const void *_b)
-{
-	const struct sortable *a = _a;
-	const struct sortable *b = _b;
-	int32_t a_i = heap_get_page(a->v.i)->values[current_sort_member].i;
-	int32_t b_i = heap_get_page(b->v.i)->values[current_sort_member].i;
-	int d = (a_i > b_i) - (a_i < b_i);
-	return d ? d : a->index - b->index;
-}
-
-static int array_compare_member_string(const void *_a, const void *_b)
-{
-	const struct sortable *a = _a;
-	const struct sortable *b = _b;
-	int32_t a_i = heap_get_page(a->v.i)->values[current_sort_member].i;
-	int32_t b_i = heap_get_page(b->v.i)->values[current_sort_member].i;
-	int d = strcmp(heap_get_string(a_i)->text, heap_get_string(b_i)->text);
-	return d ? d : a->index - b->index;
+	for (int i = 0; i < page->nr_vars; i++) {
+		entries[i].v = page->values[i];
+	}
+	sort_entries(page, entries, cmp);
 }
 
 void array_sort_mem(struct page *page, int member_no)
@@ -637,20 +898,55 @@ void array_sort_mem(struct page *page, int member_no)
 	if (member_no < 0 || member_no >= s->nr_members)
 		VM_ERROR("A_SORT_MEM called with invalid member index");
 
-	struct sortable *values = xcalloc(page->nr_vars, sizeof(struct sortable));
+	bool is_string = s->members[member_no].type.data == AIN_STRING;
+	struct sort_entry *entries = xmalloc(page->nr_vars * sizeof(struct sort_entry));
 	for (int i = 0; i < page->nr_vars; i++) {
-		values[i].v = page->values[i];
-		values[i].index = i;
+		int32_t m = heap_get_page(page->values[i].i)->values[member_no].i;
+		entries[i].v = page->values[i];
+		if (is_string)
+			entries[i].key.s = heap_get_string(m)->text;
+		else
+			entries[i].key.i = m;
 	}
-	current_sort_member = member_no;
-	if (s->members[member_no].type.data == AIN_STRING)
-		qsort(values, page->nr_vars, sizeof(struct sortable), array_compare_member_string);
-	else
-		qsort(values, page->nr_vars, sizeof(struct sortable), array_compare_member);
-	for (int i = 0; i < page->nr_vars; i++) {
-		page->values[i] = values[i].v;
+	sort_entries(page, entries, is_string ? sort_compare_string : sort_compare_int);
+}
+
+/*
+ * Find the first int equal to X in VALUES[START..END). On 64-bit targets
+ * each vm_value is 8 bytes with the int in the low half, so the vector
+ * versions de-interleave pairs of values before comparing.
+ */
+static int find_int(const union vm_value *values, int start, int end, int32_t x)
+{
+	int i = start;
+#if defined(HAVE_SSE2_FIND)
+	const __m128i key = _mm_set1_epi32(x);
+	for (; i + 4 <= end; i += 4) {
+		__m128 lo = _mm_loadu_ps((const float*)&values[i]);
+		__m128 hi = _mm_loadu_ps((const float*)&values[i+2]);
+		__m128i v = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, key)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(HAVE_NEON_FIND)
+	const int32x4_t key = vdupq_n_s32(x);
+	for (; i + 4 <= end; i += 4) {
+		int32x4x2_t v = vld2q_s32((const int32_t*)&values[i]);
+		uint32x4_t eq = vceqq_s32(v.val[0], key);
+		if (vmaxvq_u32(eq)) {
+			for (;; i++) {
+				if (values[i].i == x)
+					return i;
+			}
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		if (values[i].i == x)
+			return i;
 	}
-	free(values);
+	return -1;
 }
 
 int array_find(struct page *page, int start, int end, union vm_value v, int compare_fno)
@@ -670,10 +966,7 @@ int array_find(struct page *page, int start, int end, union vm_value v, int comp
 					return i;
 			}
 		} else {
-			for (int i = start; i < end; i++) {
-				if (page->values[i].i == v.i)
-					return i;
-			}
+			return find_int(page->values, start, end, v.i);
 		}
 		return -1;
 	}
@@ -736,7 +1029,7 @@ struct page *delegate_append(struct page *dst, int obj, int fun)
 	if (delegate_contains(dst, obj, fun))
 		return dst;
 
-	dst = xrealloc(dst, sizeof(struct page) + sizeof(union vm_value) * (dst->nr_vars + 3));
+	dst = page_resize(dst, dst->nr_vars + 3);
 	dst->values[dst->nr_vars+0].i = obj;
 	dst->values[dst->nr_vars+1].i = fun;
 	dst->values[dst->nr_vars+2].i = heap_get_seq(obj);
@@ -347,7 +347,7 @@ bool parts_flat_load(struct parts *parts, struct parts_flat *f, struct string *f
 		struct flat_library *lib = &f->flat->libraries[i];
 		if (lib->type != FLAT_LIB_CG)
 			continue;
-		struct cg *cg = cg_load_buffer((uint8_t *)lib->cg.data, lib->cg.size);
+		struct cg *cg = asset_cg_decode_buffer((uint8_t *)lib->cg.data, lib->cg.size);
 		if (!cg) {
 			WARNING("flat: failed to load CG for library '%s'", lib->name->text);
 			continue;
@@ -0,0 +1,266 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "system4.h"
+
+#include "xsystem4.h"
+#include "parts_internal.h"
+
+/*
+ * Uniform grid over the (DEFAULT state) hitboxes of all parts, in the same
+ * coordinates used by parts_hittest. Each part is listed in every cell its
+ * hitbox overlaps; hitboxes extending past the edge of the grid are clamped
+ * to the edge cells, so lookups with the cursor outside of the view still
+ * find them.
+ *
+ * Updates are lazy: parts whose hitbox may have moved are queued with
+ * parts_hit_index_invalidate() and re-indexed at the next query.
+ *
+ * A query returns the parts in the cell containing the cursor together with
+ * the "active" parts (those hovered at the last update, or in a non-DEFAULT
+ * state), ordered front-to-back. Every other part would be a no-op for
+ * PE_UpdateInputState, so input handling only needs to visit this set.
+ */
+
+#define CELL_SHIFT 6
+
+struct hit_cell {
+	struct parts **parts;
+	unsigned n;
+	unsigned cap;
+};
+
+struct parts_array {
+	struct parts **parts;
+	unsigned n;
+	unsigned cap;
+};
+
+static struct hit_cell *grid = NULL;
+static int grid_w = 0;
+static int grid_h = 0;
+
+static struct parts_array dirty = {0};
+static struct parts_array active = {0};
+static struct parts_array candidates = {0};
+
+// true when list_index needs to be renumbered
+static bool list_dirty = true;
+static uint32_t query_mark = 0;
+
+static void array_push(struct parts_array *a, struct parts *parts)
+{
+	if (a->n >= a->cap) {
+		a->cap = a->cap ? a->cap * 2 : 64;
+		a->parts = xrealloc(a->parts, a->cap * sizeof(struct parts*));
+	}
+	a->parts[a->n++] = parts;
+}
+
+static void array_remove(struct parts_array *a, struct parts *parts)
+{
+	for (unsigned i = 0; i < a->n; i++) {
+		if (a->parts[i] == parts) {
+			a->parts[i] = a->parts[--a->n];
+			return;
+		}
+	}
+}
+
+static void grid_init(void)
+{
+	grid_w = max(1, (config.view_width + (1 << CELL_SHIFT) - 1) >> CELL_SHIFT);
+	grid_h = max(1, (config.view_height + (1 << CELL_SHIFT) - 1) >> CELL_SHIFT);
+	grid = xcalloc(grid_w * grid_h, sizeof(struct hit_cell));
+}
+
+static int cell_x(int x)
+{
+	return x < 0 ? 0 : min(x >> CELL_SHIFT, grid_w - 1);
+}
+
+static int cell_y(int y)
+{
+	return y < 0 ? 0 : min(y >> CELL_SHIFT, grid_h - 1);
+}
+
+static void cell_add(struct hit_cell *cell, struct parts *parts)
+{
+	if (cell->n >= cell->cap) {
+		cell->cap = cell->cap ? cell->cap * 2 : 8;
+		cell->parts = xrealloc(cell->parts, cell->cap * sizeof(struct parts*));
+	}
+	cell->parts[cell->n++] = parts;
+}
+
+static void cell_remove(struct hit_cell *cell, struct parts *parts)
+{
+	for (unsigned i = 0; i < cell->n; i++) {
+		if (cell->parts[i] == parts) {
+			cell->parts[i] = cell->parts[--cell->n];
+			return;
+		}
+	}
+}
+
+static void grid_remove(struct parts *parts)
+{
+	Rectangle *c = &parts->hit.cells;
+	for (int y = c->y; y < c->y + c->h; y++) {
+		for (int x = c->x; x < c->x + c->w; x++) {
+			cell_remove(&grid[y * grid_w + x], parts);
+		}
+	}
+	*c = (Rectangle) {0};
+}
+
+static void grid_add(struct parts *parts)
+{
+	Rectangle hitbox = parts->states[PARTS_STATE_DEFAULT].common.hitbox;
+	if (hitbox.w <= 0 || hitbox.h <= 0)
+		return;
+	if (parts->parent) {
+		hitbox.x += parts->parent->global.pos.x;
+		hitbox.y += parts->parent->global.pos.y;
+	}
+
+	int x0 = cell_x(hitbox.x);
+	int y0 = cell_y(hitbox.y);
+	int x1 = cell_x(hitbox.x + hitbox.w - 1);
+	int y1 = cell_y(hitbox.y + hitbox.h - 1);
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			cell_add(&grid[y * grid_w + x], parts);
+		}
+	}
+	parts->hit.cells = (Rectangle) { x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+}
+
+static void flush_dirty(void)
+{
+	if (!grid)
+		grid_init();
+	for (unsigned i = 0; i < dirty.n; i++) {
+		struct parts *parts = dirty.parts[i];
+		grid_remove(parts);
+		grid_add(parts);
+		parts->hit.dirty = false;
+	}
+	dirty.n = 0;
+}
+
+static void renumber_list(void)
+{
+	unsigned i = 0;
+	struct parts *parts;
+	PARTS_LIST_FOREACH(parts) {
+		parts->hit.list_index = i++;
+	}
+	list_dirty = false;
+}
+
+void parts_hit_index_invalidate(struct parts *parts)
+{
+	if (parts->hit.dirty)
+		return;
+	parts->hit.dirty = true;
+	array_push(&dirty, parts);
+}
+
+void parts_hit_index_set_active(struct parts *parts)
+{
+	if (parts->hit.active)
+		return;
+	parts->hit.active = true;
+	array_push(&active, parts);
+}
+
+void parts_hit_index_remove(struct parts *parts)
+{
+	if (grid)
+		grid_remove(parts);
+	if (parts->hit.dirty)
+		array_remove(&dirty, parts);
+	if (parts->hit.active)
+		array_remove(&active, parts);
+	array_remove(&candidates, parts);
+	parts->hit.dirty = false;
+	parts->hit.active = false;
+}
+
+void parts_hit_index_list_changed(void)
+{
+	list_dirty = true;
+}
+
+static void add_candidate(struct parts *parts)
+{
+	if (parts->hit.mark == query_mark)
+		return;
+	parts->hit.mark = query_mark;
+	array_push(&candidates, parts);
+}
+
+static int candidate_cmp(const void *_a, const void *_b)
+{
+	const struct parts *a = *(struct parts * const *)_a;
+	const struct parts *b = *(struct parts * const *)_b;
+	// front-to-back, i.e. reverse list order
+	return (a->hit.list_index < b->hit.list_index) - (a->hit.list_index > b->hit.list_index);
+}
+
+struct parts **parts_hit_index_query(Point pos, unsigned *nr_candidates)
+{
+	flush_dirty();
+	if (list_dirty)
+		renumber_list();
+
+	if (++query_mark == 0) {
+		// mark wrapped around; clear stale marks
+		struct parts *parts;
+		PARTS_LIST_FOREACH(parts) {
+			parts->hit.mark = 0;
+		}
+		query_mark = 1;
+	}
+
+	candidates.n = 0;
+	struct hit_cell *cell = &grid[cell_y(pos.y) * grid_w + cell_x(pos.x)];
+	for (unsigned i = 0; i < cell->n; i++) {
+		add_candidate(cell->parts[i]);
+	}
+	for (unsigned i = 0; i < active.n; i++) {
+		add_candidate(active.parts[i]);
+	}
+
+	qsort(candidates.parts, candidates.n, sizeof(struct parts*), candidate_cmp);
+	*nr_candidates = candidates.n;
+	return candidates.parts;
+}
+
+void parts_hit_index_update_active(struct parts **parts, unsigned nr_parts)
+{
+	for (unsigned i = 0; i < active.n; i++) {
+		active.parts[i]->hit.active = false;
+	}
+	active.n = 0;
+	for (unsigned i = 0; i < nr_parts; i++) {
+		if (parts[i]->is_hovered || parts[i]->state != PARTS_STATE_DEFAULT)
+			parts_hit_index_set_active(parts[i]);
+	}
+}
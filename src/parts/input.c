@@ -167,12 +167,16 @@ void PE_UpdateInputState(int passed_time)
 
 	bool hover_consumed = false;
 	bool click_consumed = false;
-	struct parts *parts;
-	// Iterate front-to-back (highest z first) for proper cursor consumption
-	PARTS_LIST_FOREACH_REVERSE(parts) {
-		parts_update_mouse(parts, cur_pos, cur_clicking, passed_time,
+	// Candidates are ordered front-to-back (highest z first) for proper cursor
+	// consumption. Parts not in this set are neither under the cursor nor
+	// previously hovered, so updating them would have no effect.
+	unsigned nr_candidates;
+	struct parts **candidates = parts_hit_index_query(cur_pos, &nr_candidates);
+	for (unsigned i = 0; i < nr_candidates; i++) {
+		parts_update_mouse(candidates[i], cur_pos, cur_clicking, passed_time,
 				&hover_consumed, &click_consumed);
 	}
+	parts_hit_index_update_active(candidates, nr_candidates);
 
 	// Drag movement processing
 	if (drag_parts && cur_clicking) {
@@ -195,7 +199,9 @@ void PE_UpdateInputState(int passed_time)
 		// Drop target tracking
 		if (cursor_moved && is_dragging) {
 			struct parts *new_drop = NULL;
-			PARTS_LIST_FOREACH_REVERSE(parts) {
+			candidates = parts_hit_index_query(cur_pos, &nr_candidates);
+			for (unsigned i = 0; i < nr_candidates; i++) {
+				struct parts *parts = candidates[i];
 				if (parts == drag_parts)
 					continue;
 				if (parts_hittest(parts, PARTS_STATE_DEFAULT, cur_pos)) {
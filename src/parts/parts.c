@@ -58,6 +58,7 @@ static void parts_init(struct parts *parts)
 	parts->sp.has_pixel = true;
 	parts->sp.has_alpha = true;
 	parts->sp.render = parts_sprite_render;
+	parts->sp.batchable = true;
 	parts->sp.to_json = parts_sprite_to_json;
 	parts->local = PARTS_PARAMS_INITIALIZER;
 	parts->global = PARTS_PARAMS_INITIALIZER;
@@ -126,6 +127,7 @@ static void parts_list_insert(struct parts *parts)
 	}
 	TAILQ_INSERT_TAIL(&parts_list, parts, parts_list_entry);
 done:
+	parts_hit_index_list_changed();
 	parts_engine_dirty();
 	scene_register_sprite(&parts->sp);
 }
@@ -134,6 +136,7 @@ static void parts_list_remove(struct parts *parts)
 {
 	TAILQ_REMOVE(&parts_list, parts, parts_list_entry);
 	scene_unregister_sprite(&parts->sp);
+	parts_hit_index_list_changed();
 }
 
 void parts_list_resort(struct parts *parts)
@@ -425,6 +428,8 @@ static void parts_common_recalculate_hitbox(struct parts *parts, struct parts_co
 			.h = common->h,
 		};
 	}
+	if (common == &parts->states[PARTS_STATE_DEFAULT].common)
+		parts_hit_index_invalidate(parts);
 }
 
 void parts_recalculate_hitbox(struct parts *parts)
@@ -440,6 +445,7 @@ static void parts_update_global_pos(struct parts *parts, Point parent_pos)
 		parent_pos.x + parts->local.pos.x,
 		parent_pos.y + parts->local.pos.y
 	};
+	parts_hit_index_invalidate(parts);
 
 	struct parts *child;
 	PARTS_FOREACH_CHILD(child, parts) {
@@ -701,7 +707,7 @@ bool parts_cg_set(struct parts *parts, struct parts_cg *parts_cg, struct string
 	struct cg *cg;
 	if (!memcmp(cg_name->text, "<save>", 6)) {
 		char *path = savedir_path(cg_name->text + 6);
-		cg = cg_load_file(path);
+		cg = asset_cg_decode_file(path);
 		no = 0;
 		free(path);
 	} else {
@@ -716,6 +722,9 @@ int parts_nr_numeral_fonts = 0;
 void parts_numeral_font_init(struct parts_numeral_font *font)
 {
 	if (font->type == PARTS_NUMERAL_FONT_SEPARATE) {
+		for (int i = 0; i < 12; i++) {
+			asset_cg_prefetch(font->cg_no + i);
+		}
 		for (int i = 0; i < 12; i++) {
 			struct cg *cg = asset_cg_load(font->cg_no + i);
 			if (!cg) {
@@ -726,6 +735,10 @@ void parts_numeral_font_init(struct parts_numeral_font *font)
 			cg_free(cg);
 		}
 	} else if (font->type == PARTS_NUMERAL_FONT_SEPARATE2) {
+		for (int i = 0; i < 12; i++) {
+			if (font->width[i] >= 0)
+				asset_cg_prefetch(font->width[i]);
+		}
 		for (int i = 0; i < 12; i++) {
 			if (font->width[i] < 0)
 				continue;
@@ -925,6 +938,8 @@ void parts_set_state(struct parts *parts, enum parts_state_type state)
 	if (parts->state != state) {
 		parts->state = state;
 		parts_dirty(parts);
+		if (state != PARTS_STATE_DEFAULT)
+			parts_hit_index_set_active(parts);
 	}
 }
 
@@ -1002,6 +1017,7 @@ void parts_release(int parts_no)
 		struct parts *child = TAILQ_FIRST(&parts->children);
 		TAILQ_REMOVE(&parts->children, child, child_list_entry);
 		child->parent = NULL;
+		parts_hit_index_invalidate(child);
 	}
 	if (parts->parent) {
 		TAILQ_REMOVE(&parts->parent->children, parts, child_list_entry);
@@ -1010,6 +1026,7 @@ void parts_release(int parts_no)
 
 	parts_list_remove(parts);
 	dirty_list_remove(parts);
+	parts_hit_index_remove(parts);
 	free(parts);
 	slot->value = NULL;
 	parts_engine_dirty();
@@ -1140,6 +1157,7 @@ void PE_UpdateComponent(possibly_unused int passed_time)
 			}
 			parts->parent = parent;
 			TAILQ_INSERT_TAIL(&parent->children, parts, child_list_entry);
+			parts_hit_index_invalidate(parts);
 
 			// if parent is layout box, mark it dirty so that it can re-layout its children
 			if (parent->states[0].type == PARTS_LAYOUT_BOX)
@@ -1247,7 +1265,7 @@ bool PE_SetPartsCG_by_string_index(int parts_no, struct string *cg_name,
 		return true;
 	} else if (!memcmp(cg_name->text, "<save>SaveData\\", 15)) {
 		char *path = savedir_path(cg_name->text + 15);
-		bool result = _parts_cg_set(parts, cg, cg_load_file(path), 0, string_ref(cg_name));
+		bool result = _parts_cg_set(parts, cg, asset_cg_decode_file(path), 0, string_ref(cg_name));
 		free(path);
 		return result;
 	} else {
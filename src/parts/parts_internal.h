@@ -435,6 +435,14 @@ struct parts {
 	int margin_right;
 	struct parts_motion_list motion;
 	int controller_no;
+	// hit test index state (see hit_index.c)
+	struct {
+		Rectangle cells;
+		unsigned list_index;
+		uint32_t mark;
+		bool dirty;
+		bool active;
+	} hit;
 };
 
 #define PARTS_LIST_FOREACH(iter) TAILQ_FOREACH(iter, &parts_list, parts_list_entry)
@@ -524,6 +532,14 @@ void parts_render_family(struct parts *parts);
 void parts_clear_motion(struct parts *parts);
 void parts_add_motion(struct parts *parts, struct parts_motion *motion);
 
+// hit_index.c
+void parts_hit_index_invalidate(struct parts *parts);
+void parts_hit_index_set_active(struct parts *parts);
+void parts_hit_index_remove(struct parts *parts);
+void parts_hit_index_list_changed(void);
+struct parts **parts_hit_index_query(Point pos, unsigned *nr_candidates);
+void parts_hit_index_update_active(struct parts **candidates, unsigned nr_candidates);
+
 // input.c
 extern bool parts_began_click;
 void parts_input_reset_drag(struct parts *parts);
@@ -646,7 +646,9 @@ void parts_engine_render(possibly_unused struct sprite *_)
 
 void parts_sprite_render(struct sprite *sp)
 {
+	gfx_pass_begin(GFX_PASS_PARTS);
 	parts_render((struct parts*)sp);
+	gfx_pass_end(GFX_PASS_PARTS);
 }
 
 static bool pe_dirty = false;
@@ -615,6 +615,8 @@ static void load_parts(struct iarray_reader *r, int version)
 	int no = iarray_read(r);
 	struct parts *parts = parts_get(no);
 	parts->state = iarray_read(r);
+	if (parts->state != PARTS_STATE_DEFAULT)
+		parts_hit_index_set_active(parts);
 	for (int i = 0; i < PARTS_NR_STATES; i++) {
 		load_parts_state(r, parts, &parts->states[i], version);
 	}
@@ -0,0 +1,368 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#define VM_PRIVATE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "system4.h"
+#include "system4/ain.h"
+#include "system4/instructions.h"
+#include "system4/little_endian.h"
+#include "system4/utfsjis.h"
+
+#include "profile.h"
+#include "vm.h"
+
+/*
+ * Sampling profiler.
+ *
+ * A background thread periodically takes a snapshot of the VM call stack,
+ * instr_ptr and the currently executing HLL function. The snapshot is taken
+ * without synchronizing with the VM thread; a sample may occasionally be
+ * inconsistent (e.g. taken in the middle of a call), but invalid frames are
+ * discarded, and this keeps the cost to the VM at zero.
+ */
+
+#define PROFILE_INTERVAL_MS 1
+#define MAX_FRAMES 256
+// frame ID for HLL functions (the leaf frame of a sample)
+#define HLL_FRAME 0x80000000
+
+struct profile_stack {
+	uint32_t hash;
+	uint32_t depth;
+	uint32_t *frames;
+	uint64_t count;
+};
+
+static struct {
+	char *path;
+	SDL_Thread *thread;
+	SDL_atomic_t running;
+	uint32_t start_time;
+	uint32_t end_time;
+	uint64_t nr_samples;
+	uint64_t nr_dropped;
+	// collapsed stacks (open addressing)
+	struct profile_stack *stacks;
+	uint32_t nr_stacks;
+	uint32_t stacks_size;
+	// per-function sample counts
+	uint64_t *self;
+	uint64_t *total;
+	uint64_t *last_sample; // for counting recursive functions once per sample
+	uint64_t opcodes[NR_OPCODES];
+} prof;
+
+volatile int32_t profile_current_hll = PROFILE_NO_HLL;
+
+static uint32_t hash_frames(uint32_t *frames, uint32_t depth)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < depth; i++) {
+		h ^= frames[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct profile_stack *lookup_stack(struct profile_stack *table, uint32_t size,
+		uint32_t hash, uint32_t *frames, uint32_t depth)
+{
+	uint32_t i = hash & (size - 1);
+	while (table[i].frames) {
+		if (table[i].hash == hash && table[i].depth == depth
+				&& !memcmp(table[i].frames, frames, depth * sizeof(uint32_t)))
+			break;
+		i = (i + 1) & (size - 1);
+	}
+	return &table[i];
+}
+
+static void grow_stacks(void)
+{
+	uint32_t new_size = prof.stacks_size ? prof.stacks_size * 2 : 1024;
+	struct profile_stack *table = xcalloc(new_size, sizeof(struct profile_stack));
+	for (uint32_t i = 0; i < prof.stacks_size; i++) {
+		struct profile_stack *s = &prof.stacks[i];
+		if (!s->frames)
+			continue;
+		*lookup_stack(table, new_size, s->hash, s->frames, s->depth) = *s;
+	}
+	free(prof.stacks);
+	prof.stacks = table;
+	prof.stacks_size = new_size;
+}
+
+static void record_stack(uint32_t *frames, uint32_t depth)
+{
+	if ((prof.nr_stacks + 1) * 4 >= prof.stacks_size * 3)
+		grow_stacks();
+
+	uint32_t hash = hash_frames(frames, depth);
+	struct profile_stack *s = lookup_stack(prof.stacks, prof.stacks_size, hash, frames, depth);
+	if (!s->frames) {
+		s->hash = hash;
+		s->depth = depth;
+		s->frames = xmalloc(max(depth, 1) * sizeof(uint32_t));
+		memcpy(s->frames, frames, depth * sizeof(uint32_t));
+		prof.nr_stacks++;
+	}
+	s->count++;
+}
+
+static void take_sample(void)
+{
+	uint32_t frames[MAX_FRAMES + 1];
+	uint32_t depth = 0;
+
+	int32_t csp = *(volatile int32_t*)&call_stack_ptr;
+	size_t ip = *(volatile size_t*)&instr_ptr;
+	int32_t hll = profile_current_hll;
+	if (csp <= 0 || csp > (int32_t)(sizeof(call_stack)/sizeof(*call_stack))) {
+		prof.nr_dropped++;
+		return;
+	}
+
+	// keep the innermost frames if the stack is too deep
+	int32_t bottom = csp > MAX_FRAMES ? csp - MAX_FRAMES : 0;
+	for (int32_t i = bottom; i < csp; i++) {
+		int32_t fno = ((volatile struct function_call*)call_stack)[i].fno;
+		if (fno < 0 || fno >= ain->nr_functions) {
+			prof.nr_dropped++;
+			return;
+		}
+		frames[depth++] = fno;
+	}
+	if (hll != PROFILE_NO_HLL)
+		frames[depth++] = HLL_FRAME | hll;
+
+	uint64_t sample = ++prof.nr_samples;
+	record_stack(frames, depth);
+
+	// per-function counts (time spent in HLL functions is not self time)
+	if (hll == PROFILE_NO_HLL)
+		prof.self[frames[csp - bottom - 1]]++;
+	for (uint32_t i = 0; i < (uint32_t)(csp - bottom); i++) {
+		if (prof.last_sample[frames[i]] != sample) {
+			prof.last_sample[frames[i]] = sample;
+			prof.total[frames[i]]++;
+		}
+	}
+
+	// per-opcode counts (HLL time is attributed to CALLHLL)
+	if (ip < ain->code_size) {
+		uint16_t op = LittleEndian_getW(ain->code, ip) & ~OPTYPE_MASK;
+		if (op < NR_OPCODES)
+			prof.opcodes[op]++;
+	}
+}
+
+static int profile_thread(void *data)
+{
+	while (SDL_AtomicGet(&prof.running)) {
+		SDL_Delay(PROFILE_INTERVAL_MS);
+		take_sample();
+	}
+	return 0;
+}
+
+//
+// --- Output ---
+//
+
+// Frame names must not contain ';' (the frame separator in collapsed stacks).
+static void print_name(FILE *out, const char *sjis)
+{
+	char *utf = sjis2utf(sjis, 0);
+	for (char *p = utf; *p; p++) {
+		fputc(*p == ';' ? ':' : *p, out);
+	}
+	free(utf);
+}
+
+static void print_frame(FILE *out, uint32_t frame)
+{
+	if (frame & HLL_FRAME) {
+		int libno = (frame >> 16) & 0x7FFF;
+		int fno = frame & 0xFFFF;
+		if (libno < ain->nr_libraries && fno < ain->libraries[libno].nr_functions) {
+			print_name(out, ain->libraries[libno].name);
+			fputc('.', out);
+			print_name(out, ain->libraries[libno].functions[fno].name);
+		} else {
+			fprintf(out, "HLL#%d.%d", libno, fno);
+		}
+	} else {
+		print_name(out, ain->functions[frame].name);
+	}
+}
+
+static void write_collapsed_stacks(void)
+{
+	FILE *out = fopen(prof.path, "w");
+	if (!out) {
+		WARNING("Failed to open profile output file: %s", prof.path);
+		return;
+	}
+	for (uint32_t i = 0; i < prof.stacks_size; i++) {
+		struct profile_stack *s = &prof.stacks[i];
+		if (!s->frames)
+			continue;
+		for (uint32_t j = 0; j < s->depth; j++) {
+			if (j)
+				fputc(';', out);
+			print_frame(out, s->frames[j]);
+		}
+		fprintf(out, " %llu\n", (unsigned long long)s->count);
+	}
+	fclose(out);
+}
+
+static uint64_t *sort_counts;
+
+static int count_cmp(const void *_a, const void *_b)
+{
+	uint64_t a = sort_counts[*(const int*)_a];
+	uint64_t b = sort_counts[*(const int*)_b];
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+// Get the indices of the N largest values in COUNTS, in descending order.
+static int top_n(uint64_t *counts, int nr_counts, int *out, int n)
+{
+	int *idx = xmalloc(nr_counts * sizeof(int));
+	for (int i = 0; i < nr_counts; i++) {
+		idx[i] = i;
+	}
+	sort_counts = counts;
+	qsort(idx, nr_counts, sizeof(int), count_cmp);
+	int i;
+	for (i = 0; i < n && i < nr_counts && counts[idx[i]]; i++) {
+		out[i] = idx[i];
+	}
+	free(idx);
+	return i;
+}
+
+static double percent(uint64_t n)
+{
+	return prof.nr_samples ? (100.0 * n) / prof.nr_samples : 0.0;
+}
+
+#define SUMMARY_ROWS 30
+
+static void print_summary(void)
+{
+	int top[SUMMARY_ROWS];
+	int n;
+
+	sys_message("Profile: %llu samples over %.2fs (%llu dropped), written to %s\n",
+			(unsigned long long)prof.nr_samples,
+			(prof.end_time - prof.start_time) / 1000.0,
+			(unsigned long long)prof.nr_dropped, prof.path);
+
+	sys_message("\n  self%%  total%%  function\n");
+	n = top_n(prof.self, ain->nr_functions, top, SUMMARY_ROWS);
+	for (int i = 0; i < n; i++) {
+		char *name = sjis2utf(ain->functions[top[i]].name, 0);
+		sys_message("%6.2f  %6.2f  %s\n", percent(prof.self[top[i]]),
+				percent(prof.total[top[i]]), name);
+		free(name);
+	}
+
+	// HLL functions are always leaf frames
+	int nr_hll = 0;
+	for (int i = 0; i < ain->nr_libraries; i++) {
+		nr_hll += ain->libraries[i].nr_functions;
+	}
+	if (nr_hll) {
+		uint64_t *hll_counts = xcalloc(nr_hll, sizeof(uint64_t));
+		int *hll_base = xmalloc(ain->nr_libraries * sizeof(int));
+		for (int i = 0, base = 0; i < ain->nr_libraries; i++) {
+			hll_base[i] = base;
+			base += ain->libraries[i].nr_functions;
+		}
+		for (uint32_t i = 0; i < prof.stacks_size; i++) {
+			struct profile_stack *s = &prof.stacks[i];
+			if (!s->frames || !(s->frames[s->depth-1] & HLL_FRAME))
+				continue;
+			int libno = (s->frames[s->depth-1] >> 16) & 0x7FFF;
+			int fno = s->frames[s->depth-1] & 0xFFFF;
+			if (libno < ain->nr_libraries && fno < ain->libraries[libno].nr_functions)
+				hll_counts[hll_base[libno] + fno] += s->count;
+		}
+		n = top_n(hll_counts, nr_hll, top, SUMMARY_ROWS);
+		if (n)
+			sys_message("\n  self%%  HLL function\n");
+		for (int i = 0; i < n; i++) {
+			int libno = 0;
+			while (libno + 1 < ain->nr_libraries && hll_base[libno+1] <= top[i])
+				libno++;
+			struct ain_library *lib = &ain->libraries[libno];
+			char *lib_name = sjis2utf(lib->name, 0);
+			char *fun_name = sjis2utf(lib->functions[top[i] - hll_base[libno]].name, 0);
+			sys_message("%6.2f  %s.%s\n", percent(hll_counts[top[i]]), lib_name, fun_name);
+			free(lib_name);
+			free(fun_name);
+		}
+		free(hll_counts);
+		free(hll_base);
+	}
+
+	sys_message("\n  self%%  opcode\n");
+	n = top_n(prof.opcodes, NR_OPCODES, top, SUMMARY_ROWS);
+	for (int i = 0; i < n; i++) {
+		sys_message("%6.2f  %s\n", percent(prof.opcodes[top[i]]), instructions[top[i]].name);
+	}
+}
+
+static void profile_stop(void)
+{
+	if (!prof.thread)
+		return;
+	SDL_AtomicSet(&prof.running, 0);
+	SDL_WaitThread(prof.thread, NULL);
+	prof.thread = NULL;
+	prof.end_time = SDL_GetTicks();
+
+	write_collapsed_stacks();
+	print_summary();
+}
+
+void profile_start(const char *path)
+{
+	prof.path = xstrdup(path);
+	prof.self = xcalloc(ain->nr_functions, sizeof(uint64_t));
+	prof.total = xcalloc(ain->nr_functions, sizeof(uint64_t));
+	prof.last_sample = xcalloc(ain->nr_functions, sizeof(uint64_t));
+	grow_stacks();
+
+	SDL_AtomicSet(&prof.running, 1);
+	prof.start_time = SDL_GetTicks();
+	prof.thread = SDL_CreateThread(profile_thread, "Profiler", NULL);
+	if (!prof.thread) {
+		WARNING("SDL_CreateThread failed: %s", SDL_GetError());
+		return;
+	}
+	// write the profile however the program exits (including errors)
+	atexit(profile_stop);
+}
@@ -0,0 +1,235 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+
+#include "system4.h"
+#include "system4/file.h"
+
+#include "replay.h"
+#include "vm.h"
+
+/*
+ * The log is a text file with one record per line: a single character
+ * giving the record type, followed by a space and the payload.
+ */
+#define REPLAY_MAGIC "xsystem4-replay 1"
+
+enum replay_mode replay_mode = REPLAY_OFF;
+
+static FILE *record_file = NULL;
+
+static struct {
+	char *text;
+	char *pos;
+	char *end;
+	unsigned line;
+} stream = {0};
+
+static struct {
+	bool enabled;
+	uint64_t start;
+	uint64_t last_frame;
+	uint64_t render_ticks;
+	uint64_t render_start;
+	int render_depth;
+	float *frame_ms;
+	unsigned nr_frames;
+	unsigned cap_frames;
+} bench = {0};
+
+static void record_close(void)
+{
+	if (record_file)
+		fclose(record_file);
+	record_file = NULL;
+}
+
+void replay_record_start(const char *path)
+{
+	if (!(record_file = fopen(path, "w"))) {
+		WARNING("Failed to open replay file for writing: %s", path);
+		return;
+	}
+	fputs(REPLAY_MAGIC "\n", record_file);
+	atexit(record_close);
+	replay_mode = REPLAY_RECORD;
+}
+
+void replay_record(enum replay_record_type type, const char *fmt, ...)
+{
+	if (!record_file)
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	fputc(type, record_file);
+	fputc(' ', record_file);
+	vfprintf(record_file, fmt, ap);
+	fputc('\n', record_file);
+	va_end(ap);
+}
+
+static double ticks_to_ms(uint64_t ticks)
+{
+	return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static int float_cmp(const void *_a, const void *_b)
+{
+	float a = *(const float*)_a;
+	float b = *(const float*)_b;
+	return a < b ? -1 : a > b;
+}
+
+static float percentile(float *sorted, unsigned n, unsigned p)
+{
+	if (!n)
+		return 0.f;
+	unsigned i = (n - 1) * p / 100;
+	return sorted[i];
+}
+
+static void bench_report(void)
+{
+	double wall_ms = ticks_to_ms(SDL_GetPerformanceCounter() - bench.start);
+	double render_ms = ticks_to_ms(bench.render_ticks);
+	unsigned n = bench.nr_frames;
+	qsort(bench.frame_ms, n, sizeof(float), float_cmp);
+
+	sys_message("Benchmark: %u frames in %.3fs (%.1f fps)\n", n, wall_ms / 1000.0,
+			wall_ms > 0 ? n * 1000.0 / wall_ms : 0.0);
+	sys_message("  frame time (ms): p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+			percentile(bench.frame_ms, n, 50), percentile(bench.frame_ms, n, 90),
+			percentile(bench.frame_ms, n, 99), n ? bench.frame_ms[n-1] : 0.f);
+	// everything outside of scene rendering and presentation: the VM, HLL
+	// work (including CG/audio decoding) and any remaining waits
+	sys_message("  render: %.3fs (%.1f%%)  other: %.3fs (%.1f%%)\n",
+			render_ms / 1000.0, wall_ms > 0 ? render_ms * 100.0 / wall_ms : 0.0,
+			(wall_ms - render_ms) / 1000.0,
+			wall_ms > 0 ? (wall_ms - render_ms) * 100.0 / wall_ms : 0.0);
+}
+
+static void replay_end(const char *reason)
+{
+	NOTICE("Replay ended at line %u: %s", stream.line, reason);
+	replay_mode = REPLAY_OFF;
+	free(stream.text);
+	stream.text = stream.pos = stream.end = NULL;
+	if (bench.enabled) {
+		bench_report();
+		vm_exit(0);
+	}
+}
+
+void replay_play_start(const char *path, bool benchmark)
+{
+	size_t len;
+	if (!(stream.text = file_read(path, &len)))
+		ERROR("Failed to read replay file: %s", path);
+	stream.pos = stream.text;
+	stream.end = stream.text + len;
+	stream.line = 1;
+
+	char *nl = memchr(stream.pos, '\n', stream.end - stream.pos);
+	if (!nl || strncmp(stream.pos, REPLAY_MAGIC, nl - stream.pos))
+		ERROR("Not a replay file: %s", path);
+	stream.pos = nl + 1;
+	stream.line++;
+
+	replay_mode = REPLAY_PLAY;
+	if (benchmark) {
+		bench.enabled = true;
+		bench.start = SDL_GetPerformanceCounter();
+		bench.last_frame = bench.start;
+	}
+}
+
+char replay_peek(void)
+{
+	if (replay_mode != REPLAY_PLAY || stream.pos >= stream.end)
+		return 0;
+	return *stream.pos;
+}
+
+char *replay_next(enum replay_record_type type)
+{
+	if (replay_mode != REPLAY_PLAY)
+		return NULL;
+	if (stream.pos >= stream.end) {
+		replay_end("end of log");
+		return NULL;
+	}
+	if (*stream.pos != type) {
+		replay_end("game diverged from log");
+		return NULL;
+	}
+
+	char *nl = memchr(stream.pos, '\n', stream.end - stream.pos);
+	char *next = nl ? nl + 1 : stream.end;
+	if (nl)
+		*nl = '\0';
+	char *payload = stream.pos[1] ? stream.pos + 2 : stream.pos + 1;
+	stream.pos = next;
+	stream.line++;
+	return payload;
+}
+
+uint32_t replay_time(uint32_t now)
+{
+	switch (replay_mode) {
+	case REPLAY_OFF:
+		break;
+	case REPLAY_RECORD:
+		replay_record(REPLAY_TIME, "%u", now);
+		break;
+	case REPLAY_PLAY: {
+		char *t = replay_next(REPLAY_TIME);
+		if (t)
+			return strtoul(t, NULL, 10);
+		break;
+	}
+	}
+	return now;
+}
+
+void replay_frame(void)
+{
+	if (!bench.enabled)
+		return;
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (bench.nr_frames >= bench.cap_frames) {
+		bench.cap_frames = bench.cap_frames ? bench.cap_frames * 2 : 4096;
+		bench.frame_ms = xrealloc(bench.frame_ms, bench.cap_frames * sizeof(float));
+	}
+	bench.frame_ms[bench.nr_frames++] = ticks_to_ms(now - bench.last_frame);
+	bench.last_frame = now;
+}
+
+void replay_render_begin(void)
+{
+	if (bench.enabled && bench.render_depth++ == 0)
+		bench.render_start = SDL_GetPerformanceCounter();
+}
+
+void replay_render_end(void)
+{
+	if (bench.enabled && --bench.render_depth == 0)
+		bench.render_ticks += SDL_GetPerformanceCounter() - bench.render_start;
+}
@@ -26,6 +26,7 @@
 #include "gfx/gfx.h"
 #include "json.h"
 #include "queue.h"
+#include "replay.h"
 #include "scene.h"
 #include "xsystem4.h"
 
@@ -37,6 +38,19 @@ static TAILQ_HEAD(listhead, sprite) sprite_list = TAILQ_HEAD_INITIALIZER(sprite_
 
 static Texture wp = {0};
 
+// The area of the main surface which must be redrawn by scene_update.
+static Rectangle damage = {0};
+// When set, scene_update redraws the whole scene.
+static bool damage_all = true;
+// The swap count after the last scene_update (see gfx_get_swap_count).
+static unsigned last_swap_count = 0;
+
+void scene_dirty(void)
+{
+	scene_is_dirty = true;
+	damage_all = true;
+}
+
 void scene_register_sprite(struct sprite *sp)
 {
 	if (sp->in_scene)
@@ -47,21 +61,16 @@ void scene_register_sprite(struct sprite *sp)
 
 	struct sprite *p;
 	TAILQ_FOREACH(p, &sprite_list, entry) {
-		if (p->z == sp->z) {
-			if (p->z2 > sp->z2) {
-				TAILQ_INSERT_BEFORE(p, sp, entry);
-				sp->in_scene = true;
-				return;
-			}
-		} else if (p->z > sp->z) {
-			TAILQ_INSERT_BEFORE(p, sp, entry);
-			sp->in_scene = true;
-			return;
-		}
+		if (p->z == sp->z ? p->z2 > sp->z2 : p->z > sp->z)
+			break;
 	}
-	TAILQ_INSERT_TAIL(&sprite_list, sp, entry);
+	if (p)
+		TAILQ_INSERT_BEFORE(p, sp, entry);
+	else
+		TAILQ_INSERT_TAIL(&sprite_list, sp, entry);
 	sp->in_scene = true;
-	scene_dirty();
+	sp->damaged = true;
+	scene_is_dirty = true;
 }
 
 void scene_unregister_sprite(struct sprite *sp)
@@ -70,24 +79,120 @@ void scene_unregister_sprite(struct sprite *sp)
 		return;
 	TAILQ_REMOVE(&sprite_list, sp, entry);
 	sp->in_scene = false;
-	scene_dirty();
+	if (sp->drawn) {
+		SDL_UnionRect(&damage, &sp->drawn_bounds, &damage);
+		sp->drawn = false;
+	}
+	scene_is_dirty = true;
 }
 
-void scene_render(void)
+static Rectangle sprite_bounds(struct sprite *sp)
 {
+	Rectangle r;
+	if (sp->get_bounds && sp->get_bounds(sp, &r))
+		return r;
+	return RECT(0, 0, config.view_width, config.view_height);
+}
+
+/*
+ * Draw the scene to the main surface. If CLIP is not NULL, only the area
+ * within CLIP is redrawn, and sprites outside of it are skipped.
+ */
+static void render_scene(Rectangle *clip)
+{
+	replay_render_begin();
+	gfx_pass_begin(GFX_PASS_SCENE);
 	gfx_clear();
 	if (wp.handle) {
 		Rectangle r = RECT(0, 0, wp.w, wp.h);
 		gfx_render_texture(&wp, &r);
 	}
 
+	// Sprites are drawn in z-order within a single render batch, so that
+	// GL state shared by consecutive sprites isn't set up repeatedly.
+	gfx_batch_begin();
 	struct sprite *sp;
 	TAILQ_FOREACH(sp, &sprite_list, entry) {
-		if (sp->render)
-			sp->render(sp);
-		else
+		if (!sp->render) {
 			WARNING("sprite in scene without render function");
+			continue;
+		}
+		Rectangle r = (sp->damaged || !sp->drawn) ? sprite_bounds(sp) : sp->drawn_bounds;
+		sp->damaged = false;
+		sp->drawn = true;
+		sp->drawn_bounds = r;
+		if (clip && !SDL_HasIntersection(&r, clip))
+			continue;
+		if (sp->batchable) {
+			sp->render(sp);
+		} else {
+			gfx_batch_invalidate();
+			sp->render(sp);
+			gfx_batch_invalidate();
+		}
 	}
+	gfx_batch_end();
+	gfx_pass_end(GFX_PASS_SCENE);
+	replay_render_end();
+
+	damage = RECT(0, 0, 0, 0);
+	damage_all = false;
+}
+
+void scene_render(void)
+{
+	render_scene(NULL);
+}
+
+/*
+ * Redraw the parts of the scene which changed since it was last drawn and
+ * present the result. Returns false (without swapping) if nothing visible
+ * changed.
+ */
+bool scene_update(void)
+{
+	struct sprite *sp;
+	TAILQ_FOREACH(sp, &sprite_list, entry) {
+		if (!sp->damaged)
+			continue;
+		if (sp->drawn)
+			SDL_UnionRect(&damage, &sp->drawn_bounds, &damage);
+		Rectangle r = sprite_bounds(sp);
+		SDL_UnionRect(&damage, &r, &damage);
+	}
+	scene_is_dirty = false;
+
+	// If anything else was presented since the last update, the main
+	// surface may no longer contain the scene.
+	if (gfx_get_swap_count() != last_swap_count)
+		damage_all = true;
+
+	Rectangle screen = RECT(0, 0, config.view_width, config.view_height);
+	Rectangle clip;
+	if (damage_all || (damage.x <= 0 && damage.y <= 0
+			&& damage.x + damage.w >= screen.w
+			&& damage.y + damage.h >= screen.h)) {
+		render_scene(NULL);
+	} else if (SDL_IntersectRect(&damage, &screen, &clip)) {
+		gfx_set_clip_rect(&clip);
+		render_scene(&clip);
+		gfx_set_clip_rect(NULL);
+	} else {
+		// Nothing visible changed; just record the new sprite bounds.
+		TAILQ_FOREACH(sp, &sprite_list, entry) {
+			if (!sp->damaged)
+				continue;
+			sp->damaged = false;
+			sp->drawn = true;
+			sp->drawn_bounds = sprite_bounds(sp);
+		}
+		damage = RECT(0, 0, 0, 0);
+		return false;
+	}
+
+	gfx_swap();
+	last_swap_count = gfx_get_swap_count();
+	return true;
 }
 
 int scene_set_wp(int cg_no) {
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "system4.h"
@@ -49,9 +50,16 @@ void sprite_init(struct sact_sprite *sp)
 	sp->multiply_color = (SDL_Color){255,255,255,255};
 }
 
+static void sprite_shadow_invalidate(struct sact_sprite *sp)
+{
+	free(sp->shadow.pixels);
+	sp->shadow.pixels = NULL;
+}
+
 void sprite_free(struct sact_sprite *sp)
 {
 	scene_unregister_sprite(&sp->sp);
+	sprite_shadow_invalidate(sp);
 	gfx_delete_texture(&sp->texture);
 	gfx_delete_texture(&sp->text.texture);
 	if (sp->plugin) {
@@ -157,7 +165,9 @@ static void sprite_render(struct sprite *_sp)
 {
 	struct sact_sprite *sp = (struct sact_sprite*)_sp;
 	if (sp->plugin && sp->plugin->render) {
+		gfx_batch_invalidate();
 		sp->plugin->render(sp);
+		gfx_batch_invalidate();
 		return;
 	}
 
@@ -192,9 +202,39 @@ static void sprite_render(struct sprite *_sp)
 		glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
 }
 
+static bool sprite_get_bounds(struct sprite *_sp, Rectangle *bounds)
+{
+	struct sact_sprite *sp = (struct sact_sprite*)_sp;
+	// plugins may draw anywhere
+	if (sp->plugin && sp->plugin->render)
+		return false;
+
+	Rectangle r = sp->rect;
+	if (sp->surface_area.x || sp->surface_area.y) {
+		r.x -= sp->surface_area.x;
+		r.y -= sp->surface_area.y;
+	}
+	if (sp->texture.handle) {
+		r.w = max(r.w, sp->texture.w);
+		r.h = max(r.h, sp->texture.h);
+	}
+	if (sp->text.texture.handle) {
+		r.w = max(r.w, sp->text.texture.w);
+		r.h = max(r.h, sp->text.texture.h);
+	}
+	*bounds = r;
+	return true;
+}
+
+// NOTE: the caller may draw to the returned texture, so the shadow copy is
+//       dropped (it will be read back again on the next hit test).
 struct texture *sprite_get_texture(struct sact_sprite *sp)
 {
 	sprite_init_texture(sp);
+	sprite_shadow_invalidate(sp);
+	// drawing to the main surface bypasses the scene's damage tracking
+	if (sp->texture.handle == gfx_main_surface()->handle)
+		scene_dirty();
 	return &sp->texture;
 }
 
@@ -207,11 +247,20 @@ void sprite_set_cg(struct sact_sprite *sp, struct cg *cg)
 {
 	gfx_delete_texture(&sp->texture);
 	gfx_init_texture_with_cg(&sp->texture, cg);
+	sprite_shadow_invalidate(sp);
+	if (sp->shadow.enabled && cg->pixels) {
+		// the CG's pixels are exactly what was uploaded
+		size_t size = (size_t)cg->metrics.w * (size_t)cg->metrics.h * 4;
+		sp->shadow.pixels = xmalloc(size);
+		memcpy(sp->shadow.pixels, cg->pixels, size);
+	}
 	sp->rect.w = cg->metrics.w;
 	sp->rect.h = cg->metrics.h;
 	sp->sp.has_pixel = true;
 	sp->sp.has_alpha = cg->metrics.has_alpha;
 	sp->sp.render = sprite_render;
+	sp->sp.batchable = true;
+	sp->sp.get_bounds = sprite_get_bounds;
 	sp->sp.to_json = _sprite_to_json;
 	sprite_dirty(sp);
 }
@@ -229,6 +278,7 @@ void sprite_set_cg_2x(struct sact_sprite *sp, struct cg *cg)
 
 	// upscale into sprite texture
 	gfx_delete_texture(&sp->texture);
+	sprite_shadow_invalidate(sp);
 	if (cg->metrics.has_alpha) {
 		gfx_init_texture_rgba(&sp->texture, w, h, c);
 	} else {
@@ -241,6 +291,8 @@ void sprite_set_cg_2x(struct sact_sprite *sp, struct cg *cg)
 	sp->sp.has_pixel = true;
 	sp->sp.has_alpha = cg->metrics.has_alpha;
 	sp->sp.render = sprite_render;
+	sp->sp.batchable = true;
+	sp->sp.get_bounds = sprite_get_bounds;
 	sp->sp.to_json = _sprite_to_json;
 	sprite_dirty(sp);
 	gfx_delete_texture(&tmp);
@@ -280,7 +332,7 @@ int sprite_set_cg_by_name(struct sact_sprite *sp, const char *name)
 
 int sprite_set_cg_from_file(struct sact_sprite *sp, const char *path)
 {
-	struct cg *cg = cg_load_file(path);
+	struct cg *cg = asset_cg_decode_file(path);
 	if (!cg)
 		return 0;
 	sprite_set_cg(sp, cg);
@@ -302,10 +354,13 @@ void sprite_init_color(struct sact_sprite *sp, int w, int h, int r, int g, int b
 	sp->rect.w = w;
 	sp->rect.h = h;
 	gfx_delete_texture(&sp->texture);
+	sprite_shadow_invalidate(sp);
 
 	sp->sp.has_pixel = true;
 	sp->sp.has_alpha = a >= 0;
 	sp->sp.render = sprite_render;
+	sp->sp.batchable = true;
+	sp->sp.get_bounds = sprite_get_bounds;
 	sp->sp.to_json = _sprite_to_json;
 	sprite_dirty(sp);
 }
@@ -313,6 +368,8 @@ void sprite_init_color(struct sact_sprite *sp, int w, int h, int r, int g, int b
 void sprite_init_custom(struct sact_sprite *sp)
 {
 	sp->sp.render = sprite_render;
+	sp->sp.batchable = true;
+	sp->sp.get_bounds = sprite_get_bounds;
 	sp->sp.to_json = _sprite_to_json;
 }
 
@@ -456,25 +513,48 @@ bool sprite_is_point_in_rect(struct sact_sprite *sp, int x, int y)
 	return !!SDL_PointInRect(&p, &sp->rect);
 }
 
+/*
+ * Get a pixel from the sprite's texture. The first query reads back the
+ * whole texture into the shadow copy; later queries don't touch the GPU
+ * until the texture changes.
+ *
+ * Sprite 0 shares the main surface's texture, which is drawn to without
+ * going through the sprite, so it is always read directly.
+ */
+static SDL_Color sprite_get_pixel(struct sact_sprite *sp, int x, int y)
+{
+	sprite_init_texture(sp);
+	if (x < 0 || y < 0 || x >= sp->texture.w || y >= sp->texture.h)
+		return (SDL_Color) { 0, 0, 0, 0 };
+	if (sp->texture.handle == gfx_main_surface()->handle)
+		return gfx_get_pixel(&sp->texture, x, y);
+
+	sp->shadow.enabled = true;
+	if (!sp->shadow.pixels)
+		sp->shadow.pixels = gfx_get_pixels(&sp->texture);
+
+	uint8_t *p = sp->shadow.pixels + ((size_t)y * sp->texture.w + x) * 4;
+	return (SDL_Color) { .r = p[0], .g = p[1], .b = p[2], .a = p[3] };
+}
+
 bool sprite_is_point_in(struct sact_sprite *sp, int x, int y)
 {
 	if (!sprite_is_point_in_rect(sp, x, y))
 		return 0;
 
 	// check alpha
-	struct texture *t = sprite_get_texture(sp);
-	SDL_Color c = gfx_get_pixel(t, x - sp->rect.x, y - sp->rect.y);
+	SDL_Color c = sprite_get_pixel(sp, x - sp->rect.x, y - sp->rect.y);
 	return !!c.a;
 }
 
 int sprite_get_amap_value(struct sact_sprite *sp, int x, int y)
 {
-	return gfx_get_pixel(sprite_get_texture(sp), x, y).a;
+	return sprite_get_pixel(sp, x, y).a;
 }
 
 void sprite_get_pixel_value(struct sact_sprite *sp, int x, int y, int *r, int *g, int *b)
 {
-	SDL_Color c = gfx_get_pixel(sprite_get_texture(sp), x, y);
+	SDL_Color c = sprite_get_pixel(sp, x, y);
 	*r = c.r;
 	*g = c.g;
 	*b = c.b;
@@ -0,0 +1,148 @@
+/* Copyright (C) 2026 Nunuhara Cabbage <nunuhara@haniwa.technology>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "system4.h"
+#include "system4/string.h"
+#include "system4/utfsjis.h"
+
+#include "vm/string_index.h"
+
+// strings shorter than this (in bytes) are cheap enough to scan
+#define MIN_INDEX_SIZE 256
+// a byte offset is recorded for every INDEX_STRIDE'th character
+#define INDEX_STRIDE 64
+#define NR_CACHED_INDICES 8
+
+struct string_index {
+	struct string *s;
+	int nr_chars;
+	int *offsets;
+};
+
+// most recently used first
+static struct string_index cache[NR_CACHED_INDICES] = {0};
+
+static void index_free(struct string_index *idx)
+{
+	if (!idx->s)
+		return;
+	free_string(idx->s);
+	free(idx->offsets);
+	idx->s = NULL;
+	idx->offsets = NULL;
+}
+
+static bool index_build(struct string_index *idx, struct string *s)
+{
+	// Strings with embedded NULs or a truncated trailing character are
+	// not indexed, so that results match the unindexed versions exactly.
+	if (strlen(s->text) != (size_t)s->size)
+		return false;
+
+	int cap = s->size / INDEX_STRIDE + 1;
+	int *offsets = xmalloc(cap * sizeof(int));
+	int nr_chars = 0;
+	int pos = 0;
+	while (pos < s->size) {
+		if (nr_chars % INDEX_STRIDE == 0)
+			offsets[nr_chars / INDEX_STRIDE] = pos;
+		pos += SJIS_2BYTE(s->text[pos]) ? 2 : 1;
+		nr_chars++;
+	}
+	if (pos != s->size) {
+		free(offsets);
+		return false;
+	}
+
+	idx->s = string_ref(s);
+	idx->nr_chars = nr_chars;
+	idx->offsets = offsets;
+	return true;
+}
+
+static struct string_index *index_lookup(struct string *s)
+{
+	for (int i = 0; i < NR_CACHED_INDICES && cache[i].s; i++) {
+		if (cache[i].s != s)
+			continue;
+		if (i > 0) {
+			struct string_index tmp = cache[i];
+			memmove(cache + 1, cache, i * sizeof(struct string_index));
+			cache[0] = tmp;
+		}
+		return &cache[0];
+	}
+	return NULL;
+}
+
+static struct string_index *index_get(struct string *s)
+{
+	struct string_index *idx = index_lookup(s);
+	if (idx || s->size < MIN_INDEX_SIZE)
+		return idx;
+
+	struct string_index new_idx;
+	if (!index_build(&new_idx, s))
+		return NULL;
+	index_free(&cache[NR_CACHED_INDICES-1]);
+	memmove(cache + 1, cache, (NR_CACHED_INDICES - 1) * sizeof(struct string_index));
+	cache[0] = new_idx;
+	return &cache[0];
+}
+
+// Byte offset of character I (0 <= I <= nr_chars).
+static int index_char_offset(struct string_index *idx, int i)
+{
+	if (i == idx->nr_chars)
+		return idx->s->size;
+	const char *text = idx->s->text;
+	int pos = idx->offsets[i / INDEX_STRIDE];
+	for (int n = i % INDEX_STRIDE; n > 0; n--) {
+		pos += SJIS_2BYTE(text[pos]) ? 2 : 1;
+	}
+	return pos;
+}
+
+int vm_string_length(struct string *s)
+{
+	// Length alone doesn't justify building an index, but use one if
+	// it exists (e.g. a GetPart loop bounded by Length).
+	struct string_index *idx = index_lookup(s);
+	if (idx)
+		return idx->nr_chars;
+	return sjis_count_char(s->text);
+}
+
+struct string *vm_string_copy(struct string *s, int index, int len)
+{
+	struct string_index *idx = index_get(s);
+	if (!idx || index < 0 || len <= 0 || len > idx->nr_chars - index)
+		return string_copy(s, index, len);
+
+	int start = index_char_offset(idx, index);
+	int end = index_char_offset(idx, index + len);
+	return make_string(s->text + start, end - start);
+}
+
+void vm_string_index_clear(void)
+{
+	for (int i = 0; i < NR_CACHED_INDICES; i++) {
+		index_free(&cache[i]);
+	}
+}
@@ -39,7 +39,10 @@
 #include "debugger.h"
 #include "gfx/gfx.h"
 #include "gfx/font.h"
+#include "profile.h"
+#include "replay.h"
 #include "vm.h"
+#include "vm/counters.h"
 
 #include "version.h"
 
@@ -65,6 +68,14 @@ struct config config = {
 	.manual_text_x_scale = false,
 	.save_format = SAVE_FORMAT_RSM,
 	.msgskip_delay = 0,
+	.vm_dispatch = VM_DISPATCH_THREADED,
+	.jit = true,
+	.jit_threshold = 100,
+	.cg_cache_size = -1,
+	.sound_cache_max_length = 2000,
+	.frame_stats_overlay = false,
+	.frame_stats_csv = NULL,
+	.headless = false,
 
 	.bgi_path = NULL,
 	.wai_path = NULL,
@@ -212,6 +223,42 @@ static void read_user_config_file(const char *path, const char *basedir)
 				WARNING("Invalid value for save-format in config: \"%s\"",
 						ini_string(&ini[i])->text);
 			}
+		} else if (!strcmp(ini[i].name->text, "vm-dispatch")) {
+			if (!strcmp(ini_string(&ini[i])->text, "switch")) {
+				config.vm_dispatch = VM_DISPATCH_SWITCH;
+			} else if (!strcmp(ini_string(&ini[i])->text, "threaded")) {
+				config.vm_dispatch = VM_DISPATCH_THREADED;
+			} else {
+				WARNING("Invalid value for vm-dispatch in config: \"%s\"",
+						ini_string(&ini[i])->text);
+			}
+		} else if (!strcmp(ini[i].name->text, "jit")) {
+			config.jit = ini_boolean(&ini[i]);
+		} else if (!strcmp(ini[i].name->text, "jit-threshold")) {
+			int threshold = ini_integer(&ini[i]);
+			if (threshold < 1) {
+				WARNING("Invalid value for jit-threshold in config: %d", threshold);
+			} else {
+				config.jit_threshold = threshold;
+			}
+		} else if (!strcmp(ini[i].name->text, "cg-cache-size")) {
+			int size = ini_integer(&ini[i]);
+			if (size < 0) {
+				WARNING("Invalid value for cg-cache-size in config: %d", size);
+			} else {
+				config.cg_cache_size = size;
+			}
+		} else if (!strcmp(ini[i].name->text, "sound-cache-max-length")) {
+			int length = ini_integer(&ini[i]);
+			if (length < 0) {
+				WARNING("Invalid value for sound-cache-max-length in config: %d", length);
+			} else {
+				config.sound_cache_max_length = length;
+			}
+		} else if (!strcmp(ini[i].name->text, "frame-stats")) {
+			config.frame_stats_overlay = ini_boolean(&ini[i]);
+		} else if (!strcmp(ini[i].name->text, "frame-stats-csv")) {
+			config.frame_stats_csv = strdup(ini_string(&ini[i])->text);
 		}
 		ini_free_entry(&ini[i]);
 	}
@@ -383,6 +430,20 @@ static void usage(void)
 	puts("        --msgskip-delay  Specify the delay in ms to add when skipping messages with CTRL");
 	puts("        --save-folder    Override save folder location");
 	puts("        --save-format    Specify the resume save file format. json (default) or rsm");
+	puts("        --vm-dispatch    Specify the bytecode dispatch method. threaded (default) or switch");
+	puts("        --nojit          Disable the JIT compiler");
+	puts("        --jit-threshold  Specify the number of calls before a function is compiled");
+	puts("        --cg-cache-size  Specify the number of decoded CGs to cache (0 = disabled)");
+	puts("        --sound-cache-max-length  Specify the max length in ms of sounds to keep decoded in memory (0 = disabled)");
+	puts("        --headless       Run without a window or audio output (for benchmarking)");
+	puts("        --frame-stats    Display rendering statistics in an on-screen overlay");
+	puts("        --frame-stats-csv  Write per-frame rendering statistics to the given CSV file");
+	puts("        --profile        Profile the game and write collapsed stacks to the given file");
+	puts("        --record         Record input to the given replay file");
+	puts("        --benchmark      Replay the given file as fast as possible and report frame timings");
+#ifdef VM_COUNTERS
+	puts("        --counters       Write execution counters to the given file (default: xsystem4-counters.json)");
+#endif
 #ifdef DEBUGGER_ENABLED
 	puts("        --nodebug        Disable debugger");
 	puts("        --debug          Start in debugger");
@@ -414,6 +475,20 @@ enum {
 	LOPT_MSGSKIP_DELAY,
 	LOPT_SAVE_FOLDER,
 	LOPT_SAVE_FORMAT,
+	LOPT_VM_DISPATCH,
+	LOPT_NOJIT,
+	LOPT_JIT_THRESHOLD,
+	LOPT_CG_CACHE_SIZE,
+	LOPT_SOUND_CACHE_MAX_LENGTH,
+	LOPT_HEADLESS,
+	LOPT_FRAME_STATS,
+	LOPT_FRAME_STATS_CSV,
+	LOPT_PROFILE,
+	LOPT_RECORD,
+	LOPT_BENCHMARK,
+#ifdef VM_COUNTERS
+	LOPT_COUNTERS,
+#endif
 #ifdef DEBUGGER_ENABLED
 	LOPT_NODEBUG,
 	LOPT_DEBUG,
@@ -424,6 +499,9 @@ enum {
 
 static void error_handler(const char *msg)
 {
+	// don't block unattended runs on a message box
+	if (config.headless)
+		return;
 	SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "xsystem4", msg, NULL);
 }
 
@@ -441,6 +519,19 @@ int main(int argc, char *argv[])
 	char *joypad = NULL;
 	char *savedir = NULL;
 	char *debug_info_path = NULL;
+	char *vm_dispatch = NULL;
+	bool nojit = false;
+	int jit_threshold = 0;
+	int cg_cache_size = -1;
+	int sound_cache_max_length = -1;
+	bool frame_stats = false;
+	char *frame_stats_csv = NULL;
+	char *profile_path = NULL;
+	char *record_path = NULL;
+	char *benchmark_path = NULL;
+#ifdef VM_COUNTERS
+	char *counters_path = "xsystem4-counters.json";
+#endif
 
 	while (1) {
 		static struct option long_options[] = {
@@ -456,6 +547,20 @@ int main(int argc, char *argv[])
 			{ "msgskip-delay", required_argument, 0, LOPT_MSGSKIP_DELAY },
 			{ "save-folder",   required_argument, 0, LOPT_SAVE_FOLDER },
 			{ "save-format",   required_argument, 0, LOPT_SAVE_FORMAT },
+			{ "vm-dispatch",   required_argument, 0, LOPT_VM_DISPATCH },
+			{ "nojit",         no_argument,       0, LOPT_NOJIT },
+			{ "jit-threshold", required_argument, 0, LOPT_JIT_THRESHOLD },
+			{ "cg-cache-size", required_argument, 0, LOPT_CG_CACHE_SIZE },
+			{ "sound-cache-max-length", required_argument, 0, LOPT_SOUND_CACHE_MAX_LENGTH },
+			{ "headless",      no_argument,       0, LOPT_HEADLESS },
+			{ "frame-stats",   no_argument,       0, LOPT_FRAME_STATS },
+			{ "frame-stats-csv", required_argument, 0, LOPT_FRAME_STATS_CSV },
+			{ "profile",       required_argument, 0, LOPT_PROFILE },
+			{ "record",        required_argument, 0, LOPT_RECORD },
+			{ "benchmark",     required_argument, 0, LOPT_BENCHMARK },
+#ifdef VM_COUNTERS
+			{ "counters",      required_argument, 0, LOPT_COUNTERS },
+#endif
 #ifdef DEBUGGER_ENABLED
 			{ "nodebug",       no_argument,       0, LOPT_NODEBUG },
 			{ "debug",         no_argument,       0, LOPT_DEBUG },
@@ -527,6 +632,57 @@ int main(int argc, char *argv[])
 				WARNING("Invalid value for --save-format option: \"%s\"", optarg);
 			}
 			break;
+		case LOPT_VM_DISPATCH:
+			vm_dispatch = optarg;
+			break;
+		case LOPT_NOJIT:
+			nojit = true;
+			break;
+		case LOPT_JIT_THRESHOLD:
+			jit_threshold = atoi(optarg);
+			if (jit_threshold < 1) {
+				WARNING("Invalid value for --jit-threshold: \"%s\"", optarg);
+				jit_threshold = 0;
+			}
+			break;
+		case LOPT_CG_CACHE_SIZE:
+			cg_cache_size = atoi(optarg);
+			if (cg_cache_size < 0) {
+				WARNING("Invalid value for --cg-cache-size: \"%s\"", optarg);
+				cg_cache_size = -1;
+			}
+			break;
+		case LOPT_SOUND_CACHE_MAX_LENGTH:
+			sound_cache_max_length = atoi(optarg);
+			if (sound_cache_max_length < 0) {
+				WARNING("Invalid value for --sound-cache-max-length: \"%s\"", optarg);
+				sound_cache_max_length = -1;
+			}
+			break;
+		case LOPT_HEADLESS:
+			config.headless = true;
+			break;
+		case LOPT_FRAME_STATS:
+			frame_stats = true;
+			break;
+		case LOPT_FRAME_STATS_CSV:
+			frame_stats_csv = optarg;
+			break;
+		case LOPT_PROFILE:
+			profile_path = optarg;
+			break;
+		case LOPT_RECORD:
+			record_path = optarg;
+			break;
+		case LOPT_BENCHMARK:
+			benchmark_path = optarg;
+			config.headless = true;
+			break;
+#ifdef VM_COUNTERS
+		case LOPT_COUNTERS:
+			counters_path = optarg;
+			break;
+#endif
 #ifdef DEBUGGER_ENABLED
 		case LOPT_NODEBUG:
 			dbg_enabled = false;
@@ -589,6 +745,30 @@ int main(int argc, char *argv[])
 		free(config.save_dir);
 		config.save_dir = strdup(savedir);
 	}
+	if (vm_dispatch) {
+		if (!strcmp(vm_dispatch, "switch"))
+			config.vm_dispatch = VM_DISPATCH_SWITCH;
+		else if (!strcmp(vm_dispatch, "threaded"))
+			config.vm_dispatch = VM_DISPATCH_THREADED;
+		else
+			WARNING("Invalid value for --vm-dispatch option: \"%s\"", vm_dispatch);
+	}
+	if (nojit)
+		config.jit = false;
+	if (jit_threshold)
+		config.jit_threshold = jit_threshold;
+	if (cg_cache_size >= 0)
+		config.cg_cache_size = cg_cache_size;
+	if (sound_cache_max_length >= 0)
+		config.sound_cache_max_length = sound_cache_max_length;
+	if (frame_stats)
+		config.frame_stats_overlay = true;
+	if (frame_stats_csv)
+		config.frame_stats_csv = frame_stats_csv;
+	// compiled code doesn't keep instr_ptr up to date, which would skew
+	// per-opcode samples
+	if (profile_path)
+		config.jit = false;
 
 	if (!(ain = ain_open(ainfile, &err))) {
 		ERROR("%s", ain_strerror(err));
@@ -606,5 +786,14 @@ int main(int argc, char *argv[])
 		set_msgskip_delay(ain, config.msgskip_delay);
 	asset_manager_init();
 	dbg_init(debug_info_path);
+	if (profile_path)
+		profile_start(profile_path);
+	if (benchmark_path)
+		replay_play_start(benchmark_path, true);
+	else if (record_path)
+		replay_record_start(record_path);
+#ifdef VM_COUNTERS
+	vm_counters_init(counters_path);
+#endif
 	sys_exit(vm_execute_ain(ain));
 }
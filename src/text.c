@@ -122,13 +122,121 @@ static struct font_size *text_style_font_size(struct text_style *ts)
 	return ts->font_size = gfx_font_get_size(ts->face, ts->size);
 }
 
+// empty space between atlas cells, so that filtering never samples a
+// neighbouring glyph (the dilate shader clamps its samples to the cell)
+#define GLYPH_ATLAS_PADDING 2
+
+static void glyph_atlas_page_clear(struct glyph_atlas_page *page)
+{
+	uint8_t *zero = xcalloc(GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE);
+	if (page->t.handle)
+		gfx_update_texture_rmap(&page->t, 0, 0, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, zero);
+	else
+		gfx_init_texture_rmap(&page->t, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, zero);
+	free(zero);
+	page->generation++;
+	page->nr_shelves = 0;
+}
+
+static bool glyph_atlas_page_alloc(struct glyph_atlas_page *page, int w, int h, Rectangle *out)
+{
+	w += GLYPH_ATLAS_PADDING;
+	h += GLYPH_ATLAS_PADDING;
+
+	// use the lowest shelf that fits without wasting too much space
+	struct glyph_shelf *shelf = NULL;
+	for (int i = 0; i < page->nr_shelves; i++) {
+		struct glyph_shelf *s = &page->shelves[i];
+		if (s->h < h || s->h > h + h/4 || s->x + w > GLYPH_ATLAS_SIZE)
+			continue;
+		if (!shelf || s->h < shelf->h)
+			shelf = s;
+	}
+
+	// otherwise open a new shelf
+	if (!shelf) {
+		struct glyph_shelf *last = page->nr_shelves ? &page->shelves[page->nr_shelves-1] : NULL;
+		int y = last ? last->y + last->h : 0;
+		if (y + h > GLYPH_ATLAS_SIZE || page->nr_shelves >= GLYPH_ATLAS_MAX_SHELVES)
+			return false;
+		shelf = &page->shelves[page->nr_shelves++];
+		shelf->x = 0;
+		shelf->y = y;
+		shelf->h = h;
+	}
+
+	*out = (Rectangle) {
+		.x = shelf->x,
+		.y = shelf->y,
+		.w = w - GLYPH_ATLAS_PADDING,
+		.h = h - GLYPH_ATLAS_PADDING
+	};
+	shelf->x += w;
+	return true;
+}
+
+/*
+ * Add a glyph bitmap (8-bit coverage, w x h) to the atlas for SIZE, and
+ * point GLYPH's cell for WEIGHT at it.
+ */
+bool glyph_atlas_add(struct font_size *size, struct glyph *glyph, enum font_weight weight,
+		int w, int h, uint8_t *pixels)
+{
+	struct glyph_atlas *atlas = &size->atlas;
+	if (w + GLYPH_ATLAS_PADDING > GLYPH_ATLAS_SIZE || h + GLYPH_ATLAS_PADDING > GLYPH_ATLAS_SIZE) {
+		WARNING("Glyph too large for atlas: %dx%d", w, h);
+		return false;
+	}
+
+	Rectangle r;
+	struct glyph_atlas_page *page = NULL;
+	for (int i = 0; i < atlas->nr_pages; i++) {
+		if (glyph_atlas_page_alloc(atlas->pages[i], w, h, &r)) {
+			page = atlas->pages[i];
+			break;
+		}
+	}
+	if (!page && atlas->nr_pages < GLYPH_ATLAS_MAX_PAGES) {
+		page = xcalloc(1, sizeof(struct glyph_atlas_page));
+		glyph_atlas_page_clear(page);
+		atlas->pages[atlas->nr_pages++] = page;
+		glyph_atlas_page_alloc(page, w, h, &r);
+	}
+	if (!page) {
+		// evict the oldest page
+		page = atlas->pages[atlas->next_eviction];
+		atlas->next_eviction = (atlas->next_eviction + 1) % GLYPH_ATLAS_MAX_PAGES;
+		glyph_atlas_page_clear(page);
+		glyph_atlas_page_alloc(page, w, h, &r);
+	}
+
+	gfx_update_texture_rmap(&page->t, r.x, r.y, r.w, r.h, pixels);
+	glyph->cell[weight] = (struct glyph_cell) {
+		.page = page,
+		.generation = page->generation,
+		.r = r
+	};
+	return true;
+}
+
+// Returns the glyph if it is already in the atlas, otherwise NULL.
+static struct glyph *font_get_cached_glyph(struct font_size *size, uint32_t code, enum font_weight weight)
+{
+	if (!size->glyph_table)
+		return NULL;
+	struct glyph *glyph = ht_get_int(size->glyph_table, code, NULL);
+	if (glyph && glyph_cell_valid(&glyph->cell[weight]))
+		return glyph;
+	return NULL;
+}
+
 static struct glyph *font_get_glyph(struct font_size *size, uint32_t code, enum font_weight weight)
 {
 	if (!size->glyph_table)
 		size->glyph_table = ht_create(4096);
 	// return cached glyph if available
 	struct ht_slot *slot = ht_put_int(size->glyph_table, code, NULL);
-	if (slot->value && ((struct glyph*)slot->value)->t[weight].handle)
+	if (slot->value && glyph_cell_valid(&((struct glyph*)slot->value)->cell[weight]))
 		return slot->value;
 	// alloc if necessary
 	if (!slot->value)
@@ -199,10 +307,61 @@ float gfx_get_actual_font_size_round_down(unsigned face, float size)
 	return font->get_actual_size_round_down(font, size);
 }
 
+/*
+ * Glyphs are laid out into a batch of quads and drawn with one call per
+ * atlas page (normally one call per string).
+ */
+#define GLYPH_BATCH_SIZE 256
+
+struct glyph_batch {
+	Texture *dst;
+	Texture *atlas;
+	SDL_Color color;
+	float bold_width;
+	enum gfx_glyph_mode mode;
+	int nr_quads;
+	struct gfx_glyph_quad quads[GLYPH_BATCH_SIZE];
+};
+
+static void glyph_batch_flush(struct glyph_batch *batch)
+{
+	gfx_draw_glyphs(batch->dst, batch->atlas, batch->quads, batch->nr_quads, batch->color,
+			batch->bold_width, batch->mode);
+	batch->nr_quads = 0;
+}
+
+static void glyph_batch_add(struct glyph_batch *batch, Texture *atlas, struct gfx_glyph_quad quad)
+{
+	if (batch->nr_quads && (batch->atlas != atlas || batch->nr_quads >= GLYPH_BATCH_SIZE))
+		glyph_batch_flush(batch);
+	batch->atlas = atlas;
+	batch->quads[batch->nr_quads++] = quad;
+}
+
+static enum gfx_glyph_mode glyph_mode(enum text_render_mode mode)
+{
+	switch (mode) {
+	case RENDER_COPY:    return GFX_GLYPH_COPY;
+	case RENDER_BLENDED: return GFX_GLYPH_BLEND;
+	case RENDER_PMAP:    return GFX_GLYPH_PMAP;
+	case RENDER_AMAP:    return GFX_GLYPH_AMAP;
+	}
+	return GFX_GLYPH_COPY;
+}
+
 float _gfx_render_text(Texture *dst, char *msg, struct text_render_metrics *tm)
 {
 	float pos_x = tm->x;
 	int pos_y = tm->y + tm->font_size->y_offset;
+	bool pmap_or_amap = tm->mode == RENDER_PMAP || tm->mode == RENDER_AMAP;
+
+	// kept static since it is fairly large; text is only rendered on the main thread
+	static struct glyph_batch batch;
+	batch.dst = dst;
+	batch.color = tm->color;
+	batch.bold_width = pmap_or_amap ? 0.f : tm->edge_width;
+	batch.mode = glyph_mode(tm->mode);
+	batch.nr_quads = 0;
 
 	while (*msg) {
 		pos_x += tm->edge_spacing;
@@ -210,30 +369,49 @@ float _gfx_render_text(Texture *dst, char *msg, struct text_render_metrics *tm)
 		float scale_x = *msg == ' ' ? tm->space_scale_x : tm->scale_x;
 		uint32_t code = char_to_code(msg, tm->font_size->font->charmap);
 		msg += SJIS_2BYTE(*msg) ? 2 : 1;
-		struct glyph *glyph = font_get_glyph(tm->font_size, code, tm->weight);
+		struct glyph *glyph = font_get_cached_glyph(tm->font_size, code, tm->weight);
+		if (!glyph) {
+			// rendering a new glyph may evict an atlas page used by the batch
+			glyph_batch_flush(&batch);
+			glyph = font_get_glyph(tm->font_size, code, tm->weight);
+		}
 		if (!glyph)
 			continue;
 
-		// render glyph
-		Texture *t = &glyph->t[tm->weight];
-		if (tm->mode == RENDER_COPY) {
-			float x = pos_x - glyph->rect.x;
-			int y = pos_y - glyph->rect.y;
-			gfx_draw_glyph(dst, x, y, t, tm->color, config.text_x_scale, tm->edge_width, false);
-		} else if (tm->mode == RENDER_BLENDED) {
-			float x = pos_x - glyph->rect.x;
+		// add glyph to batch
+		struct glyph_cell *cell = &glyph->cell[tm->weight];
+		if (!pmap_or_amap) {
+			// the whole cell, so that bold/outline dilation isn't clipped
+			int x = roundf(pos_x - glyph->rect.x);
 			int y = pos_y - glyph->rect.y;
-			gfx_draw_glyph(dst, x, y, t, tm->color, config.text_x_scale, tm->edge_width, true);
-		} else if (tm->mode == RENDER_PMAP) {
-			gfx_draw_glyph_to_pmap(dst, pos_x, pos_y, t, glyph->rect, tm->color, config.text_x_scale);
-		} else if (tm->mode == RENDER_AMAP) {
-			gfx_draw_glyph_to_amap(dst, pos_x, pos_y, t, glyph->rect, config.text_x_scale);
+			glyph_batch_add(&batch, &cell->page->t, (struct gfx_glyph_quad) {
+				.dx = x,
+				.dy = y,
+				.dw = cell->r.w * config.text_x_scale,
+				.dh = cell->r.h,
+				.src = cell->r
+			});
+		} else {
+			Rectangle glyph_pos = {
+				.x = cell->r.x + glyph->rect.x,
+				.y = cell->r.y + glyph->rect.y,
+				.w = glyph->rect.w,
+				.h = glyph->rect.h
+			};
+			glyph_batch_add(&batch, &cell->page->t, (struct gfx_glyph_quad) {
+				.dx = pos_x,
+				.dy = pos_y,
+				.dw = glyph_pos.w * config.text_x_scale,
+				.dh = glyph_pos.h,
+				.src = glyph_pos
+			});
 		}
 
 		// advance
 		pos_x += glyph->advance * scale_x * config.text_x_scale + tm->font_spacing;
 		pos_x += tm->edge_spacing;
 	}
+	glyph_batch_flush(&batch);
 	return pos_x - tm->x;
 }
 
@@ -315,11 +493,12 @@ void gfx_render_dash_text(Texture *dst, struct text_style *ts)
 	int y = (ts->size - h) / 2;
 	gfx_fill(&glyph, x, y, w, h, 255, 255, 255);
 
+	Rectangle r = { 0, 0, glyph.w, glyph.h };
 	float edge_width = text_style_edge_width(ts);
 	if (edge_width > 0.01f) {
-		gfx_draw_glyph(dst, 0, 0, &glyph, ts->edge_color, 1.f, edge_width, false);
+		gfx_draw_glyph(dst, 0, 0, &glyph, r, ts->edge_color, 1.f, edge_width, false);
 	}
-	gfx_draw_glyph(dst, 0, 0, &glyph, ts->color, 1.f, ts->bold_width, false);
+	gfx_draw_glyph(dst, 0, 0, &glyph, r, ts->color, 1.f, ts->bold_width, false);
 
 	gfx_delete_texture(&glyph);
 }
@@ -30,7 +30,9 @@
 #include "gfx/gfx.h"
 #include "gfx/private.h"
 #include "icon.h"
+#include "replay.h"
 #include "xsystem4.h"
+#include "vm/heap.h"
 
 struct sdl_private sdl;
 
@@ -70,6 +72,7 @@ static struct texture *view = &main_surface;
 static GLint max_texture_size;
 static SDL_Color clear_color = { 0, 0, 0, 255 };
 static float frame_rate;
+static unsigned swap_count;
 static bool wait_vsync = false;
 
 static GLchar *read_shader_file(const char *path)
@@ -229,8 +232,23 @@ int gfx_init(void)
 	uint32_t flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO;
 	if (config.joypad)
 		flags |= SDL_INIT_GAMECONTROLLER;
-	if (SDL_Init(flags) < 0)
-		ERROR("SDL_Init failed: %s", SDL_GetError());
+	if (config.headless) {
+		// Render with an offscreen (EGL) context and discard audio output.
+		// The user can still pick a different video driver through the
+		// environment.
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+		SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+		wait_vsync = false;
+	}
+	if (SDL_Init(flags) < 0) {
+		if (!config.headless)
+			ERROR("SDL_Init failed: %s", SDL_GetError());
+		// fall back to a hidden window on the default video driver
+		WARNING("SDL_Init failed: %s (retrying with default video driver)", SDL_GetError());
+		SDL_setenv("SDL_VIDEODRIVER", "", 1);
+		if (SDL_Init(flags) < 0)
+			ERROR("SDL_Init failed: %s", SDL_GetError());
+	}
 
 #ifdef USE_GLES
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -248,7 +266,8 @@ int gfx_init(void)
 				       SDL_WINDOWPOS_UNDEFINED,
 				       config.view_width,
 				       config.view_height,
-				       SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+				       SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE |
+				       (config.headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
 	if (!sdl.window)
 		ERROR("SDL_CreateWindow failed: %s", SDL_GetError());
 
@@ -273,6 +292,7 @@ int gfx_init(void)
 	atexit(gfx_fini);
 	gfx_clear();
 	icon_init();
+	gfx_frame_stats_init();
 	gfx_initialized = true;
 	return 0;
 }
@@ -372,6 +392,9 @@ void gfx_update_screen_scale(void)
 
 void gfx_set_wait_vsync(bool wait)
 {
+	// headless mode always runs uncapped
+	if (config.headless)
+		return;
 	wait_vsync = wait;
 	if (gfx_initialized)
 		SDL_GL_SetSwapInterval(wait ? 1 : 0);
@@ -407,6 +430,16 @@ float gfx_get_frame_rate(void)
 	return frame_rate;
 }
 
+/*
+ * The number of times the main surface has been presented. Used to detect
+ * whether the main surface may have been drawn to by anyone other than the
+ * scene renderer.
+ */
+unsigned gfx_get_swap_count(void)
+{
+	return swap_count;
+}
+
 static void gfx_update_frame_rate_counter(void)
 {
 	static uint64_t timestamp;
@@ -421,32 +454,93 @@ static void gfx_update_frame_rate_counter(void)
 	}
 }
 
-void gfx_swap(void)
+// Maps the unit square to the window viewport, with y pointing down.
+static mat4 present_view_transform = MAT4(
+	2,  0, 0, -1,
+	0, -2, 0,  1,
+	0,  0, 1,  0,
+	0,  0, 0,  1);
+
+/*
+ * Render T at R (in view coordinates) on top of the presented frame, using
+ * the same transform and viewport as the frame itself. Only valid while
+ * presenting.
+ */
+void gfx_present_texture(struct texture *t, Rectangle *r)
+{
+	mat4 world_transform = WORLD_TRANSFORM(
+			(float)t->w / sdl.w, (float)t->h / sdl.h,
+			(float)r->x / sdl.w, (float)r->y / sdl.h);
+	struct gfx_render_job job = {
+		.shader = &default_shader,
+		.shape = GFX_RECTANGLE,
+		.texture = t->handle,
+		.world_transform = world_transform[0],
+		.view_transform = present_view_transform[0],
+		.data = t
+	};
+	gfx_render(&job);
+}
+
+static void gfx_present(void)
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glViewport(sdl.viewport.x, sdl.viewport.y, sdl.viewport.w, sdl.viewport.h);
 	gfx_clear();
 
-	static mat4 wv_transform = MAT4(
-		2,  0, 0, -1,
-		0, -2, 0,  1,
-		0,  0, 1,  0,
-		0,  0, 0,  1);
 	struct gfx_render_job job = {
 		.shader = &default_shader,
 		.shape = GFX_RECTANGLE,
 		.texture = view->handle,
 		.world_transform = mw_transform[0],
-		.view_transform = wv_transform[0],
+		.view_transform = present_view_transform[0],
 		.data = view
 	};
 	gfx_render(&job);
+	gfx_frame_stats_render_overlay();
 
 	SDL_GL_SwapWindow(sdl.window);
 	glBindFramebuffer(GL_FRAMEBUFFER, main_surface_fb);
 	glViewport(0, 0, sdl.w, sdl.h);
+}
+
+void gfx_swap(void)
+{
+	replay_render_begin();
+	gfx_frame_stats_end_frame();
+	heap_stats_end_frame();
+
+	// Nothing is presented in headless mode; just make sure the frame's
+	// commands are submitted.
+	if (config.headless)
+		glFlush();
+	else
+		gfx_present();
 
+	swap_count++;
 	gfx_update_frame_rate_counter();
+	replay_render_end();
+	replay_frame();
+}
+
+static bool clip_enabled = false;
+
+/*
+ * Restrict rendering to the main surface to the rectangle R (in window
+ * coordinates), or remove the restriction if R is NULL. Rendering to other
+ * framebuffers (via gfx_set_framebuffer) is not affected.
+ */
+void gfx_set_clip_rect(Rectangle *r)
+{
+	if (!r) {
+		clip_enabled = false;
+		glDisable(GL_SCISSOR_TEST);
+		return;
+	}
+	clip_enabled = true;
+	// scene coordinates map directly to rows of the main surface
+	glScissor(r->x, r->y, r->w, r->h);
+	glEnable(GL_SCISSOR_TEST);
 }
 
 void gfx_set_view(struct texture *t)
@@ -459,19 +553,83 @@ void gfx_reset_view(void)
 	view = &main_surface;
 }
 
+/*
+ * Render batching. Between gfx_batch_begin() and gfx_batch_end(), GL state
+ * which is shared by consecutive jobs (the program, the texture bound to
+ * unit 0 and the vertex array setup) is only updated when it changes, and
+ * is not torn down after each job.
+ */
+static struct {
+	bool active;
+	bool valid;
+	bool texture_bound;
+	GLuint program;
+	GLuint texture;
+	struct shader *shader;
+	enum gfx_shape shape;
+} batch;
+
+static void batch_teardown(void)
+{
+	if (!batch.valid)
+		return;
+	glDisableVertexAttribArray(batch.shader->vertex_pos);
+	glDisableVertexAttribArray(batch.shader->vertex_uv);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	batch.valid = false;
+}
+
+void gfx_batch_begin(void)
+{
+	batch.active = true;
+	batch.valid = false;
+}
+
+void gfx_batch_end(void)
+{
+	batch_teardown();
+	batch.active = false;
+}
+
+/*
+ * Must be called before issuing GL calls which change the state cached by
+ * the current batch (if any).
+ */
+void gfx_batch_invalidate(void)
+{
+	batch_teardown();
+}
+
+/*
+ * Called when the binding of GL_TEXTURE_2D on unit 0 may have changed.
+ */
+static void batch_forget_texture(void)
+{
+	batch.texture_bound = false;
+}
+
 /*
  * Set up mandatory shader arguments.
  */
 void gfx_prepare_job(struct gfx_render_job *job)
 {
-	glUseProgram(job->shader->program);
+	bool new_program = !batch.valid || batch.program != job->shader->program;
+	if (new_program) {
+		glUseProgram(job->shader->program);
+		gfx_stats.shader_switches++;
+	}
 
 	glUniformMatrix4fv(job->shader->world_transform, 1, GL_FALSE, job->world_transform);
 	glUniformMatrix4fv(job->shader->view_transform, 1, GL_FALSE, job->view_transform);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, job->texture);
-	glUniform1i(job->shader->texture, 0);
+	if (!batch.valid || !batch.texture_bound || batch.texture != job->texture) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, job->texture);
+		gfx_stats.texture_binds++;
+	}
+	if (new_program)
+		glUniform1i(job->shader->texture, 0);
 
 	if (job->shader->prepare)
 		job->shader->prepare(job, job->data);
@@ -482,26 +640,42 @@ void gfx_prepare_job(struct gfx_render_job *job)
  */
 void gfx_run_job(struct gfx_render_job *job)
 {
-	glBindVertexArray(sdl.gl.vao);
-	glEnableVertexAttribArray(job->shader->vertex_pos);
-	glEnableVertexAttribArray(job->shader->vertex_uv);
-
-	glBindBuffer(GL_ARRAY_BUFFER, job->shape == GFX_QUADRILATERAL ? sdl.gl.quad_vbo : sdl.gl.vbo);
-	glVertexAttribPointer(job->shader->vertex_pos, 4, GL_FLOAT, GL_FALSE, sizeof(struct gfx_vertex), NULL);
-	glVertexAttribPointer(job->shader->vertex_uv, 2, GL_FLOAT, GL_FALSE, sizeof(struct gfx_vertex), (void*)offsetof(struct gfx_vertex, u));
+	if (!batch.valid || batch.shader != job->shader || batch.shape != job->shape) {
+		if (batch.valid && batch.shader != job->shader) {
+			glDisableVertexAttribArray(batch.shader->vertex_pos);
+			glDisableVertexAttribArray(batch.shader->vertex_uv);
+		}
+		glBindVertexArray(sdl.gl.vao);
+		glEnableVertexAttribArray(job->shader->vertex_pos);
+		glEnableVertexAttribArray(job->shader->vertex_uv);
+
+		glBindBuffer(GL_ARRAY_BUFFER, job->shape == GFX_QUADRILATERAL ? sdl.gl.quad_vbo : sdl.gl.vbo);
+		glVertexAttribPointer(job->shader->vertex_pos, 4, GL_FLOAT, GL_FALSE, sizeof(struct gfx_vertex), NULL);
+		glVertexAttribPointer(job->shader->vertex_uv, 2, GL_FLOAT, GL_FALSE, sizeof(struct gfx_vertex), (void*)offsetof(struct gfx_vertex, u));
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, job->shape == GFX_LINE ? sdl.gl.line_ibo : sdl.gl.rect_ibo);
+	}
 
+	gfx_stats.draw_calls++;
 	switch (job->shape) {
 	case GFX_RECTANGLE:
 	case GFX_QUADRILATERAL:
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sdl.gl.rect_ibo);
 		glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
 		break;
 	case GFX_LINE:
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sdl.gl.line_ibo);
 		glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, NULL);
 		break;
 	}
 
+	if (batch.active) {
+		batch.valid = true;
+		batch.texture_bound = true;
+		batch.program = job->shader->program;
+		batch.texture = job->texture;
+		batch.shader = job->shader;
+		batch.shape = job->shape;
+		return;
+	}
+
 	glDisableVertexAttribArray(job->shader->vertex_pos);
 	glDisableVertexAttribArray(job->shader->vertex_uv);
 	glBindVertexArray(0);
@@ -578,6 +752,7 @@ void gfx_render_quadrilateral(struct texture *t, struct gfx_vertex vertices[4])
 
 static void init_texture(struct texture *t, int w, int h)
 {
+	batch_forget_texture();
 	glGenTextures(1, &t->handle);
 	glBindTexture(GL_TEXTURE_2D, t->handle);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -593,12 +768,19 @@ void gfx_init_texture_with_pixels(struct texture *t, int w, int h, void *pixels)
 {
 	init_texture(t, w, h);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	if (pixels) {
+		gfx_stats.texture_uploads++;
+		gfx_stats.upload_bytes += (uint64_t)w * h * 4;
+	}
 }
 
 void gfx_update_texture_with_pixels(struct texture *t, void *pixels)
 {
+	batch_forget_texture();
 	glBindTexture(GL_TEXTURE_2D, t->handle);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, t->w, t->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	gfx_stats.texture_uploads++;
+	gfx_stats.upload_bytes += (uint64_t)t->w * t->h * 4;
 }
 
 void gfx_init_texture_with_cg(struct texture *t, struct cg *cg)
@@ -661,6 +843,19 @@ void gfx_init_texture_rmap(struct texture *t, int w, int h, uint8_t *rmap)
 {
 	init_texture(t, w, h);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, rmap);
+	if (rmap) {
+		gfx_stats.texture_uploads++;
+		gfx_stats.upload_bytes += (uint64_t)w * h;
+	}
+}
+
+void gfx_update_texture_rmap(struct texture *t, int x, int y, int w, int h, uint8_t *rmap)
+{
+	batch_forget_texture();
+	glBindTexture(GL_TEXTURE_2D, t->handle);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RED, GL_UNSIGNED_BYTE, rmap);
+	gfx_stats.texture_uploads++;
+	gfx_stats.upload_bytes += (uint64_t)w * h;
 }
 
 void gfx_init_texture_blank(struct texture *t, int w, int h)
@@ -676,8 +871,10 @@ void gfx_copy_main_surface(struct texture *dst)
 
 void gfx_delete_texture(struct texture *t)
 {
-	if (t->handle)
+	if (t->handle) {
+		batch_forget_texture();
 		glDeleteTextures(1, &t->handle);
+	}
 	t->handle = 0;
 }
 
@@ -687,7 +884,10 @@ GLuint gfx_set_framebuffer(GLenum target, Texture *t, int x, int y, int w, int h
 	glGenFramebuffers(1, &fbo);
 	glBindFramebuffer(target, fbo);
 	glFramebufferTexture2D(target, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->handle, 0);
+	gfx_stats.fbo_switches++;
 	glViewport(x, y, w, h);
+	if (clip_enabled)
+		glDisable(GL_SCISSOR_TEST);
 
 	if (glCheckFramebufferStatus(target) != GL_FRAMEBUFFER_COMPLETE)
 		ERROR("Incomplete framebuffer");
@@ -699,6 +899,8 @@ void gfx_reset_framebuffer(GLenum target, GLuint fbo)
 	glBindFramebuffer(target, main_surface_fb);
 	glDeleteFramebuffers(1, &fbo);
 	glViewport(0, 0, sdl.w, sdl.h);
+	if (clip_enabled)
+		glEnable(GL_SCISSOR_TEST);
 }
 
 SDL_Color gfx_get_pixel(Texture *t, int x, int y)
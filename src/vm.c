@@ -34,10 +34,15 @@
 
 #include "debugger.h"
 #include "input.h"
+#include "profile.h"
+#include "replay.h"
 #include "savedata.h"
 #include "vm.h"
 #include "vm/heap.h"
+#include "vm/counters.h"
+#include "vm/jit.h"
 #include "vm/page.h"
+#include "vm/string_index.h"
 #include "xsystem4.h"
 
 static inline int32_t lint_clamp(int64_t n)
@@ -57,7 +62,21 @@ static inline int32_t lint_clamp(int64_t n)
 /*
  * NOTE: The current implementation is a simple bytecode interpreter.
  *       System40.exe uses a JIT compiler, and we should too.
+ *
+ *       When compiled with GCC or Clang, the bytecode is pre-decoded at load
+ *       time and executed with computed-goto dispatch (see
+ *       vm_execute_threaded). The switch in execute_instruction() remains the
+ *       reference implementation and handles every instruction which doesn't
+ *       have a dedicated threaded handler (including breakpoints).
  */
+#if defined(__GNUC__) && !defined(VM_NO_THREADED_DISPATCH)
+#define VM_THREADED_DISPATCH
+#endif
+// compiled code is entered from the threaded interpreter, and doesn't count
+// instructions
+#if defined(VM_JIT) && (!defined(VM_THREADED_DISPATCH) || defined(VM_COUNTERS))
+#undef VM_JIT
+#endif
 
 // The stack
 union vm_value *stack = NULL; // the stack
@@ -192,11 +211,9 @@ static union vm_value *stack_peek_ptr(int n)
 	return &stack[stack_ptr - (1 + n)];
 }
 
-// Pop a reference off the stack, returning the address of the referenced object.
-static union vm_value *stack_pop_var(void)
+// Get the address of the variable referenced by the pair (HEAP_INDEX, PAGE_INDEX).
+static union vm_value *page_var(int32_t heap_index, int32_t page_index)
 {
-	int32_t page_index = stack_pop().i;
-	int32_t heap_index = stack_pop().i;
 	if (unlikely(!heap_index_valid(heap_index)))
 		VM_ERROR("Out of bounds heap index: %d/%d", heap_index, page_index);
 	if (unlikely(!heap[heap_index].page || page_index >= heap[heap_index].page->nr_vars))
@@ -204,6 +221,14 @@ static union vm_value *stack_pop_var(void)
 	return &heap[heap_index].page->values[page_index];
 }
 
+// Pop a reference off the stack, returning the address of the referenced object.
+static union vm_value *stack_pop_var(void)
+{
+	int32_t page_index = stack_pop().i;
+	int32_t heap_index = stack_pop().i;
+	return page_var(heap_index, page_index);
+}
+
 union vm_value *stack_peek_var(void)
 {
 	int32_t page_index = stack_peek(0).i;
@@ -227,6 +252,30 @@ static struct string *stack_peek_string(int n)
 	return heap[stack_peek(n).i].s;
 }
 
+/*
+ * Append B to *A, in place if *A is not shared. Allocations are rounded up
+ * to a power of two, so that realloc only has to move the string when it
+ * crosses a size class. This keeps chains of concatenations (e.g. message
+ * text built up with + or +=) linear rather than quadratic.
+ */
+static void vm_string_append(struct string **a, const struct string *b)
+{
+	struct string *s = *a;
+	if (s->ref != 1 || s->cow) {
+		string_append(a, b);
+		return;
+	}
+
+	size_t size = (size_t)s->size + b->size;
+	size_t alloc = 32;
+	while (alloc < sizeof(struct string) + size + 1)
+		alloc *= 2;
+	s = xrealloc(s, alloc);
+	memcpy(s->text + s->size, b->text, b->size + 1);
+	s->size = size;
+	*a = s;
+}
+
 int vm_string_ref(struct string *s)
 {
 	int slot = heap_alloc_slot(VM_STRING);
@@ -368,9 +417,16 @@ static void scenario_call(int slot)
  *   - callee pushes return value on the stack
  *   - RETURN jumps to return address (saved in stack frame)
  */
+#ifdef VM_JIT
+static void jit_count_call(int fno);
+#endif
+
 static int _function_call(int fno, int return_address)
 {
 	struct ain_function *f = &ain->functions[fno];
+#ifdef VM_JIT
+	jit_count_call(fno);
+#endif
 	int slot = heap_alloc_slot(VM_PAGE);
 	heap_set_page(slot, alloc_page(LOCAL_PAGE, fno, f->nr_vars));
 	heap[slot].page->local.struct_ptr = -1;
@@ -480,6 +536,7 @@ static void delegate_call(int dg_no, int return_address)
 void vm_call(int fno, int struct_page)
 {
 	size_t saved_ip = instr_ptr;
+	int32_t saved_hll = profile_vm_enter();
 	if (struct_page < 0) {
 		function_call(fno, VM_RETURN);
 	} else {
@@ -487,6 +544,7 @@ void vm_call(int fno, int struct_page)
 		method_call(fno, VM_RETURN);
 	}
 	vm_execute();
+	profile_vm_leave(saved_hll);
 	instr_ptr = saved_ip;
 }
 
@@ -1525,7 +1583,7 @@ static enum opcode execute_instruction(enum opcode opcode)
 	case S_PLUSA2: {
 		int a = stack_peek(1).i;
 		int b = stack_peek(0).i;
-		string_append(&heap[a].s, heap[b].s);
+		vm_string_append(&heap[a].s, heap[b].s);
 		heap_unref(b);
 		stack_pop();
 		stack_pop();
@@ -1535,9 +1593,15 @@ static enum opcode execute_instruction(enum opcode opcode)
 	case S_ADD: {
 		int b = stack_pop().i;
 		int a = stack_pop().i;
-		// TODO: can use string_append here?
-		stack_push_string(string_concatenate(heap_get_string(a), heap_get_string(b)));
-		heap_unref(a);
+		struct string *sa = heap_get_string(a);
+		if (heap[a].ref == 1 && sa->ref == 1) {
+			// A is a temporary: append to it and reuse its slot
+			vm_string_append(&heap[a].s, heap_get_string(b));
+			stack_push(a);
+		} else {
+			stack_push_string(string_concatenate(sa, heap_get_string(b)));
+			heap_unref(a);
+		}
 		heap_unref(b);
 		break;
 	}
@@ -1585,12 +1649,12 @@ static enum opcode execute_instruction(enum opcode opcode)
 	}
 	case S_LENGTH: {
 		int str = stack_pop_var()->i;
-		stack_push(sjis_count_char(heap_get_string(str)->text));
+		stack_push(vm_string_length(heap_get_string(str)));
 		break;
 	}
 	case S_LENGTH2: {
 		int str = stack_pop().i;
-		stack_push(sjis_count_char(heap_get_string(str)->text));
+		stack_push(vm_string_length(heap_get_string(str)));
 		heap_unref(str);
 		break;
 	}
@@ -1615,7 +1679,7 @@ static enum opcode execute_instruction(enum opcode opcode)
 	case S_GETPART: {
 		int len = stack_pop().i; // length
 		int i = stack_pop().i; // index
-		struct string *s = string_copy(stack_peek_string(0), i, len);
+		struct string *s = vm_string_copy(stack_peek_string(0), i, len);
 		heap_unref(stack_pop().i);
 		stack_push_string(s);
 		break;
@@ -2372,18 +2436,985 @@ static enum opcode execute_instruction(enum opcode opcode)
 	return opcode;
 }
 
+// Execute the instruction at instr_ptr with the switch interpreter.
+void vm_execute_instruction(void)
+{
+	uint16_t opcode = execute_instruction(get_opcode(instr_ptr));
+	instr_ptr += instructions[opcode].ip_inc;
+}
+
+#ifdef VM_THREADED_DISPATCH
+
+/*
+ * Pre-decoded instruction. The handler is the address of a label in
+ * vm_execute_threaded, and the arguments are copied out of the bytecode.
+ * For branch instructions, the target address argument is replaced with the
+ * index of the target instruction.
+ */
+struct vm_insn {
+	const void *handler;
+	uint32_t addr;
+	int32_t args[3];
+	void *native; // JIT entry point
+};
+
+// Pseudo-opcodes for handlers which don't correspond to a real instruction.
+enum {
+	VM_HANDLER_FALLBACK = NR_OPCODES,
+	VM_HANDLER_BAD_IP,
+	VM_HANDLER_JIT,
+	// superinstructions would hide the fused instructions from the counters
+#ifndef VM_COUNTERS
+	// superinstructions (see vm_superinstructions below)
+	SI_LOCAL_REF,
+	SI_STRUCT_REF,
+	SI_GLOBAL_REF,
+	SI_LOCAL_VARREF,
+	SI_STRUCT_VARREF,
+	SI_LOCAL_ASSIGN_IMM,
+	SI_LOCAL_INC,
+	SI_LOCAL_DEC,
+	SI_ASSIGN_POP,
+	SI_ADD_IMM,
+	SI_SUB_IMM,
+	SI_LT_IFZ,
+	SI_GT_IFZ,
+	SI_LTE_IFZ,
+	SI_GTE_IFZ,
+	SI_NOTE_IFZ,
+	SI_EQUALE_IFZ,
+	SI_LOCALREF_LOCALREF,
+#endif
+	NR_VM_HANDLERS
+};
+
+#define SI_MAX_LENGTH 5
+
+#ifndef VM_COUNTERS
+
+/*
+ * Superinstructions: common instruction sequences which are executed by a
+ * single handler. The sequences are taken from instruction pair/triple counts
+ * over the startup and scenario code of several games, and mostly correspond
+ * to how the compiler emits local/member variable access, assignment
+ * statements and conditionals.
+ *
+ * Fusion only replaces the handler of the first instruction in a sequence;
+ * the remaining instructions are left intact so that jumps (including SWITCH
+ * and STRSWITCH targets, which are looked up by address) into the middle of a
+ * sequence still work. Patterns are matched in order, so longer sequences
+ * must come first.
+ */
+static const struct {
+	int handler;
+	int nr_ops;
+	enum opcode ops[SI_MAX_LENGTH];
+} vm_superinstructions[] = {
+	{ SI_LOCAL_ASSIGN_IMM,  5, { PUSHLOCALPAGE, PUSH, PUSH, ASSIGN, POP } },
+	{ SI_LOCAL_REF,         3, { PUSHLOCALPAGE, PUSH, REF } },
+	{ SI_LOCAL_INC,         3, { PUSHLOCALPAGE, PUSH, INC } },
+	{ SI_LOCAL_DEC,         3, { PUSHLOCALPAGE, PUSH, DEC } },
+	{ SI_STRUCT_REF,        3, { PUSHSTRUCTPAGE, PUSH, REF } },
+	{ SI_GLOBAL_REF,        3, { PUSHGLOBALPAGE, PUSH, REF } },
+	{ SI_LOCAL_VARREF,      2, { PUSHLOCALPAGE, PUSH } },
+	{ SI_STRUCT_VARREF,     2, { PUSHSTRUCTPAGE, PUSH } },
+	{ SI_ASSIGN_POP,        2, { ASSIGN, POP } },
+	{ SI_ADD_IMM,           2, { PUSH, ADD } },
+	{ SI_SUB_IMM,           2, { PUSH, SUB } },
+	{ SI_LT_IFZ,            2, { LT, IFZ } },
+	{ SI_GT_IFZ,            2, { GT, IFZ } },
+	{ SI_LTE_IFZ,           2, { LTE, IFZ } },
+	{ SI_GTE_IFZ,           2, { GTE, IFZ } },
+	{ SI_NOTE_IFZ,          2, { NOTE, IFZ } },
+	{ SI_EQUALE_IFZ,        2, { EQUALE, IFZ } },
+	{ SI_LOCALREF_LOCALREF, 2, { SH_LOCALREF, SH_LOCALREF } },
+};
+#endif
+
+#define VM_INSN_NONE 0xFFFFFFFF
+
+static struct vm_insn *vm_insns = NULL; // decoded instructions (+ sentinel)
+static uint32_t vm_nr_insns = 0;
+static uint32_t *vm_insn_index = NULL;  // (address / 2) -> index into vm_insns
+static const void **vm_handlers = NULL;
+
+static void vm_execute_threaded(const void ***handlers_out);
+
+static struct vm_insn *vm_insn_at(size_t addr)
+{
+	if (unlikely(addr >= ain->code_size || (addr & 1) || vm_insn_index[addr/2] == VM_INSN_NONE))
+		VM_ERROR("Illegal instruction pointer: 0x%08lX", addr);
+	return &vm_insns[vm_insn_index[addr/2]];
+}
+
+// Get the index of the argument holding the branch target for OP, or -1.
+static int branch_target_argument(enum opcode op)
+{
+	switch (op) {
+	case JUMP:
+	case IFZ:
+	case IFNZ:
+		return 0;
+	case SH_IF_STRUCTREF_Z:
+	case SH_IF_STRUCT_A_NOT_EMPTY:
+		return 1;
+	case SH_IF_LOC_LT_IMM:
+	case SH_IF_LOC_GE_IMM:
+	case SH_IF_LOC_GT_IMM:
+	case SH_IF_LOC_NE_IMM:
+	case SH_IF_STRUCTREF_NE_LOCALREF:
+	case SH_IF_STRUCTREF_GT_IMM:
+	case SH_IF_STRUCTREF_NE_IMM:
+	case SH_IF_STRUCTREF_EQ_IMM:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+static void decode_instruction(struct vm_insn *insn)
+{
+	uint16_t opcode = get_opcode(insn->addr);
+	enum opcode op = opcode & ~OPTYPE_MASK;
+	int nr_args = (instruction_width(op) - 2) / 4;
+
+	for (int i = 0; i < nr_args && i < 3; i++) {
+		insn->args[i] = LittleEndian_getDW(ain->code, insn->addr + 2 + i*4);
+	}
+
+	// breakpoints are handled by the switch interpreter
+	insn->handler = opcode < NR_OPCODES ? vm_handlers[opcode] : NULL;
+	if (nr_args > 3)
+		insn->handler = NULL;
+
+	int target_arg = branch_target_argument(op);
+	if (insn->handler && target_arg >= 0) {
+		uint32_t target = insn->args[target_arg];
+		if (target < ain->code_size && !(target & 1) && vm_insn_index[target/2] != VM_INSN_NONE)
+			insn->args[target_arg] = vm_insn_index[target/2];
+		else
+			insn->handler = NULL;
+	}
+
+	if (!insn->handler)
+		insn->handler = vm_handlers[VM_HANDLER_FALLBACK];
+	if (insn->native)
+		insn->handler = vm_handlers[VM_HANDLER_JIT];
+}
+
+/*
+ * Replace the handler of the instruction at index I with a superinstruction
+ * if it begins one of the sequences in vm_superinstructions.
+ */
+static void fuse_instruction(possibly_unused uint32_t i)
+{
+#ifndef VM_COUNTERS
+	if (vm_insns[i].native)
+		return;
+	for (unsigned p = 0; p < sizeof(vm_superinstructions)/sizeof(*vm_superinstructions); p++) {
+		int nr_ops = vm_superinstructions[p].nr_ops;
+		if (i + nr_ops > vm_nr_insns)
+			continue;
+		bool match = true;
+		for (int k = 0; k < nr_ops; k++) {
+			struct vm_insn *insn = &vm_insns[i + k];
+			// breakpoints don't match here, and unresolved branches have
+			// the fallback handler
+			if (get_opcode(insn->addr) != vm_superinstructions[p].ops[k]
+					|| insn->handler == vm_handlers[VM_HANDLER_FALLBACK]) {
+				match = false;
+				break;
+			}
+		}
+		if (match) {
+			vm_insns[i].handler = vm_handlers[vm_superinstructions[p].handler];
+			return;
+		}
+	}
+#endif
+}
+
+static void vm_free_decoded(void)
+{
+	free(vm_insns);
+	free(vm_insn_index);
+	vm_insns = NULL;
+	vm_insn_index = NULL;
+	vm_nr_insns = 0;
+}
+
+/*
+ * Translate ain->code into the pre-decoded representation used by
+ * vm_execute_threaded. Returns false if the code couldn't be decoded, in
+ * which case the switch interpreter is used.
+ */
+static bool vm_decode(void)
+{
+	vm_execute_threaded(&vm_handlers);
+
+	// count instructions
+	uint32_t nr_insns = 0;
+	size_t addr = 0;
+	while (addr < ain->code_size) {
+		enum opcode op = get_opcode(addr) & ~OPTYPE_MASK;
+		if (op < 0 || op >= NR_OPCODES) {
+			WARNING("Invalid opcode at 0x%08zx: 0x%04x; using switch dispatch", addr, op);
+			return false;
+		}
+		addr += instruction_width(op);
+		nr_insns++;
+	}
+	if (addr != ain->code_size) {
+		WARNING("Truncated instruction at end of code section; using switch dispatch");
+		return false;
+	}
+
+	vm_nr_insns = nr_insns;
+	vm_insns = xcalloc(nr_insns + 1, sizeof(struct vm_insn));
+	vm_insn_index = xmalloc(((ain->code_size + 1) / 2) * sizeof(uint32_t));
+	memset(vm_insn_index, 0xFF, ((ain->code_size + 1) / 2) * sizeof(uint32_t));
+
+	addr = 0;
+	for (uint32_t i = 0; i < nr_insns; i++) {
+		vm_insns[i].addr = addr;
+		vm_insn_index[addr/2] = i;
+		addr += instruction_width(get_opcode(addr) & ~OPTYPE_MASK);
+	}
+	for (uint32_t i = 0; i < nr_insns; i++) {
+		decode_instruction(&vm_insns[i]);
+	}
+	for (uint32_t i = 0; i < nr_insns; i++) {
+		fuse_instruction(i);
+	}
+
+	// sentinel: falling off the end of the code section is an error
+	vm_insns[nr_insns].addr = ain->code_size;
+	vm_insns[nr_insns].handler = vm_handlers[VM_HANDLER_BAD_IP];
+	return true;
+}
+
+#ifdef VM_COUNTERS
+// the sentinel's address is the end of the code section
+#define COUNT_INSN() \
+	do { \
+		if (instr_ptr < ain->code_size) \
+			VM_COUNT_OPCODE(get_opcode(instr_ptr)); \
+	} while (0)
+#else
+#define COUNT_INSN()
+#endif
+
+#define DISPATCH() \
+	do { \
+		instr_ptr = ip->addr; \
+		COUNT_INSN(); \
+		goto *ip->handler; \
+	} while (0)
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+#define BRANCH(index) do { ip = &vm_insns[index]; DISPATCH(); } while (0)
+#define SKIP(n) do { ip += n; DISPATCH(); } while (0)
+
+/*
+ * Threaded-code interpreter. Executes the pre-decoded instruction stream,
+ * keeping instr_ptr in sync so that call frames, error messages and the
+ * debugger see the same state as with the switch interpreter.
+ *
+ * When called with a non-NULL argument, stores the handler table and returns
+ * without executing anything.
+ */
+static void vm_execute_threaded(const void ***handlers_out)
+{
+	static const void *handlers[NR_VM_HANDLERS] = {
+		[PUSH] = &&op_PUSH,
+		[POP] = &&op_POP,
+		[F_PUSH] = &&op_F_PUSH,
+		[REF] = &&op_REF,
+		[REFREF] = &&op_REFREF,
+		[DUP] = &&op_DUP,
+		[DUP2] = &&op_DUP2,
+		[DUP_U2] = &&op_DUP_U2,
+		[SWAP] = &&op_SWAP,
+		[PUSHGLOBALPAGE] = &&op_PUSHGLOBALPAGE,
+		[PUSHLOCALPAGE] = &&op_PUSHLOCALPAGE,
+		[PUSHSTRUCTPAGE] = &&op_PUSHSTRUCTPAGE,
+		[ASSIGN] = &&op_ASSIGN,
+		[F_ASSIGN] = &&op_ASSIGN,
+		[SH_GLOBALREF] = &&op_SH_GLOBALREF,
+		[SH_LOCALREF] = &&op_SH_LOCALREF,
+		[SH_STRUCTREF] = &&op_SH_STRUCTREF,
+		[SH_LOCALASSIGN] = &&op_SH_LOCALASSIGN,
+		[SH_LOCALINC] = &&op_SH_LOCALINC,
+		[SH_LOCALDEC] = &&op_SH_LOCALDEC,
+		[SH_LOCALREFREF] = &&op_SH_LOCALREFREF,
+		[SH_LOCALASSIGN_SUB_IMM] = &&op_SH_LOCALASSIGN_SUB_IMM,
+		[SH_MEM_ASSIGN_LOCAL] = &&op_SH_MEM_ASSIGN_LOCAL,
+		[SH_MEM_ASSIGN_IMM] = &&op_SH_MEM_ASSIGN_IMM,
+		[SH_LOCAL_ASSIGN_STRUCTREF] = &&op_SH_LOCAL_ASSIGN_STRUCTREF,
+		[SH_STRUCTREF_GT_IMM] = &&op_SH_STRUCTREF_GT_IMM,
+		[CALLFUNC] = &&op_CALLFUNC,
+		[CALLMETHOD] = &&op_CALLMETHOD,
+		[THISCALLMETHOD_NOPARAM] = &&op_THISCALLMETHOD_NOPARAM,
+		[RETURN] = &&op_RETURN,
+		[JUMP] = &&op_JUMP,
+		[IFZ] = &&op_IFZ,
+		[IFNZ] = &&op_IFNZ,
+		[SH_IF_LOC_LT_IMM] = &&op_SH_IF_LOC_LT_IMM,
+		[SH_IF_LOC_GE_IMM] = &&op_SH_IF_LOC_GE_IMM,
+		[SH_IF_LOC_GT_IMM] = &&op_SH_IF_LOC_GT_IMM,
+		[SH_IF_LOC_NE_IMM] = &&op_SH_IF_LOC_NE_IMM,
+		[SH_IF_STRUCTREF_Z] = &&op_SH_IF_STRUCTREF_Z,
+		[SH_IF_STRUCTREF_EQ_IMM] = &&op_SH_IF_STRUCTREF_EQ_IMM,
+		[SH_IF_STRUCTREF_NE_IMM] = &&op_SH_IF_STRUCTREF_NE_IMM,
+		[SH_IF_STRUCTREF_GT_IMM] = &&op_SH_IF_STRUCTREF_GT_IMM,
+		[SH_IF_STRUCTREF_NE_LOCALREF] = &&op_SH_IF_STRUCTREF_NE_LOCALREF,
+		[INV] = &&op_INV,
+		[NOT] = &&op_NOT,
+		[COMPL] = &&op_COMPL,
+		[ADD] = &&op_ADD,
+		[SUB] = &&op_SUB,
+		[MUL] = &&op_MUL,
+		[DIV] = &&op_DIV,
+		[MOD] = &&op_MOD,
+		[AND] = &&op_AND,
+		[OR] = &&op_OR,
+		[XOR] = &&op_XOR,
+		[LSHIFT] = &&op_LSHIFT,
+		[RSHIFT] = &&op_RSHIFT,
+		[LT] = &&op_LT,
+		[GT] = &&op_GT,
+		[LTE] = &&op_LTE,
+		[GTE] = &&op_GTE,
+		[NOTE] = &&op_NOTE,
+		[EQUALE] = &&op_EQUALE,
+		[PLUSA] = &&op_PLUSA,
+		[MINUSA] = &&op_MINUSA,
+		[INC] = &&op_INC,
+		[DEC] = &&op_DEC,
+		[ITOB] = &&op_ITOB,
+		[FTOI] = &&op_FTOI,
+		[ITOF] = &&op_ITOF,
+		[F_ADD] = &&op_F_ADD,
+		[F_SUB] = &&op_F_SUB,
+		[F_MUL] = &&op_F_MUL,
+		[F_DIV] = &&op_F_DIV,
+		[FUNC] = &&op_FUNC,
+		[VM_HANDLER_FALLBACK] = &&op_fallback,
+		[VM_HANDLER_BAD_IP] = &&op_bad_ip,
+		[VM_HANDLER_JIT] = &&op_jit,
+#ifndef VM_COUNTERS
+		[SI_LOCAL_REF] = &&si_LOCAL_REF,
+		[SI_STRUCT_REF] = &&si_STRUCT_REF,
+		[SI_GLOBAL_REF] = &&si_GLOBAL_REF,
+		[SI_LOCAL_VARREF] = &&si_LOCAL_VARREF,
+		[SI_STRUCT_VARREF] = &&si_STRUCT_VARREF,
+		[SI_LOCAL_ASSIGN_IMM] = &&si_LOCAL_ASSIGN_IMM,
+		[SI_LOCAL_INC] = &&si_LOCAL_INC,
+		[SI_LOCAL_DEC] = &&si_LOCAL_DEC,
+		[SI_ASSIGN_POP] = &&si_ASSIGN_POP,
+		[SI_ADD_IMM] = &&si_ADD_IMM,
+		[SI_SUB_IMM] = &&si_SUB_IMM,
+		[SI_LT_IFZ] = &&si_LT_IFZ,
+		[SI_GT_IFZ] = &&si_GT_IFZ,
+		[SI_LTE_IFZ] = &&si_LTE_IFZ,
+		[SI_GTE_IFZ] = &&si_GTE_IFZ,
+		[SI_NOTE_IFZ] = &&si_NOTE_IFZ,
+		[SI_EQUALE_IFZ] = &&si_EQUALE_IFZ,
+		[SI_LOCALREF_LOCALREF] = &&si_LOCALREF_LOCALREF,
+#endif
+	};
+	struct vm_insn *ip;
+
+	if (handlers_out) {
+		*handlers_out = handlers;
+		return;
+	}
+
+	goto lookup;
+
+	//
+	// --- Stack Management ---
+	//
+op_PUSH:
+	stack_push(ip->args[0]);
+	NEXT();
+op_POP:
+	stack_ptr--;
+	NEXT();
+op_F_PUSH:
+	stack_push(ip->args[0]);
+	NEXT();
+op_REF:
+	stack_push(stack_pop_var()->i);
+	NEXT();
+op_REFREF: {
+	union vm_value *ref = stack_pop_var();
+	stack_push(ref[0].i);
+	stack_push(ref[1].i);
+	NEXT();
+}
+op_DUP:
+	stack_push(stack_peek(0).i);
+	NEXT();
+op_DUP2: {
+	int a = stack_peek(1).i;
+	int b = stack_peek(0).i;
+	stack_push(a);
+	stack_push(b);
+	NEXT();
+}
+op_DUP_U2:
+	stack_push(stack_peek(1).i);
+	NEXT();
+op_SWAP: {
+	int a = stack_peek(1).i;
+	stack_set(1, stack_peek(0));
+	stack_set(0, a);
+	NEXT();
+}
+	//
+	// --- Variables ---
+	//
+op_PUSHGLOBALPAGE:
+	stack_push(0);
+	NEXT();
+op_PUSHLOCALPAGE:
+	stack_push(local_page_slot());
+	NEXT();
+op_PUSHSTRUCTPAGE:
+	stack_push(struct_page_slot());
+	NEXT();
+op_ASSIGN: {
+	union vm_value val = stack_pop();
+	stack_pop_var()[0] = val;
+	stack_push(val);
+	NEXT();
+}
+op_SH_GLOBALREF:
+	stack_push(global_get(ip->args[0]).i);
+	NEXT();
+op_SH_LOCALREF:
+	stack_push(local_get(ip->args[0]).i);
+	NEXT();
+op_SH_STRUCTREF:
+	stack_push(member_get(ip->args[0]));
+	NEXT();
+op_SH_LOCALASSIGN:
+	local_set(ip->args[0], ip->args[1]);
+	NEXT();
+op_SH_LOCALINC:
+	local_ptr(ip->args[0])->i++;
+	NEXT();
+op_SH_LOCALDEC:
+	local_ptr(ip->args[0])->i--;
+	NEXT();
+op_SH_LOCALREFREF:
+	stack_push(local_get(ip->args[0]));
+	stack_push(local_get(ip->args[0]+1));
+	NEXT();
+op_SH_LOCALASSIGN_SUB_IMM:
+	local_ptr(ip->args[0])->i -= ip->args[1];
+	NEXT();
+op_SH_MEM_ASSIGN_LOCAL:
+	member_set(ip->args[0], local_get(ip->args[1]).i);
+	NEXT();
+op_SH_MEM_ASSIGN_IMM:
+	member_set(ip->args[0], ip->args[1]);
+	NEXT();
+op_SH_LOCAL_ASSIGN_STRUCTREF:
+	local_set(ip->args[0], member_get(ip->args[1]).i);
+	NEXT();
+op_SH_STRUCTREF_GT_IMM:
+	stack_push(member_get(ip->args[0]).i > ip->args[1] ? 1 : 0);
+	NEXT();
+	//
+	// --- Control Flow ---
+	//
+op_CALLFUNC:
+	function_call(ip->args[0], instr_ptr + instruction_width(CALLFUNC));
+	goto lookup;
+op_CALLMETHOD:
+	method_call(ip->args[0], instr_ptr + instruction_width(CALLMETHOD));
+	goto lookup;
+op_THISCALLMETHOD_NOPARAM: {
+	int this_page = struct_page_slot();
+	function_call(ip->args[0], instr_ptr + instruction_width(THISCALLMETHOD_NOPARAM));
+	set_struct_page(this_page);
+	goto lookup;
+}
+op_RETURN:
+	function_return();
+	goto lookup;
+op_JUMP:
+	BRANCH(ip->args[0]);
+op_IFZ:
+	if (!stack_pop().i)
+		BRANCH(ip->args[0]);
+	NEXT();
+op_IFNZ:
+	if (stack_pop().i)
+		BRANCH(ip->args[0]);
+	NEXT();
+op_SH_IF_LOC_LT_IMM:
+	if (local_get(ip->args[0]).i < ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_LOC_GE_IMM:
+	if (local_get(ip->args[0]).i >= ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_LOC_GT_IMM:
+	if (local_get(ip->args[0]).i > ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_LOC_NE_IMM:
+	if (local_get(ip->args[0]).i != ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_STRUCTREF_Z:
+	if (!member_get(ip->args[0]).i)
+		BRANCH(ip->args[1]);
+	NEXT();
+op_SH_IF_STRUCTREF_EQ_IMM:
+	if (member_get(ip->args[0]).i == ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_STRUCTREF_NE_IMM:
+	if (member_get(ip->args[0]).i != ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_STRUCTREF_GT_IMM:
+	if (member_get(ip->args[0]).i > ip->args[1])
+		BRANCH(ip->args[2]);
+	NEXT();
+op_SH_IF_STRUCTREF_NE_LOCALREF:
+	if (member_get(ip->args[0]).i != local_get(ip->args[1]).i)
+		BRANCH(ip->args[2]);
+	NEXT();
+	//
+	// --- Arithmetic ---
+	//
+op_INV:
+	stack[stack_ptr-1].i = -stack[stack_ptr-1].i;
+	NEXT();
+op_NOT:
+	stack[stack_ptr-1].i = !stack[stack_ptr-1].i;
+	NEXT();
+op_COMPL:
+	stack[stack_ptr-1].i = ~stack[stack_ptr-1].i;
+	NEXT();
+op_ADD:
+	stack[stack_ptr-2].i += stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_SUB:
+	stack[stack_ptr-2].i -= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_MUL:
+	stack[stack_ptr-2].i *= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_DIV:
+	if (!stack[stack_ptr-1].i) {
+		stack[stack_ptr-2].i = 0;
+	} else {
+		stack[stack_ptr-2].i /= stack[stack_ptr-1].i;
+	}
+	stack_ptr--;
+	NEXT();
+op_MOD:
+	if (!stack[stack_ptr-1].i) {
+		stack[stack_ptr-2].i = 0;
+	} else {
+		stack[stack_ptr-2].i %= stack[stack_ptr-1].i;
+	}
+	stack_ptr--;
+	NEXT();
+op_AND:
+	stack[stack_ptr-2].i &= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_OR:
+	stack[stack_ptr-2].i |= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_XOR:
+	stack[stack_ptr-2].i ^= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_LSHIFT:
+	stack[stack_ptr-2].i <<= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_RSHIFT:
+	stack[stack_ptr-2].i >>= stack[stack_ptr-1].i;
+	stack_ptr--;
+	NEXT();
+op_LT:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i < stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_GT:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i > stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_LTE:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i <= stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_GTE:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i >= stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_NOTE:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i != stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_EQUALE:
+	stack[stack_ptr-2].i = stack[stack_ptr-2].i == stack[stack_ptr-1].i ? 1 : 0;
+	stack_ptr--;
+	NEXT();
+op_PLUSA: {
+	int32_t n = stack_pop().i;
+	stack_push(stack_pop_var()->i += n);
+	NEXT();
+}
+op_MINUSA: {
+	int32_t n = stack_pop().i;
+	stack_push(stack_pop_var()->i -= n);
+	NEXT();
+}
+op_INC:
+	stack_pop_var()[0].i++;
+	NEXT();
+op_DEC:
+	stack_pop_var()[0].i--;
+	NEXT();
+op_ITOB:
+	stack_set(0, !!stack_peek(0).i);
+	NEXT();
+	//
+	// --- Floating Point Arithmetic ---
+	//
+op_FTOI:
+	stack_set(0, (int32_t)stack_peek(0).f);
+	NEXT();
+op_ITOF:
+	stack_set(0, (float)stack_peek(0).i);
+	NEXT();
+op_F_ADD: {
+	float f = stack_pop().f;
+	stack_set(0, stack_peek(0).f + f);
+	NEXT();
+}
+op_F_SUB: {
+	float f = stack_pop().f;
+	stack_set(0, stack_peek(0).f - f);
+	NEXT();
+}
+op_F_MUL: {
+	float f = stack_pop().f;
+	stack_set(0, stack_peek(0).f * f);
+	NEXT();
+}
+op_F_DIV: {
+	float f = stack_pop().f;
+	stack_set(0, stack_peek(0).f / f);
+	NEXT();
+}
+	// -- NOOPs ---
+op_FUNC:
+	NEXT();
+
+#ifndef VM_COUNTERS
+	//
+	// --- Superinstructions ---
+	//
+	// The arguments of the fused instructions are read from the following
+	// entries, e.g. ip[1].args[0] is the argument of the second instruction.
+	//
+si_LOCAL_REF:
+	stack_push(page_var(local_page_slot(), ip[1].args[0])->i);
+	SKIP(3);
+si_STRUCT_REF:
+	stack_push(page_var(struct_page_slot(), ip[1].args[0])->i);
+	SKIP(3);
+si_GLOBAL_REF:
+	stack_push(page_var(0, ip[1].args[0])->i);
+	SKIP(3);
+si_LOCAL_VARREF:
+	stack_push(local_page_slot());
+	stack_push(ip[1].args[0]);
+	SKIP(2);
+si_STRUCT_VARREF:
+	stack_push(struct_page_slot());
+	stack_push(ip[1].args[0]);
+	SKIP(2);
+si_LOCAL_ASSIGN_IMM:
+	page_var(local_page_slot(), ip[1].args[0])->i = ip[2].args[0];
+	SKIP(5);
+si_LOCAL_INC:
+	page_var(local_page_slot(), ip[1].args[0])->i++;
+	SKIP(3);
+si_LOCAL_DEC:
+	page_var(local_page_slot(), ip[1].args[0])->i--;
+	SKIP(3);
+si_ASSIGN_POP: {
+	union vm_value val = stack_pop();
+	stack_pop_var()[0] = val;
+	SKIP(2);
+}
+si_ADD_IMM:
+	stack[stack_ptr-1].i += ip->args[0];
+	SKIP(2);
+si_SUB_IMM:
+	stack[stack_ptr-1].i -= ip->args[0];
+	SKIP(2);
+#define CMP_IFZ(op) \
+	do { \
+		int32_t b = stack_pop().i; \
+		int32_t a = stack_pop().i; \
+		if (!(a op b)) \
+			BRANCH(ip[1].args[0]); \
+		SKIP(2); \
+	} while (0)
+si_LT_IFZ:
+	CMP_IFZ(<);
+si_GT_IFZ:
+	CMP_IFZ(>);
+si_LTE_IFZ:
+	CMP_IFZ(<=);
+si_GTE_IFZ:
+	CMP_IFZ(>=);
+si_NOTE_IFZ:
+	CMP_IFZ(!=);
+si_EQUALE_IFZ:
+	CMP_IFZ(==);
+#undef CMP_IFZ
+si_LOCALREF_LOCALREF:
+	stack_push(local_get(ip[0].args[0]).i);
+	stack_push(local_get(ip[1].args[0]).i);
+	SKIP(2);
+#endif
+
+	// Everything else is executed by the switch interpreter.
+op_fallback:
+	vm_execute_instruction();
+	// fast path: execution continues at the next instruction
+	if (instr_ptr == ip[1].addr)
+		NEXT();
+	goto lookup;
+op_bad_ip:
+	VM_ERROR("Illegal instruction pointer: 0x%08lX", instr_ptr);
+op_jit:
+#ifdef VM_JIT
+	jit_enter(ip->native);
+#endif
+	goto lookup;
+
+lookup:
+	if (instr_ptr == VM_RETURN)
+		return;
+	ip = vm_insn_at(instr_ptr);
+	DISPATCH();
+}
+
+#undef COUNT_INSN
+#undef DISPATCH
+#undef NEXT
+#undef BRANCH
+#undef SKIP
+
+#endif /* VM_THREADED_DISPATCH */
+
+#ifdef VM_JIT
+
+static bool jit_enabled = false;
+static uint32_t *jit_call_count = NULL;
+static struct jit_function **jit_functions = NULL;
+
+// call count of functions which failed to compile
+#define JIT_NOT_COMPILABLE UINT32_MAX
+
+// Get the index of the first instruction after the function body containing
+// the instruction at index I.
+static uint32_t function_end(uint32_t i)
+{
+	while (i < vm_nr_insns) {
+		enum opcode op = get_opcode(vm_insns[i].addr) & ~OPTYPE_MASK;
+		if (op == FUNC || op == ENDFUNC)
+			break;
+		i++;
+	}
+	return i;
+}
+
+static void jit_compile_function(int fno)
+{
+	uint32_t addr = ain->functions[fno].address;
+	if (addr >= ain->code_size || (addr & 1) || vm_insn_index[addr/2] == VM_INSN_NONE)
+		return;
+
+	uint32_t start = vm_insn_index[addr/2];
+	uint32_t end = function_end(start);
+	if (start == end)
+		return;
+
+	struct jit_function *f = jit_compile(fno, addr, vm_insns[end].addr);
+	if (!f) {
+		jit_call_count[fno] = JIT_NOT_COMPILABLE;
+		return;
+	}
+	jit_functions[fno] = f;
+	for (uint32_t i = start; i < end; i++) {
+		vm_insns[i].native = jit_entry_point(f, vm_insns[i].addr);
+		if (vm_insns[i].native)
+			vm_insns[i].handler = vm_handlers[VM_HANDLER_JIT];
+	}
+}
+
+static void jit_count_call(int fno)
+{
+	uint32_t threshold = config.jit_threshold;
+	if (jit_enabled && jit_call_count[fno] < threshold && ++jit_call_count[fno] == threshold)
+		jit_compile_function(fno);
+}
+
+static void jit_discard_function(int fno)
+{
+	if (jit_functions[fno]) {
+		jit_free(jit_functions[fno]);
+		jit_functions[fno] = NULL;
+	}
+}
+
+/*
+ * Return the instructions in the range [start, end) to the interpreter.
+ * The caller is responsible for discarding the native code.
+ */
+static void jit_uncompile_range(uint32_t start, uint32_t end)
+{
+	bool compiled = false;
+	for (uint32_t i = start; i < end; i++) {
+		if (vm_insns[i].native) {
+			vm_insns[i].native = NULL;
+			decode_instruction(&vm_insns[i]);
+			compiled = true;
+		}
+	}
+	if (!compiled)
+		return;
+	for (uint32_t i = start; i < end; i++) {
+		fuse_instruction(i);
+	}
+	jit_invalidate();
+}
+
+// Return the function containing the instruction at index I to the interpreter.
+static void jit_uncompile_function(uint32_t i)
+{
+	uint32_t start = i;
+	while (start > 0 && (get_opcode(vm_insns[start-1].addr) & ~OPTYPE_MASK) != FUNC)
+		start--;
+	jit_uncompile_range(start, function_end(i));
+
+	// allow the function to be recompiled once it becomes hot again
+	if (start > 0) {
+		int fno = vm_insns[start-1].args[0];
+		if (fno >= 0 && fno < ain->nr_functions) {
+			jit_discard_function(fno);
+			jit_call_count[fno] = 0;
+		}
+	}
+}
+
+static void jit_init(void)
+{
+	jit_call_count = xcalloc(ain->nr_functions, sizeof(uint32_t));
+	jit_functions = xcalloc(ain->nr_functions, sizeof(struct jit_function*));
+	jit_enabled = true;
+}
+
+#endif /* VM_JIT */
+
+bool vm_jit_is_enabled(void)
+{
+#ifdef VM_JIT
+	return jit_enabled;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Enable or disable the JIT compiler at runtime. When disabled, all compiled
+ * code is discarded and execution continues in the interpreter. Returns false
+ * if the JIT compiler is not available.
+ */
+bool vm_jit_set_enabled(bool enable)
+{
+#ifdef VM_JIT
+	if (!jit_call_count)
+		return false;
+	if (!enable && jit_enabled) {
+		jit_uncompile_range(0, vm_nr_insns);
+		for (int i = 0; i < ain->nr_functions; i++) {
+			jit_discard_function(i);
+		}
+		memset(jit_call_count, 0, ain->nr_functions * sizeof(uint32_t));
+	}
+	jit_enabled = enable;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Overwrite the opcode at ADDR (e.g. to set or clear a breakpoint), keeping
+ * the pre-decoded instruction stream in sync.
+ */
+void vm_patch_opcode(uint32_t addr, uint16_t opcode)
+{
+	LittleEndian_putW(ain->code, addr, opcode);
+#ifdef VM_THREADED_DISPATCH
+	if (!vm_insns || addr >= ain->code_size || (addr & 1) || vm_insn_index[addr/2] == VM_INSN_NONE)
+		return;
+
+	// re-decode every instruction which could begin a superinstruction
+	// containing the patched instruction
+	uint32_t i = vm_insn_index[addr/2];
+#ifdef VM_JIT
+	// compiled code doesn't check for breakpoints
+	if (jit_call_count)
+		jit_uncompile_function(i);
+#endif
+	uint32_t start = i >= SI_MAX_LENGTH - 1 ? i - (SI_MAX_LENGTH - 1) : 0;
+	decode_instruction(&vm_insns[i]);
+	for (uint32_t j = start; j <= i; j++) {
+		if (j != i)
+			decode_instruction(&vm_insns[j]);
+		fuse_instruction(j);
+	}
+#endif
+}
+
 static void vm_execute(void)
 {
+#ifdef VM_THREADED_DISPATCH
+	if (vm_insns) {
+		vm_execute_threaded(NULL);
+		return;
+	}
+#endif
 	for (;;) {
-		uint16_t opcode;
 		if (instr_ptr == VM_RETURN)
 			return;
 		if (unlikely(instr_ptr >= ain->code_size)) {
 			VM_ERROR("Illegal instruction pointer: 0x%08lX", instr_ptr);
 		}
-		opcode = get_opcode(instr_ptr);
-		opcode = execute_instruction(opcode);
-		instr_ptr += instructions[opcode].ip_inc;
+		VM_COUNT_OPCODE(get_opcode(instr_ptr));
+		vm_execute_instruction();
 	}
 }
 
@@ -2420,6 +3451,7 @@ static void vm_free(void)
 	// free globals
 	if (heap_size > 0 && heap[0].ref > 0)
 		exit_unref(0);
+	vm_string_index_clear();
 
 	vm_reset_once = true;
 }
@@ -2435,7 +3467,23 @@ _Noreturn void vm_reset(void)
 int vm_execute_ain(struct ain *program)
 {
 	ain = program;
-	setjmp(reset_buf);
+#ifdef VM_THREADED_DISPATCH
+	if (config.vm_dispatch == VM_DISPATCH_THREADED && !vm_insns) {
+		if (!vm_decode())
+			vm_free_decoded();
+	}
+#endif
+#ifdef VM_JIT
+	if (config.jit && vm_insns && !jit_call_count)
+		jit_init();
+#endif
+	if (setjmp(reset_buf)) {
+		profile_current_hll = PROFILE_NO_HLL;
+#ifdef VM_JIT
+		// vm_reset may have been called from within native code
+		jit_reset_stack();
+#endif
+	}
 
 	// initialize VM state
 	if (!stack) {
@@ -2519,11 +3567,14 @@ _Noreturn void _vm_error(const char *fmt, ...)
 
 int vm_time(void)
 {
-	return SDL_GetTicks();
+	return replay_time(SDL_GetTicks());
 }
 
 void vm_sleep(int ms)
 {
+	// the clock is read from the log during replay, so there's no need to wait
+	if (replay_mode == REPLAY_PLAY)
+		return;
 	SDL_Delay(ms);
 }
 